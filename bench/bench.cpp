@@ -0,0 +1,430 @@
+/*!
+	@file
+	@brief Benchmarks of library hot paths
+	@author Philip Pavo
+
+	Every case prints throughput, latency percentiles and heap allocations
+	per operation. Run with a substring to select cases: ./vkbench parse
+*/
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "../src/vklib.h"
+#include "../src/vkstream.h"
+#include "../src/vkcolumns.h"
+#include "../src/vkstore.h"
+#include "../src/vkquery.h"
+#include "../src/vkparams.h"
+#include "../src/vktransport.h"
+#include "../test/fixtures.h"
+#include "loopback.h"
+
+using namespace std;
+
+// RUNNER
+static string filter;
+static volatile size_t sink;
+
+/**
+	Run case and print its line
+
+	@param name case name
+	@param samples number of timed samples
+	@param batch operations in one sample
+	@param operation code of one operation
+	@param note extra text printed after the numbers
+*/
+static void run(const string &name, size_t samples, size_t batch, function<void()> operation, const string &note = ""){
+	if(name.find(filter) == string::npos) return;
+
+	// Warm up caches, pools and connections
+	for(size_t i = 0; i < batch && i < 100; i++) operation();
+
+	vector<double> times(samples);
+	size_t allocations_before = allocations;
+	size_t allocated_before = allocated;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(size_t i = 0; i < samples; i++){
+		chrono::steady_clock::time_point sample = chrono::steady_clock::now();
+		for(size_t j = 0; j < batch; j++) operation();
+		times[i] = chrono::duration<double, nano>(chrono::steady_clock::now() - sample).count() / batch;
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	double operations = (double)samples * batch;
+	double allocs = (allocations - allocations_before) / operations;
+	double bytes = (allocated - allocated_before) / operations;
+
+	sort(times.begin(), times.end());
+	printf("%-34s %11.0f op/s  p50 %9.0f ns  p90 %9.0f ns  p99 %9.0f ns  %8.1f allocs/op  %9.0f B/op  %s\n",
+		name.c_str(), operations / elapsed, times[samples / 2], times[samples * 9 / 10], times[samples * 99 / 100],
+		allocs, bytes, note.c_str());
+	fflush(stdout);
+}
+
+// PAYLOADS
+/**
+	@param users number of users
+	@param search build users.search response instead of users.get
+	@return response text
+*/
+static string payload(int users, bool search){
+	Json::Value items(Json::arrayValue);
+	for(int i = 0; i < users; i++){
+		items.append(user(i + 1));
+	}
+	Json::Value root;
+	if(search){
+		root["response"]["count"] = users;
+		root["response"]["items"] = items;
+	}else{
+		root["response"] = items;
+	}
+	Json::FastWriter writer;
+	return writer.write(root);
+}
+
+// CASES
+static void encoding(){
+	string ascii(64, 'a');
+	string cyrillic = "Иван Петров Москва Санкт-Петербург";
+	string large(4096, 'x');
+	run("urlencode ascii 64B", 2000, 1000, [&](){ sink += VK::Utils::urlencode(ascii).size(); });
+	run("urlencode cyrillic 61B", 2000, 1000, [&](){ sink += VK::Utils::urlencode(cyrillic).size(); });
+	run("urlencode ascii 4KB", 2000, 20, [&](){ sink += VK::Utils::urlencode(large).size(); });
+
+	map<string, string> params;
+	params["q"] = cyrillic;
+	params["fields"] = "photo_50,city,verified,sex,bdate,universities,schools";
+	params["count"] = "1000";
+	params["offset"] = "0";
+	params["sort"] = "0";
+	params["access_token"] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef012345";
+	run("data2str 6 params", 2000, 200, [&](){ sink += VK::Utils::data2str(params).size(); });
+
+	vector<string> fields;
+	fields.push_back("photo_50");
+	fields.push_back("city");
+	fields.push_back("verified");
+	run("Params build+encode 6 params", 2000, 200, [&](){
+		VK::Params typed;
+		typed.set(VK::Keys::Q, cyrillic).set(VK::Keys::FIELDS, fields).set(VK::Keys::COUNT, 1000)
+			.set(VK::Keys::OFFSET, 0).set(VK::Keys::SORT, 0).set(VK::Keys::ACCESS_TOKEN, params["access_token"]);
+		string body;
+		body.reserve(typed.encodedSize());
+		typed.encode(body);
+		sink += body.size();
+	});
+}
+
+static void parsing(){
+	int sizes[] = {10, 100, 1000};
+	for(int k = 0; k < 3; k++){
+		int users = sizes[k];
+		size_t samples = users == 1000 ? 50 : 500;
+		string text = payload(users, false);
+		string size = to_string(users) + " users";
+		string note = to_string(text.size() / 1024) + " KB";
+
+		run("parse dom " + size, samples, 1, [&](){
+			Json::Value root;
+			Json::Reader reader;
+			reader.parse(text, root, false);
+			vector<VK::UserFull> list;
+			VK::UsersList::parse(root["response"], list);
+			sink += list.size();
+		}, note);
+
+		run("parse dom projected " + size, samples, 1, [&](){
+			Json::Value root;
+			Json::Reader reader;
+			reader.parse(text, root, false);
+			vector<VK::UserFull> list;
+			VK::UsersList::parse(root["response"], list, VK::UserFull::Fields::parse("sex,city"));
+			sink += list.size();
+		}, "fields=sex,city");
+
+		run("parse stream " + size, samples, 1, [&](){
+			VK::UsersStream users;
+			VK::JsonStream stream(&users);
+			for(size_t i = 0; i < text.size(); i += 16384){
+				stream.feed(text.data() + i, min((size_t)16384, text.size() - i));
+			}
+			stream.finish();
+			sink += users.users.size();
+		}, "16 KB chunks");
+
+		run("parse stream projected " + size, samples, 1, [&](){
+			VK::UsersStream users(nullptr, VK::UserFull::Fields::parse("sex,city"));
+			VK::JsonStream stream(&users);
+			for(size_t i = 0; i < text.size(); i += 16384){
+				stream.feed(text.data() + i, min((size_t)16384, text.size() - i));
+			}
+			stream.finish();
+			sink += users.users.size();
+		}, "fields=sex,city");
+	}
+}
+
+static void models(){
+	Json::Value root;
+	Json::Reader reader;
+	reader.parse(payload(1000, false), root, false);
+	vector<VK::UserFull> users;
+	VK::UsersList::parse(root["response"], users);
+
+	size_t i = 0;
+	run("UserFull copy", 2000, 100, [&](){
+		VK::UserFull copy = users[i++ % users.size()];
+		sink += copy.id;
+	});
+	run("UserFull move", 2000, 100, [&](){
+		VK::UserFull copy = users[i % users.size()];
+		VK::UserFull moved = std::move(copy);
+		sink += moved.id;
+	}, "includes one copy");
+
+	size_t vector_bytes = users.capacity() * sizeof(VK::UserFull);
+	for(size_t j = 0; j < users.size(); j++){
+		vector_bytes += users[j].first_name.capacity() + users[j].last_name.capacity()
+			+ users[j].photo_50.capacity() + users[j].photo_100.capacity() + users[j].photo_200.capacity()
+			+ users[j].status.capacity() + users[j].domain.capacity();
+	}
+	VK::UsersColumns columns(users);
+	run("UsersColumns push 1000 users", 100, 1, [&](){
+		VK::UsersColumns built(users);
+		sink += built.size();
+	}, "columns " + to_string(columns.memory() / 1024) + " KB vs vector " + to_string(vector_bytes / 1024) + " KB");
+
+	VK::StringPool::Stats pool = VK::StringPool::shared().getStats();
+	run("intern repeated title", 2000, 1000, [&](){
+		VK::Interned title("Москва");
+		sink += title.size();
+	}, "pool saved " + to_string(pool.saved_bytes / 1024) + " KB");
+}
+
+static void snapshots(){
+	string text = payload(1000, false);
+	Json::Value root;
+	Json::Reader reader;
+	reader.parse(text, root, false);
+	VK::UsersList users(root["response"]);
+
+	ostringstream out;
+	{
+		VK::SnapshotWriter writer(out);
+		writer.write(users);
+	}
+	string snapshot = out.str();
+	string note = "snapshot " + to_string(snapshot.size() / 1024) + " KB vs json " + to_string(text.size() / 1024) + " KB";
+
+	run("load json 1000 users", 50, 1, [&](){
+		Json::Value parsed;
+		Json::Reader json;
+		json.parse(text, parsed, false);
+		vector<VK::UserFull> list;
+		VK::UsersList::parse(parsed["response"], list);
+		sink += list.size();
+	}, "Json::Reader + UsersList::parse");
+
+	run("snapshot write 1000 users", 50, 1, [&](){
+		ostringstream stream;
+		VK::SnapshotWriter writer(stream);
+		writer.write(users);
+		writer.finish();
+		sink += writer.size();
+	}, note);
+
+	run("snapshot load 1000 users", 50, 1, [&](){
+		VK::SnapshotReader snapshot_reader(snapshot.data(), snapshot.size());
+		vector<VK::UserFull> list;
+		list.reserve(1000);
+		VK::UserFull user;
+		while(snapshot_reader.next(user)) list.push_back(user);
+		sink += list.size();
+	}, "decode into UserFull");
+
+	run("snapshot view 1000 users", 50, 1, [&](){
+		VK::SnapshotReader snapshot_reader(snapshot.data(), snapshot.size());
+		VK::UserView user;
+		size_t followers = 0;
+		while(snapshot_reader.next(user)) followers += user.followers_count + user.first_name.length;
+		sink += followers;
+	}, "strings read in place");
+}
+
+static void stores(){
+	// Filling 10M users takes seconds and gigabytes, it only runs when selected: ./vkbench UserStore
+	if(filter.find("UserStore") == string::npos) return;
+
+	const int users = 10000000;
+	VK::UserStore store;
+	store.reserve(users, (size_t)users * 40);
+	VK::UserFull user = VK::UserFull();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int id = 1; id <= users; id++){
+		user.id = id;
+		user.first_name = id % 2 ? "Анна" : "Иван";
+		user.last_name = "Петров-" + to_string(id % 97);
+		user.sex = 1 + id % 2;
+		user.online = id % 5 == 0;
+		user.city.id = 1 + id % 1000;
+		user.country.id = 1 + id % 30;
+		user.followers_count = id % 5000;
+		store.put(user);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	VK::UserStore::Stats stats = store.getStats();
+	string note = to_string(stats.memory / 1048576) + " MB, " + to_string(stats.memory / users) + " B/user vs "
+		+ to_string(sizeof(VK::UserFull)) + " B sizeof(UserFull), filled in " + to_string((int)seconds) + " s";
+
+	int id = 0;
+	run("UserStore upsert 10M users", 200, 1000, [&](){
+		id = (int)((id + 7919) % users);
+		user.id = id + 1;
+		user.city.id = 1 + id % 999;
+		sink += store.put(user);
+	}, note);
+	run("UserStore get 10M users", 200, 1000, [&](){
+		id = (int)((id + 7919) % users);
+		sink += store.get(id + 1, user);
+	}, "decode into UserFull");
+	VK::UserView view;
+	run("UserStore view 10M users", 200, 1000, [&](){
+		id = (int)((id + 7919) % users);
+		sink += store.view(id + 1, view) + view.first_name.length;
+	}, "strings read in place");
+	run("UserStore contains 10M users", 200, 1000, [&](){
+		id = (int)((id + 7919) % users);
+		sink += store.contains(id + 1);
+	});
+	run("UserStore find city 10M users", 50, 10, [&](){
+		id = (id + 1) % 1000;
+		sink += store.find(VK::UserStore::CITY, id + 1).size();
+	}, "about 10000 ids per city");
+	run("UserStore count online 10M users", 200, 1000, [&](){
+		sink += store.count(VK::UserStore::ONLINE, 1);
+	});
+}
+
+static void queries(){
+	const int count = 1000000;
+	vector<VK::UserFull> users(count);
+	for(int i = 0; i < count; i++){
+		users[i].id = i + 1;
+		users[i].sex = 1 + i % 2;
+		users[i].online = i % 5 == 0;
+		users[i].city.id = 1 + (i * 7) % 1000;
+		users[i].country.id = 1 + i % 30;
+		users[i].last_seen.time = 1500000000 + i % 86400;
+		users[i].followers_count = (i * 13) % 5000;
+	}
+	VK::UsersColumns columns(users);
+
+	run("filter loop vector<UserFull> 1M", 20, 1, [&](){
+		size_t found = 0;
+		for(size_t i = 0; i < users.size(); i++){
+			const VK::UserFull &user = users[i];
+			if(user.sex == 1 && user.online && user.last_seen.time >= 1500003600 && user.followers_count >= 100) found++;
+		}
+		sink += found;
+	}, "sex, online, last_seen, followers");
+
+	run("UsersQuery count 1M", 20, 1, [&](){
+		VK::UsersQuery query(columns);
+		query.where(VK::UsersQuery::SEX, 1).where(VK::UsersQuery::ONLINE, 1)
+			.where(VK::UsersQuery::LAST_SEEN, 1500003600, 1LL << 40).where(VK::UsersQuery::FOLLOWERS_COUNT, 100, 1 << 30);
+		sink += query.count();
+	}, "same conditions, " + to_string(thread::hardware_concurrency()) + " cores");
+
+	run("UsersQuery count 1M 1 thread", 20, 1, [&](){
+		VK::UsersQuery query(columns);
+		query.threads(1).where(VK::UsersQuery::SEX, 1).where(VK::UsersQuery::ONLINE, 1)
+			.where(VK::UsersQuery::LAST_SEEN, 1500003600, 1LL << 40).where(VK::UsersQuery::FOLLOWERS_COUNT, 100, 1 << 30);
+		sink += query.count();
+	});
+
+	run("group loop vector<UserFull> 1M", 20, 1, [&](){
+		unordered_map<int, long long> followers;
+		for(size_t i = 0; i < users.size(); i++){
+			if(users[i].online) followers[users[i].city.id] += users[i].followers_count;
+		}
+		sink += followers.size();
+	}, "followers of online users by city");
+
+	run("UsersQuery groupBy 1M", 20, 1, [&](){
+		VK::UsersQuery query(columns);
+		query.where(VK::UsersQuery::ONLINE, 1);
+		sink += query.groupBy(VK::UsersQuery::CITY, VK::UsersQuery::FOLLOWERS_COUNT).size();
+	}, "followers of online users by city");
+}
+
+static void network(){
+	Loopback server;
+	string users = payload(100, false);
+	string search = payload(1000, true);
+	server.respond("users.get", users);
+	server.respond("users.search", search);
+	VK::API::api_url = server.url();
+	VK::API api("5.131", "ru", true, "token");
+
+	map<string, string> params;
+	params["user_ids"] = "1,2,3";
+	params["fields"] = "photo_50,city,verified";
+	run("API::call users.get 100", 500, 1, [&](){
+		sink += api.call("users.get", params)["response"].size();
+	}, "loopback");
+
+	run("API::usersSearchStream 1000", 100, 1, [&](){
+		size_t count = 0;
+		api.usersSearchStream(params, [&](VK::UserFull &user){ count += user.id > 0; });
+		sink += count;
+	}, "loopback, callback per user");
+
+	run("API::callAsync x64", 200, 1, [&](){
+		vector<future<Json::Value> > results;
+		for(int i = 0; i < 64; i++) results.push_back(api.callAsync("users.isAppUser", params));
+		for(size_t i = 0; i < results.size(); i++) sink += results[i].get()["response"].asInt();
+	}, "64 small requests in flight, time per batch");
+
+	shared_ptr<VK::ReplayTransport> replay = make_shared<VK::ReplayTransport>();
+	replay->add("users.get", users);
+	replay->add("users.isAppUser", "{\"response\":1}");
+	api.setTransport(replay);
+	run("API::call replay users.get 100", 500, 1, [&](){
+		sink += api.call("users.get", params)["response"].size();
+	}, "no network, parse only");
+	run("API::callAsync replay x64", 200, 1, [&](){
+		vector<future<Json::Value> > results;
+		for(int i = 0; i < 64; i++) results.push_back(api.callAsync("users.isAppUser", params));
+		for(size_t i = 0; i < results.size(); i++) sink += results[i].get()["response"].asInt();
+	}, "time per batch");
+	api.setTransport(NULL);
+
+	api.enableCache();
+	run("API::call cache hit", 200, 100, [&](){
+		sink += api.call("users.isAppUser", params)["response"].asInt();
+	});
+}
+
+int main(int argc, char **argv){
+	if(argc > 1) filter = argv[1];
+	encoding();
+	parsing();
+	models();
+	snapshots();
+	stores();
+	queries();
+	network();
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "loopback.h"
+
+using namespace std;
+
+Loopback::Loopback(){
+	stopping = false;
+	answered = 0;
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+	bind(listener, (sockaddr*)&address, sizeof(address));
+	listen(listener, 1024);
+
+	socklen_t length = sizeof(address);
+	getsockname(listener, (sockaddr*)&address, &length);
+	port = ntohs(address.sin_port);
+	acceptor = thread(&Loopback::accept, this);
+}
+
+Loopback::~Loopback(){
+	stopping = true;
+	shutdown(listener, SHUT_RDWR);
+	close(listener);
+	acceptor.join();
+	{
+		lock_guard<mutex> guard(lock);
+		for(size_t i = 0; i < clients.size(); i++){
+			shutdown(clients[i], SHUT_RDWR);
+		}
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[i].join();
+		close(clients[i]);
+	}
+}
+
+string Loopback::url(){
+	return "http://127.0.0.1:" + to_string(port) + "/method/";
+}
+
+void Loopback::respond(const string &method, const string &body){
+	lock_guard<mutex> guard(lock);
+	bodies[method] = body;
+}
+
+size_t Loopback::requests(){
+	return answered;
+}
+
+void Loopback::accept(){
+	while(!stopping){
+		int client = ::accept(listener, NULL, NULL);
+		if(client < 0) continue;
+		int yes = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		lock_guard<mutex> guard(lock);
+		if(stopping){
+			close(client);
+			break;
+		}
+		clients.push_back(client);
+		threads.push_back(thread(&Loopback::serve, this, client));
+	}
+}
+
+void Loopback::serve(int client){
+	string input;
+	char chunk[16384];
+	while(!stopping){
+		size_t end = input.find("\r\n\r\n");
+		if(end == string::npos){
+			ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+			if(received <= 0) break;
+			input.append(chunk, received);
+			continue;
+		}
+
+		// Request line is "POST /method/users.get HTTP/1.1"
+		string head = input.substr(0, end);
+		size_t path_end = head.find(' ', 5);
+		size_t slash = head.rfind('/', path_end);
+		string method = head.substr(slash + 1, path_end - slash - 1);
+
+		size_t length = 0;
+		size_t header = head.find("Content-Length:");
+		if(header == string::npos) header = head.find("content-length:");
+		if(header != string::npos) length = strtoul(head.c_str() + header + 15, NULL, 10);
+		if(head.find("Expect: 100-continue") != string::npos){
+			static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			send(client, proceed, sizeof(proceed) - 1, MSG_NOSIGNAL);
+		}
+
+		while(input.size() < end + 4 + length){
+			ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+			if(received <= 0) return;
+			input.append(chunk, received);
+		}
+		input.erase(0, end + 4 + length);
+
+		string body;
+		{
+			lock_guard<mutex> guard(lock);
+			map<string, string>::iterator it = bodies.find(method);
+			body = it != bodies.end() ? it->second : "{\"response\":1}";
+		}
+		string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+			+ to_string(body.size()) + "\r\n\r\n" + body;
+		size_t sent = 0;
+		while(sent < response.size()){
+			ssize_t written = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if(written <= 0) return;
+			sent += written;
+		}
+		answered++;
+	}
+}
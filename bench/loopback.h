@@ -0,0 +1,71 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains loopback HTTP server standing in for VK API in benchmarks
+*/
+#include <string>
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+using namespace std;
+
+/**
+	A Loopback class answers HTTP POST requests on 127.0.0.1 with canned
+	bodies chosen by the last path segment (the method name). Connections
+	are kept alive, every connection is served by its own thread
+*/
+class Loopback{
+public:
+	/**
+		Start listening on a free port
+	*/
+	Loopback();
+
+	/**
+		Close listener and all connections
+	*/
+	~Loopback();
+
+	/**
+		@return API url to use as VK::API::api_url
+	*/
+	string url();
+
+	/**
+		Set response body of method
+
+		@param method method name
+		@param body response body
+	*/
+	void respond(const string &method, const string &body);
+
+	/**
+		@return number of requests answered
+	*/
+	size_t requests();
+
+private:
+	int listener;
+	int port;
+	atomic<bool> stopping;
+	atomic<size_t> answered;
+	mutex lock;
+	map<string, string> bodies;
+	vector<int> clients;
+	vector<thread> threads;
+	thread acceptor;
+
+	void accept();
+	void serve(int client);
+
+	Loopback(const Loopback&) = delete;
+	Loopback &operator=(const Loopback&) = delete;
+};
+#endif
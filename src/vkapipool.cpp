@@ -0,0 +1,218 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "vkapipool.h"
+
+using namespace std;
+
+VK::APIPool::APIPool(string version, string lang, bool https, double rate, double burst) : client(version, lang, https, ""){
+	VK::APIPool::rate = rate > VK::RateLimiter::MIN_RATE ? rate : VK::RateLimiter::MIN_RATE;
+	VK::APIPool::burst = burst;
+	next = 0;
+	stopping = false;
+	client.setRateLimit(rate, burst);
+
+	// User authorization failed, flood control, rate limit of method reached
+	cooldowns[5] = 600;
+	cooldowns[9] = 60;
+	cooldowns[29] = 3600;
+}
+
+VK::APIPool::~APIPool(){
+	stopping = true;
+}
+
+void VK::APIPool::add(const string &token){
+	add(token, rate, burst);
+}
+
+void VK::APIPool::add(const string &token, double rate, double burst){
+	// Loads are divided by rate, it is raised to the minimum like the limiter does
+	if(!(rate > VK::RateLimiter::MIN_RATE)) rate = VK::RateLimiter::MIN_RATE;
+	lock_guard<mutex> guard(lock);
+	client.limiter->setLimit(token, rate, burst);
+	for(size_t i = 0; i < tokens.size(); i++){
+		if(tokens[i].token == token){
+			tokens[i].rate = rate;
+			tokens[i].burst = burst;
+			return;
+		}
+	}
+
+	VK::APIPool::Token entry;
+	entry.token = token;
+	entry.rate = rate;
+	entry.burst = burst;
+	entry.added = chrono::steady_clock::now();
+	entry.ejected_until = chrono::steady_clock::time_point();
+	entry.calls = 0;
+	entry.failures = 0;
+	entry.in_flight = 0;
+	entry.last_error = 0;
+	tokens.push_back(entry);
+}
+
+void VK::APIPool::restore(const string &token){
+	lock_guard<mutex> guard(lock);
+	for(size_t i = 0; i < tokens.size(); i++){
+		if(tokens[i].token == token) tokens[i].ejected_until = chrono::steady_clock::time_point();
+	}
+}
+
+void VK::APIPool::setCooldown(int error_code, int seconds){
+	lock_guard<mutex> guard(lock);
+	if(seconds > 0) cooldowns[error_code] = seconds;
+	else cooldowns.erase(error_code);
+}
+
+size_t VK::APIPool::size(){
+	lock_guard<mutex> guard(lock);
+	return tokens.size();
+}
+
+size_t VK::APIPool::available(){
+	lock_guard<mutex> guard(lock);
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	size_t count = 0;
+	for(size_t i = 0; i < tokens.size(); i++){
+		if(tokens[i].ejected_until <= now) count++;
+	}
+	return count;
+}
+
+VK::API &VK::APIPool::api(){
+	return client;
+}
+
+bool VK::APIPool::acquire(const vector<size_t> &tried, size_t &index, string &token){
+	lock_guard<mutex> guard(lock);
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	size_t count = tokens.size();
+	bool found = false;
+	double best = 0;
+
+	// Scan starts after the last taken token, so tokens with equal load take turns
+	for(size_t k = 0; k < count; k++){
+		size_t i = (next + k) % count;
+		VK::APIPool::Token &entry = tokens[i];
+		if(entry.ejected_until > now) continue;
+		if(find(tried.begin(), tried.end(), i) != tried.end()) continue;
+		double load = (entry.in_flight + 1) / entry.rate;
+		if(!found || load < best){
+			found = true;
+			best = load;
+			index = i;
+		}
+	}
+	if(!found) return false;
+
+	VK::APIPool::Token &entry = tokens[index];
+	entry.in_flight++;
+	entry.calls++;
+	token = entry.token;
+	next = index + 1;
+	return true;
+}
+
+bool VK::APIPool::release(size_t index, const Json::Value &resp){
+	int code = 0;
+	if(!resp["success"].asBool()){
+		code = resp["error"][VK::Parameters::ERROR_CODE].asInt();
+		if(!code) code = -1;
+	}
+
+	lock_guard<mutex> guard(lock);
+	VK::APIPool::Token &entry = tokens[index];
+	entry.in_flight--;
+	if(!code) return false;
+
+	entry.failures++;
+	entry.last_error = code;
+	map<int, int>::iterator cooldown = cooldowns.find(code);
+	if(cooldown == cooldowns.end()) return false;
+	entry.ejected_until = chrono::steady_clock::now() + chrono::seconds(cooldown->second);
+	return true;
+}
+
+Json::Value VK::APIPool::unavailable(){
+	Json::Value root;
+	root["success"] = false;
+	root["error"][VK::Parameters::ERROR_CODE] = -1;
+	root["error"][VK::Parameters::ERROR_MSG] = "No access token available";
+	return root;
+}
+
+Json::Value VK::APIPool::call(string method, map<string, string> params, int priority){
+	vector<size_t> tried;
+	Json::Value last;
+	while(true){
+		size_t index;
+		string token;
+		if(!acquire(tried, index, token)) return tried.empty() ? unavailable() : last;
+		params["access_token"] = token;
+		last = client.call(method, params, priority);
+		if(!release(index, last)) return last;
+		tried.push_back(index);
+	}
+}
+
+future<Json::Value> VK::APIPool::callAsync(string method, map<string, string> params){
+	shared_ptr<promise<Json::Value> > result = make_shared<promise<Json::Value> >();
+	callAsync(method, params, [result](Json::Value resp){
+		result->set_value(resp);
+	});
+	return result->get_future();
+}
+
+void VK::APIPool::callAsync(string method, map<string, string> params, function<void(Json::Value)> callback){
+	shared_ptr<VK::APIPool::Call> call = make_shared<VK::APIPool::Call>();
+	call->method = method;
+	call->params = params;
+	call->callback = callback;
+	dispatch(call);
+}
+
+void VK::APIPool::dispatch(shared_ptr<VK::APIPool::Call> call){
+	size_t index;
+	string token;
+	if(stopping || !acquire(call->tried, index, token)){
+		call->callback(call->tried.empty() ? unavailable() : call->last);
+		return;
+	}
+
+	map<string, string> params = call->params;
+	params["access_token"] = token;
+	client.callAsync(call->method, params, [this, call, index](Json::Value resp){
+		if(release(index, resp)){
+			call->tried.push_back(index);
+			call->last = resp;
+			dispatch(call);
+			return;
+		}
+		call->callback(resp);
+	});
+}
+
+vector<VK::APIPool::Stats> VK::APIPool::getStats(){
+	lock_guard<mutex> guard(lock);
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	vector<VK::APIPool::Stats> stats(tokens.size());
+	for(size_t i = 0; i < tokens.size(); i++){
+		VK::APIPool::Token &entry = tokens[i];
+		stats[i].token = entry.token;
+		stats[i].rate = entry.rate;
+		stats[i].calls = entry.calls;
+		stats[i].failures = entry.failures;
+		stats[i].in_flight = entry.in_flight;
+		stats[i].last_error = entry.last_error;
+		stats[i].ejected_for = entry.ejected_until > now ? chrono::duration<double>(entry.ejected_until - now).count() : 0;
+
+		// Bucket starts full, so a burst is budget on top of rate
+		double elapsed = chrono::duration<double>(now - entry.added).count();
+		double budget = entry.rate * elapsed + entry.burst;
+		double granted = client.limiter->getStats(entry.token).granted;
+		stats[i].utilization = budget > 0 ? min(1.0, granted / budget) : 0;
+	}
+	return stats;
+}
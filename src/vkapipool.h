@@ -0,0 +1,224 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains pool of access tokens sharing the load of API calls
+*/
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <functional>
+#include "vklib.h"
+#ifndef VKAPIPOOL_H
+#define VKAPIPOOL_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A APIPool class sends calls on behalf of many access tokens. Every
+		call goes to the eligible token with the least calls in flight
+		relative to its rate, each token is limited by its own bucket of the
+		rate limiter. Tokens answered with an authorization or flood error are
+		ejected for a cooldown and the call is sent again with another token.
+		Cache, metrics, retry policy and transport are set on api(), its rate
+		limiter keeps the limits of tokens and must not be replaced
+	*/
+	class APIPool{
+	public:
+		/**
+			A Stats class describes use of one token
+		*/
+		class Stats{
+		public:
+			string token;
+			double rate;
+			unsigned long calls;
+			unsigned long failures;
+			size_t in_flight;
+
+			/**
+				Seconds until the token is used again, 0 when it is not ejected
+			*/
+			double ejected_for;
+
+			/**
+				Error code of the last failed call, 0 if none failed
+			*/
+			int last_error;
+
+			/**
+				Share of the rate budget used since the token was added, from 0 to 1
+			*/
+			double utilization;
+		};
+
+		/**
+			APIPool constructor
+
+			@param version Api version
+			@param lang Api language
+			@param https Api requests via https
+			@param rate Requests per second of a token
+			@param burst Maximum number of requests of a token sent at once
+		*/
+		APIPool(string version, string lang, bool https, double rate = 3, double burst = 3);
+
+		/**
+			Completes calls in flight, calls which were to be sent again fail
+		*/
+		~APIPool();
+
+		/**
+			Add token with rate of the pool
+
+			@param token access token
+		*/
+		void add(const string &token);
+
+		/**
+			Add token with own rate
+
+			@param token access token
+			@param rate Requests per second
+			@param burst Maximum number of requests sent at once
+		*/
+		void add(const string &token, double rate, double burst);
+
+		/**
+			Return ejected token to service
+
+			@param token access token
+		*/
+		void restore(const string &token);
+
+		/**
+			Set how long tokens are ejected after an error. 0 stops ejecting on the error
+
+			@param error_code VK error code
+			@param seconds cooldown
+		*/
+		void setCooldown(int error_code, int seconds);
+
+		size_t size();
+
+		/**
+			@return number of tokens which are not ejected
+		*/
+		size_t available();
+
+		/**
+			API call with the least loaded token
+
+			@param method method name
+			@param params map of data without access_token
+			@param priority rate limiter priority, higher is served first
+			@return json Json Value Object
+		*/
+		Json::Value call(string method, map<string, string> params, int priority = 0);
+
+		/**
+			Asynchronous API call with the least loaded token
+
+			@param method method name
+			@param params map of data without access_token
+			@return future of json Json Value Object
+		*/
+		future<Json::Value> callAsync(string method, map<string, string> params);
+
+		/**
+			Asynchronous API call with completion callback
+
+			@param method method name
+			@param params map of data without access_token
+			@param callback completion callback
+		*/
+		void callAsync(string method, map<string, string> params, function<void(Json::Value)> callback);
+
+		/**
+			@return stats of every token in the order they were added
+		*/
+		vector<Stats> getStats();
+
+		/**
+			@return API object calls are sent with
+		*/
+		API &api();
+
+	private:
+		class Token{
+		public:
+			string token;
+			double rate;
+			double burst;
+			chrono::steady_clock::time_point added;
+			chrono::steady_clock::time_point ejected_until;
+			unsigned long calls;
+			unsigned long failures;
+			size_t in_flight;
+			int last_error;
+		};
+
+		class Call{
+		public:
+			string method;
+			map<string, string> params;
+			function<void(Json::Value)> callback;
+
+			/**
+				Tokens the call was ejected from, it is not sent with them again
+			*/
+			vector<size_t> tried;
+
+			/**
+				Response of the last ejected token
+			*/
+			Json::Value last;
+		};
+
+		mutex lock;
+		vector<Token> tokens;
+		map<int, int> cooldowns;
+		double rate;
+		double burst;
+		size_t next;
+		atomic<bool> stopping;
+		API client;
+
+		/**
+			Take least loaded token which is not ejected and not in tried
+
+			@param tried tokens to skip
+			@param index taken token index
+			@param token taken access token
+			@return false if no token is eligible
+		*/
+		bool acquire(const vector<size_t> &tried, size_t &index, string &token);
+
+		/**
+			Account finished call of token
+
+			@param index token index
+			@param resp call response
+			@return true if token was ejected and call should be sent with another token
+		*/
+		bool release(size_t index, const Json::Value &resp);
+
+		void dispatch(shared_ptr<Call> call);
+
+		/**
+			@return failed response of a call no token is available for
+		*/
+		static Json::Value unavailable();
+
+		APIPool(const APIPool&) = delete;
+		APIPool &operator=(const APIPool&) = delete;
+	};
+}
+#endif
@@ -0,0 +1,175 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "vkcolumns.h"
+
+using namespace std;
+
+const uint16_t VK::UsersColumns::ONLINE;
+const uint16_t VK::UsersColumns::ONLINE_MOBILE;
+const uint16_t VK::UsersColumns::VERIFIED;
+const uint16_t VK::UsersColumns::BLACKLISTED;
+const uint16_t VK::UsersColumns::HAS_MOBILE;
+const uint64_t VK::UsersColumns::Str::MAX_LENGTH;
+
+VK::UsersColumns::UsersColumns(){
+}
+
+VK::UsersColumns::UsersColumns(const vector<VK::UserFull> &users){
+	reserve(users.size());
+	for(size_t i = 0; i < users.size(); i++){
+		push_back(users[i]);
+	}
+}
+
+VK::UsersColumns::UsersColumns(const VK::UsersList &users){
+	reserve(users.list.size());
+	for(size_t i = 0; i < users.list.size(); i++){
+		push_back(users.list[i]);
+	}
+}
+
+void VK::UsersColumns::reserve(size_t users, size_t heap){
+	id.reserve(users);
+	sex.reserve(users);
+	flags.reserve(users);
+	city.reserve(users);
+	country.reserve(users);
+	followers_count.reserve(users);
+	common_count.reserve(users);
+	last_seen.reserve(users);
+	platform.reserve(users);
+	first_name.reserve(users);
+	last_name.reserve(users);
+	photo_50.reserve(users);
+	photo_100.reserve(users);
+	photo_200.reserve(users);
+	domain.reserve(users);
+	bdate.reserve(users);
+	home_town.reserve(users);
+	status.reserve(users);
+	city_title.reserve(users);
+	country_title.reserve(users);
+	if(heap) VK::UsersColumns::heap.reserve(heap);
+}
+
+VK::UsersColumns::Str VK::UsersColumns::store(const string &value){
+	VK::UsersColumns::Str str;
+	str.offset = heap.size();
+	str.length = value.size() < VK::UsersColumns::Str::MAX_LENGTH ? value.size() : VK::UsersColumns::Str::MAX_LENGTH;
+	heap.append(value, 0, str.length);
+	return str;
+}
+
+VK::UsersColumns::Str VK::UsersColumns::title(const string &value){
+	unordered_map<string, VK::UsersColumns::Str>::iterator it = titles.find(value);
+	if(it != titles.end()) return it->second;
+	VK::UsersColumns::Str str = store(value);
+	titles[value] = str;
+	return str;
+}
+
+void VK::UsersColumns::push_back(const VK::UserFull &user){
+	id.push_back(user.id);
+	sex.push_back((int8_t)user.sex);
+	uint16_t flag = 0;
+	if(user.online) flag |= ONLINE;
+	if(user.online_mobile) flag |= ONLINE_MOBILE;
+	if(user.verified) flag |= VERIFIED;
+	if(user.blacklisted) flag |= BLACKLISTED;
+	if(user.has_mobile) flag |= HAS_MOBILE;
+	flags.push_back(flag);
+	city.push_back(user.city.id);
+	country.push_back(user.country.id);
+	followers_count.push_back(user.followers_count);
+	common_count.push_back(user.common_count);
+	last_seen.push_back(user.last_seen.time);
+	platform.push_back((int8_t)user.last_seen.platform);
+
+	first_name.push_back(store(user.first_name));
+	last_name.push_back(store(user.last_name));
+	photo_50.push_back(store(user.photo_50));
+	photo_100.push_back(store(user.photo_100));
+	photo_200.push_back(store(user.photo_200));
+	domain.push_back(store(user.domain));
+	bdate.push_back(store(user.bdate));
+	home_town.push_back(store(user.home_town));
+	status.push_back(store(user.status));
+	city_title.push_back(title(user.city.title));
+	country_title.push_back(title(user.country.title));
+}
+
+void VK::UsersColumns::get(size_t i, VK::UserFull &user) const{
+	user.id = id[i];
+	user.sex = sex[i];
+	user.online = (flags[i] & ONLINE) != 0;
+	user.online_mobile = (flags[i] & ONLINE_MOBILE) != 0;
+	user.verified = (flags[i] & VERIFIED) != 0;
+	user.blacklisted = (flags[i] & BLACKLISTED) != 0;
+	user.has_mobile = (flags[i] & HAS_MOBILE) != 0;
+	user.city.id = city[i];
+	user.country.id = country[i];
+	user.followers_count = followers_count[i];
+	user.common_count = common_count[i];
+	user.last_seen.time = last_seen[i];
+	user.last_seen.platform = platform[i];
+
+	user.first_name.assign(data(first_name[i]), first_name[i].length);
+	user.last_name.assign(data(last_name[i]), last_name[i].length);
+	user.photo_50.assign(data(photo_50[i]), photo_50[i].length);
+	user.photo_100.assign(data(photo_100[i]), photo_100[i].length);
+	user.photo_200.assign(data(photo_200[i]), photo_200[i].length);
+	user.domain.assign(data(domain[i]), domain[i].length);
+	user.bdate.assign(data(bdate[i]), bdate[i].length);
+	user.home_town.assign(data(home_town[i]), home_town[i].length);
+	user.status.assign(data(status[i]), status[i].length);
+	user.city.title.assign(data(city_title[i]), city_title[i].length);
+	user.country.title.assign(data(country_title[i]), country_title[i].length);
+}
+
+VK::UserFull VK::UsersColumns::get(size_t i) const{
+	VK::UserFull user = VK::UserFull();
+	get(i, user);
+	return user;
+}
+
+vector<VK::UserFull> VK::UsersColumns::toVector() const{
+	vector<VK::UserFull> users(size());
+	for(size_t i = 0; i < users.size(); i++){
+		get(i, users[i]);
+	}
+	return users;
+}
+
+VK::UsersList VK::UsersColumns::toList() const{
+	return VK::UsersList(toVector());
+}
+
+size_t VK::UsersColumns::size() const{
+	return id.size();
+}
+
+void VK::UsersColumns::clear(){
+	*this = VK::UsersColumns();
+}
+
+string VK::UsersColumns::str(const vector<VK::UsersColumns::Str> &column, size_t i) const{
+	return string(data(column[i]), column[i].length);
+}
+
+const char *VK::UsersColumns::data(VK::UsersColumns::Str value) const{
+	return heap.data() + value.offset;
+}
+
+template<typename T> static size_t bytes(const vector<T> &column){
+	return column.capacity() * sizeof(T);
+}
+
+size_t VK::UsersColumns::memory() const{
+	return bytes(id) + bytes(sex) + bytes(flags) + bytes(city) + bytes(country)
+		+ bytes(followers_count) + bytes(common_count) + bytes(last_seen) + bytes(platform)
+		+ bytes(first_name) + bytes(last_name) + bytes(photo_50) + bytes(photo_100) + bytes(photo_200)
+		+ bytes(domain) + bytes(bdate) + bytes(home_town) + bytes(status)
+		+ bytes(city_title) + bytes(country_title) + heap.capacity()
+		+ titles.size() * (sizeof(pair<const string, Str>) + sizeof(void*)) + titles.bucket_count() * sizeof(void*);
+}
@@ -0,0 +1,132 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains columnar storage for large lists of users
+*/
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "vklib.h"
+#ifndef VKCOLUMNS_H
+#define VKCOLUMNS_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A UsersColumns class stores users as structure of arrays: every field
+		is a contiguous column, strings of all columns share one heap buffer.
+		City and country titles are stored once for every distinct title.
+		Keeps id, names, photos, sex, flags, city, country, counters and last seen.
+		Universities, schools, education, contacts and counters map are not stored
+	*/
+	class UsersColumns: public Model{
+	public:
+		/**
+			A Str class references a string in the heap. Offset and length are
+			packed into 8 bytes: heap up to 1 TB, strings up to 16 MB
+		*/
+		class Str{
+		public:
+			static const uint64_t MAX_LENGTH = (1ULL << 24) - 1;
+
+			uint64_t offset: 40;
+			uint64_t length: 24;
+		};
+
+		static const uint16_t ONLINE = 1 << 0;
+		static const uint16_t ONLINE_MOBILE = 1 << 1;
+		static const uint16_t VERIFIED = 1 << 2;
+		static const uint16_t BLACKLISTED = 1 << 3;
+		static const uint16_t HAS_MOBILE = 1 << 4;
+
+		vector<int32_t> id;
+		vector<int8_t> sex;
+		vector<uint16_t> flags;
+		vector<int32_t> city;
+		vector<int32_t> country;
+		vector<int32_t> followers_count;
+		vector<int32_t> common_count;
+		vector<int64_t> last_seen;
+		vector<int8_t> platform;
+
+		vector<Str> first_name;
+		vector<Str> last_name;
+		vector<Str> photo_50;
+		vector<Str> photo_100;
+		vector<Str> photo_200;
+		vector<Str> domain;
+		vector<Str> bdate;
+		vector<Str> home_town;
+		vector<Str> status;
+		vector<Str> city_title;
+		vector<Str> country_title;
+
+		UsersColumns();
+		UsersColumns(const vector<UserFull> &users);
+		UsersColumns(const UsersList &users);
+
+		/**
+			Reserve space for users
+
+			@param users number of users
+			@param heap bytes of strings
+		*/
+		void reserve(size_t users, size_t heap = 0);
+
+		/**
+			Append user
+
+			@param user UserFull object
+		*/
+		void push_back(const UserFull &user);
+
+		/**
+			Fill UserFull object with stored fields of user
+
+			@param i user index
+			@param user UserFull object to fill
+		*/
+		void get(size_t i, UserFull &user) const;
+		UserFull get(size_t i) const;
+
+		vector<UserFull> toVector() const;
+		UsersList toList() const;
+
+		size_t size() const;
+		void clear();
+
+		/**
+			@param column string column
+			@param i user index
+			@return string value
+		*/
+		string str(const vector<Str> &column, size_t i) const;
+
+		/**
+			@param value string reference
+			@return pointer to string characters in the heap, not null terminated
+		*/
+		const char *data(Str value) const;
+
+		/**
+			@return bytes used by columns and heap
+		*/
+		size_t memory() const;
+
+	private:
+		string heap;
+		unordered_map<string, Str> titles;
+
+		Str store(const string &value);
+
+		/**
+			Store title once, later users with the same title share it
+		*/
+		Str title(const string &value);
+	};
+}
+#endif
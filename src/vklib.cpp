@@ -2,9 +2,21 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <random>
 #include "vklib.h"
+#include "vkstream.h"
+#include "vkparams.h"
+#include "vktransport.h"
+#include "vkmetrics.h"
 #include <curl/curl.h>
 #include "jsoncpp/json/json.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -15,242 +27,2000 @@ VK::API::API(string version, string lang, bool https, string access_token){
 	VK::API::lang = lang;
 	VK::API::https = https ? "1" : "0";
 	VK::API::access_token = access_token;
+	VK::API::pool = make_shared<VK::CurlPool>();
+	VK::API::engine_lock = make_shared<mutex>();
+	prepare();
 }
 
-Json::Value VK::API::call(string method, map<string, string> data){
+Json::Value VK::API::call(string method, const map<string, string> &data, int priority){
+	string token = tokenOf(data);
+	string scope = cache ? cacheScope() : string();
+	Json::Value root;
+	if(cache && cache->get(method, data, scope, token, root)) return root;
+
+	int retries;
+	root = send(method, token, requestData(data), priority, retries);
+	if(cache && root["success"].asBool()) cache->put(method, data, scope, token, root);
+	if(retries) root["retries"] = retries;
+	return root;
+}
+
+Json::Value VK::API::call(string method, const VK::Params &params, int priority){
+	// Cache keys are built from maps
+	if(cache) return call(method, params.toMap(), priority);
+
+	string token;
+	if(!params.get("access_token", token)) token = VK::API::access_token;
+	int retries;
+	Json::Value root = send(method, token, requestData(params), priority, retries);
+	if(retries) root["retries"] = retries;
+	return root;
+}
+
+future<Json::Value> VK::API::callAsync(string method, map<string, string> params){
+	shared_ptr<promise<Json::Value> > result = make_shared<promise<Json::Value> >();
+	callAsync(method, params, [result](Json::Value resp){
+		result->set_value(resp);
+	});
+	return result->get_future();
+}
+
+void VK::API::callAsync(string method, map<string, string> params, function<void(Json::Value)> callback){
+	string token = tokenOf(params);
+	string scope = cache ? cacheScope() : string();
+	if(cache){
+		Json::Value root;
+		if(cache->get(method, params, scope, token, root)){
+			callback(root);
+			return;
+		}
+	}
+
+	shared_ptr<VK::API::AsyncCall> call = make_shared<VK::API::AsyncCall>();
+	call->method = method;
+	call->url = VK::API::api_url + method;
+	call->data = requestData(params);
+	call->token = token;
+	call->scope = scope;
+	call->params = params;
+	call->callback = callback;
+	call->limiter = limiter;
+	call->cache = cache;
+	call->metrics = metrics;
+	call->retry = retry;
+	if(transport) call->transport = transport;
+	else{
+		async();
+		call->engine = engine;
+	}
+	call->retries = 0;
+	call->waited = chrono::milliseconds(0);
+	sendAsync(call, chrono::milliseconds(0));
+}
+
+void VK::API::sendAsync(shared_ptr<VK::API::AsyncCall> call, chrono::milliseconds delay){
+	VK::AsyncEngine::Callback completion = [call](bool ok, const string &body){
+		VK::API::complete(call, ok, body);
+	};
+	if(call->metrics) call->start = chrono::steady_clock::now() + delay;
+	string key = call->limiter ? call->token : "";
+
+	// Calls do not keep transport and event loop alive, they may be destroyed while a retry waits
+	shared_ptr<VK::Transport> transport = call->transport.lock();
+	shared_ptr<VK::AsyncEngine> engine = call->engine.lock();
+	if(transport) transport->sendAsync(call->url, call->data, key, completion, delay);
+	else if(engine) engine->post(call->url, call->data, key, completion, delay);
+	else complete(call, false, "API was destroyed before request was sent");
+}
+
+void VK::API::complete(shared_ptr<VK::API::AsyncCall> call, bool ok, const string &body){
+	chrono::steady_clock::time_point received = call->metrics ? chrono::steady_clock::now() : call->start;
+	Json::Value root = ok ? parseResponse(body) : transportError(body);
+	int code = errorCode(root);
+	if(call->limiter && code == 6) call->limiter->drain(call->token);
+	if(call->metrics){
+		// Event loop does not report phases, rate limiter wait is inside total and QUEUE is not observed
+		VK::Metrics::Sample sample;
+		sample.request_bytes = call->data.size();
+		sample.response_bytes = ok ? body.size() : 0;
+		sample.error_code = code;
+		sample.retry = call->retries > 0;
+		sample.phases[VK::Metrics::PARSE] = chrono::duration<double, milli>(chrono::steady_clock::now() - received).count();
+		sample.phases[VK::Metrics::TOTAL] = chrono::duration<double, milli>(chrono::steady_clock::now() - call->start).count();
+		call->metrics->record(call->method, sample);
+	}
+
+	chrono::milliseconds delay;
+	if(call->retry && call->retry->next(call->method, code, call->retries, call->waited, delay)){
+		call->retries++;
+		call->waited += delay;
+		sendAsync(call, delay);
+		return;
+	}
+	if(call->cache && code == 0) call->cache->put(call->method, call->params, call->scope, call->token, root);
+	if(call->retries) root["retries"] = call->retries;
+	call->callback(root);
+}
+
+void VK::API::setRateLimit(double rate, double burst){
+	limiter = make_shared<VK::RateLimiter>(rate, burst);
+	if(engine) engine->setLimiter(limiter);
+	if(transport) transport->setLimiter(limiter);
+}
+
+void VK::API::setRetryPolicy(int max_retries, int base_ms, int max_ms, int budget_ms){
+	retry = make_shared<VK::RetryPolicy>(max_retries, base_ms, max_ms, budget_ms);
+}
+
+void VK::API::enableMetrics(){
+	if(!metrics) metrics = make_shared<VK::Metrics>();
+}
+
+void VK::API::setTransport(shared_ptr<VK::Transport> transport){
+	VK::API::transport = transport;
+	if(transport) transport->setLimiter(limiter);
+}
+
+string VK::API::tokenOf(const map<string, string> &params){
+	map<string, string>::const_iterator it = params.find("access_token");
+	return it != params.end() ? it->second : VK::API::access_token;
+}
+
+void VK::API::throttled(const string &token, const Json::Value &resp){
+	if(limiter && resp["error"]["error_code"].asInt() == 6) limiter->drain(token);
+}
+
+Json::Value VK::API::send(const string &method, const string &token, const string &data, int priority, int &retries){
+	shared_ptr<VK::RetryPolicy> retry = VK::API::retry;
+	chrono::milliseconds waited(0);
+	retries = 0;
+	while(true){
+		Json::Value root = attempt(method, token, data, priority, retries > 0);
+		chrono::milliseconds delay;
+		if(!retry || !retry->next(method, errorCode(root), retries, waited, delay)) return root;
+		this_thread::sleep_for(delay);
+		waited += delay;
+		retries++;
+	}
+}
+
+Json::Value VK::API::attempt(const string &method, const string &token, const string &data, int priority, bool retried){
+	string url = VK::API::api_url + method;
+	string resp;
+	shared_ptr<VK::Metrics> metrics = VK::API::metrics;
+	if(!metrics){
+		if(limiter) limiter->acquire(token, priority);
+		Json::Value root = request(url, data, resp) ? parseResponse(resp) : transportError(resp);
+		throttled(token, root);
+		return root;
+	}
+
+	VK::Metrics::Sample sample;
+	VK::Timing timing = VK::Timing();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if(limiter) limiter->acquire(token, priority);
+	chrono::steady_clock::time_point sent = chrono::steady_clock::now();
+	bool ok = request(url, data, resp, &timing);
+	chrono::steady_clock::time_point received = chrono::steady_clock::now();
+	Json::Value root = ok ? parseResponse(resp) : transportError(resp);
+	throttled(token, root);
+
+	// Transports which do not time requests leave timing empty
+	if(timing.transfer > 0) sample.fill(timing);
+	else if(ok) sample.response_bytes = resp.size();
+	sample.request_bytes = data.size();
+	sample.error_code = errorCode(root);
+	sample.retry = retried;
+	sample.phases[VK::Metrics::QUEUE] = chrono::duration<double, milli>(sent - start).count();
+	sample.queued = true;
+	sample.phases[VK::Metrics::PARSE] = chrono::duration<double, milli>(chrono::steady_clock::now() - received).count();
+	sample.phases[VK::Metrics::TOTAL] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	metrics->record(method, sample);
+	return root;
+}
+
+int VK::API::errorCode(const Json::Value &resp){
+	if(resp["success"].asBool()) return 0;
+	int code = resp["error"][VK::Parameters::ERROR_CODE].asInt();
+	return code ? code : -1;
+}
+
+Json::Value VK::API::transportError(const string &message){
+	Json::Value root;
+	root["success"] = false;
+	root["error"][VK::Parameters::ERROR_CODE] = -1;
+	root["error"][VK::Parameters::ERROR_MSG] = message;
+	return root;
+}
+
+void VK::API::enableBatching(int window_ms, size_t max_calls){
+	disableBatching();
+	batcher = make_shared<VK::ExecuteBatcher>(this, window_ms, max_calls);
+}
+
+void VK::API::disableBatching(){
+	batcher.reset();
+}
+
+future<Json::Value> VK::API::callBatched(string method, map<string, string> params){
+	if(!batcher || !VK::ExecuteBatcher::batchable(method) || params.count("access_token") || params.count("v") || params.count("lang") || params.count("https")){
+		return callAsync(method, params);
+	}
+	return batcher->add(method, params);
+}
+
+void VK::API::flushBatch(){
+	if(batcher) batcher->flush();
+}
+
+void VK::API::enableCache(size_t max_bytes, int ttl){
+	cache = make_shared<VK::ResponseCache>(max_bytes, ttl);
+}
+
+string VK::API::cacheScope(){
+	string scope;
+	const string *values[3] = {&version, &lang, &https};
+	for(int i = 0; i < 3; i++){
+		scope += PREPARED_NAMES[i];
+		scope += '=';
+		VK::Utils::urlencode(values[i]->data(), values[i]->size(), scope);
+		scope += '&';
+	}
+	return scope;
+}
+
+void VK::API::setWorkers(size_t threads){
+	workers.reset();
+	if(threads) workers = make_shared<VK::WorkerPool>(threads);
+}
+
+future<Json::Value> VK::API::dispatch(string method, map<string, string> params, int priority){
+	shared_ptr<promise<Json::Value> > result = make_shared<promise<Json::Value> >();
+	if(!workers){
+		result->set_value(call(method, params, priority));
+		return result->get_future();
+	}
+	workers->submit([this, result, method, params, priority](){
+		result->set_value(call(method, params, priority));
+	});
+	return result->get_future();
+}
+
+VK::AsyncEngine &VK::API::async(){
+	lock_guard<mutex> guard(*engine_lock);
+	if(!engine){
+		engine = make_shared<VK::AsyncEngine>(pool);
+		engine->setLimiter(limiter);
+	}
+	return *engine;
+}
+
+const char *const VK::API::PREPARED_NAMES[4] = {"v", "lang", "https", "access_token"};
+
+void VK::API::prepare(){
+	const string *values[4] = {&version, &lang, &https, &access_token};
+	for(int i = 0; i < 4; i++){
+		prepared[i].value = *values[i];
+		prepared[i].encoded = PREPARED_NAMES[i];
+		prepared[i].encoded += '=';
+		VK::Utils::urlencode(values[i]->data(), values[i]->size(), prepared[i].encoded);
+		prepared[i].encoded += '&';
+	}
+}
+
+string VK::API::requestData(const map<string, string> &data){
+	size_t size = 0;
+	map<string, string>::const_iterator it;
+	for(it = data.begin(); it != data.end(); ++it){
+		size += it->first.size() + it->second.size() * 3 + 2;
+	}
+	for(int i = 0; i < 4; i++){
+		size += prepared[i].encoded.size();
+	}
+
+	string body;
+	body.reserve(size);
+	VK::Utils::data2str(data, body);
+
+	unsigned given = 0;
+	for(int i = 0; i < 4; i++){
+		if(data.count(PREPARED_NAMES[i])) given |= 1 << i;
+	}
+	appendPrepared(body, given);
+	return body;
+}
+
+string VK::API::requestData(const VK::Params &params){
+	size_t size = params.encodedSize();
+	unsigned given = 0;
+	for(int i = 0; i < 4; i++){
+		size += prepared[i].encoded.size();
+		if(params.has(PREPARED_NAMES[i])) given |= 1 << i;
+	}
+
+	string body;
+	body.reserve(size);
+	params.encode(body);
+	appendPrepared(body, given);
+	return body;
+}
+
+void VK::API::appendPrepared(string &body, unsigned given){
+	const string *values[4] = {&version, &lang, &https, &access_token};
+
+	// Parameters given by caller take precedence over the prepared ones
+	for(int i = 0; i < 4; i++){
+		if(given & (1 << i)) continue;
+		if(prepared[i].value == *values[i]){
+			body += prepared[i].encoded;
+		}else{
+			// Member was changed after construction
+			body += PREPARED_NAMES[i];
+			body += '=';
+			VK::Utils::urlencode(values[i]->data(), values[i]->size(), body);
+			body += '&';
+		}
+	}
+}
+
+Json::Value VK::API::parseResponse(const string &resp){
+	Json::Value root;
+	Json::Reader reader;
+	bool parsedSuccess = reader.parse(resp, root, false);
+	if(!parsedSuccess){
+		root["success"] = false;
+		return root;
+	}
+
+	if(root["response"].isNull()){
+		if(!root["error"].isNull()){
+			root["success"] = false;
+		}
+	}else{
+		root["success"] = true;
+	}
+
+	return root;
+}
+
+VK::UsersList VK::API::usersGet(map<string, string> params){
+	Json::Value resp = this->call("users.get", params);
+	vector<VK::UserFull> list;
+	if(resp["success"].asBool()){
+		VK::UsersList::parse(resp["response"], list, VK::UserFull::Fields::of(params));
+	}
+	return VK::UsersList(std::move(list));
+}
+
+VK::BulkUsers VK::API::usersGetBulk(const vector<int> &ids, map<string, string> params, size_t parallel, size_t chunk){
+	if(chunk < 1 || chunk > USERS_GET_LIMIT) chunk = USERS_GET_LIMIT;
+	if(parallel < 1) parallel = 1;
+	unsigned long long fields = VK::UserFull::Fields::of(params);
+
+	VK::BulkUsers result;
+	result.users.resize(ids.size());
+	result.found = 0;
+
+	mutex lock;
+	condition_variable done;
+	size_t in_flight = 0;
+	unique_lock<mutex> guard(lock);
+	for(size_t offset = 0; offset < ids.size(); offset += chunk){
+		while(in_flight >= parallel) done.wait(guard);
+		in_flight++;
+		guard.unlock();
+
+		size_t count = min(chunk, ids.size() - offset);
+		string joined;
+		joined.reserve(count * 11);
+		for(size_t i = 0; i < count; i++){
+			if(i) joined += ',';
+			joined += to_string(ids[offset + i]);
+		}
+		params["user_ids"] = joined;
+
+		// Chunks write to own ranges of preallocated users, only counters are shared
+		callAsync("users.get", params, [&, offset, count](Json::Value resp){
+			vector<VK::UserFull> list;
+			if(resp["success"].asBool()) VK::UsersList::parse(resp["response"], list, fields);
+			size_t matched = match(ids, offset, count, list, result.users);
+
+			lock_guard<mutex> guard(lock);
+			if(resp["success"].asBool()){
+				result.found += matched;
+			}else{
+				VK::BulkUsers::Failure failure;
+				failure.offset = offset;
+				failure.count = count;
+				failure.error_code = errorCode(resp);
+				failure.error_msg = resp["error"][VK::Parameters::ERROR_MSG].asString();
+				result.failures.push_back(failure);
+			}
+			in_flight--;
+			done.notify_all();
+		});
+		guard.lock();
+	}
+	while(in_flight) done.wait(guard);
+
+	sort(result.failures.begin(), result.failures.end(), [](const VK::BulkUsers::Failure &a, const VK::BulkUsers::Failure &b){
+		return a.offset < b.offset;
+	});
+	return result;
+}
+
+size_t VK::API::match(const vector<int> &ids, size_t offset, size_t count, vector<VK::UserFull> &list, vector<VK::UserFull> &users){
+	// VK answers in order of requested ids, skipping unknown ones, so a cursor finds almost every user
+	unordered_map<int, size_t> placed;
+	size_t matched = 0;
+	size_t cursor = offset;
+	for(size_t i = 0; i < list.size(); i++){
+		int id = list[i].id;
+		size_t end = offset + count;
+		size_t position = cursor;
+		while(position < end && ids[position] != id) position++;
+		if(position == end){
+			position = offset;
+			while(position < end && (ids[position] != id || users[position].id == id)) position++;
+			if(position == end) continue;
+		}
+		placed[id] = position;
+		users[position] = std::move(list[i]);
+		cursor = position + 1;
+		matched++;
+	}
+
+	// Repeated ids get a copy of the user received once
+	if(placed.size() < count){
+		for(size_t position = offset; position < offset + count; position++){
+			if(users[position].id) continue;
+			unordered_map<int, size_t>::iterator it = placed.find(ids[position]);
+			if(it != placed.end()) users[position] = users[it->second];
+		}
+	}
+	return matched;
+}
+
+vector<VK::UserFull> VK::API::usersSearch(map<string, string> params){
+	vector<VK::UserFull> users;
+	Json::Value resp = this->call("users.search", params);
+	if(resp["success"].asBool() && resp["response"]["items"].isArray()){
+		VK::UsersList::parse(resp["response"]["items"], users, VK::UserFull::Fields::of(params));
+	} 
+	return users;
+}
+
+bool VK::API::usersIsAppUser(map<string, string> params){
+	Json::Value resp = this->call("users.isAppUser", params);
+	if(resp["success"].asBool()){
+		return resp["response"] == "1" ? true : false;
+	} 
+	return false;
+}
+
+vector<VK::UserFull> VK::API::usersGetFollowers(map<string, string> params){
+	vector<VK::UserFull> users;
+	Json::Value resp = this->call("users.getFollowers", params);
+	if(resp["success"].asBool()){
+		VK::UsersList::parse(resp["response"]["items"], users, VK::UserFull::Fields::of(params));
+	}
+	return users;
+}
+
+vector<VK::UserFull> VK::API::usersGetSubscriptions(map<string, string> params){
+	vector<VK::UserFull> users;
+	Json::Value resp = this->call("users.getSubscriptions", params);
+	if(resp["success"].asBool()){
+		// Not extended response lists user ids separately from communities
+		const Json::Value &response = resp["response"];
+		const Json::Value &items = response.isMember("users") ? response["users"]["items"] : response["items"];
+		VK::UsersList::parse(items, users, VK::UserFull::Fields::of(params));
+	}
+	return users;
+}
+
+VK::UsersPager VK::API::usersSearchPages(map<string, string> params, size_t prefetch, size_t limit){
+	return VK::UsersPager(this, "users.search", params, prefetch, limit);
+}
+
+VK::UsersPager VK::API::usersGetFollowersPages(map<string, string> params, size_t prefetch, size_t limit){
+	return VK::UsersPager(this, "users.getFollowers", params, prefetch, limit);
+}
+
+VK::UsersPager VK::API::usersGetSubscriptionsPages(map<string, string> params, size_t prefetch, size_t limit){
+	// Only extended response is paged by offset and count
+	params["extended"] = "1";
+	return VK::UsersPager(this, "users.getSubscriptions", params, prefetch, limit);
+}
+
+future<VK::UsersList> VK::API::usersGetAsync(map<string, string> params){
+	shared_ptr<promise<VK::UsersList> > result = make_shared<promise<VK::UsersList> >();
+	unsigned long long fields = VK::UserFull::Fields::of(params);
+	callAsync("users.get", params, [result, fields](Json::Value resp){
+		if(resp["success"].asBool()){
+			vector<VK::UserFull> users;
+			VK::UsersList::parse(resp["response"], users, fields);
+			result->set_value(VK::UsersList(std::move(users)));
+		}else{
+			result->set_value(VK::UsersList(vector<VK::UserFull>()));
+		}
+	});
+	return result->get_future();
+}
+
+future<vector<VK::UserFull> > VK::API::usersSearchAsync(map<string, string> params){
+	shared_ptr<promise<vector<VK::UserFull> > > result = make_shared<promise<vector<VK::UserFull> > >();
+	unsigned long long fields = VK::UserFull::Fields::of(params);
+	callAsync("users.search", params, [result, fields](Json::Value resp){
+		vector<VK::UserFull> users;
+		if(resp["success"].asBool() && resp["response"]["items"].isArray()){
+			VK::UsersList::parse(resp["response"]["items"], users, fields);
+		}
+		result->set_value(std::move(users));
+	});
+	return result->get_future();
+}
+
+future<bool> VK::API::usersIsAppUserAsync(map<string, string> params){
+	shared_ptr<promise<bool> > result = make_shared<promise<bool> >();
+	callAsync("users.isAppUser", params, [result](Json::Value resp){
+		result->set_value(resp["success"].asBool() && resp["response"] == "1");
+	});
+	return result->get_future();
+}
+
+string VK::API::post(string url, string data){
+	return VK::API::post(url, data, VK::CurlPool::shared());
+}
+
+string VK::API::post(string url, string data, VK::CurlPool &pool){
+	string buffer;
+	string error;
+	bool ok = VK::CurlTransport::perform(pool, url, data, [&buffer](const char *chunk, size_t size){
+		buffer.append(chunk, size);
+		return true;
+	}, error);
+	return ok ? buffer : error;
+}
+
+/**
+	Check that streamed response is a complete JSON document and fill totals of timing
+*/
+static bool finishStream(bool sent, VK::JsonStream &stream, string &error, VK::Timing *timing, chrono::steady_clock::time_point start){
+	bool ok = sent;
+	if(ok && !stream.finish()){
+		error = "Malformed JSON response";
+		ok = false;
+	}
+	if(timing){
+		timing->total = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		timing->received = stream.received();
+	}
+	return ok;
+}
+
+bool VK::API::post(string url, string data, VK::CurlPool &pool, VK::JsonStream &stream, string &error, VK::Timing *timing){
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool sent = VK::CurlTransport::perform(pool, url, data, [&stream](const char *chunk, size_t size){
+		return stream.feed(chunk, size);
+	}, error, timing);
+	return finishStream(sent, stream, error, timing, start);
+}
+
+bool VK::API::request(const string &url, const string &data, string &resp, VK::Timing *timing){
+	string error;
+	VK::Transport::Sink sink = [&resp](const char *chunk, size_t size){
+		resp.append(chunk, size);
+		return true;
+	};
+	bool ok = transport ? transport->send(url, data, sink, error, timing) : VK::CurlTransport::perform(*pool, url, data, sink, error, timing);
+	if(!ok) resp = error;
+	return ok;
+}
+
+bool VK::API::request(const string &url, const string &data, VK::JsonStream &stream, string &error, VK::Timing *timing){
+	if(!transport) return VK::API::post(url, data, *pool, stream, error, timing);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool sent = transport->send(url, data, [&stream](const char *chunk, size_t size){
+		return stream.feed(chunk, size);
+	}, error, timing);
+	return finishStream(sent, stream, error, timing, start);
+}
+
+shared_ptr<VK::UsersStream> VK::API::streamUsers(string method, map<string, string> params, function<void(VK::UserFull&)> callback, VK::Timing *timing){
 	string url = VK::API::api_url + method;
+	string token = tokenOf(params);
+	string data = requestData(params);
+	shared_ptr<VK::Metrics> metrics = VK::API::metrics;
+	shared_ptr<VK::RetryPolicy> retry = VK::API::retry;
+	VK::Timing measured = VK::Timing();
+	if(metrics && !timing) timing = &measured;
+	chrono::milliseconds waited(0);
+
+	for(int retries = 0; ; retries++){
+		chrono::steady_clock::time_point start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+		if(limiter) limiter->acquire(token);
+		chrono::steady_clock::time_point sent = metrics ? chrono::steady_clock::now() : start;
+
+		shared_ptr<VK::UsersStream> users = make_shared<VK::UsersStream>(callback, VK::UserFull::Fields::of(params));
+		VK::JsonStream stream(users.get());
+		string error;
+		if(!request(url, data, stream, error, timing)){
+			users->users.clear();
+			if(!users->error_code) users->error_msg = error;
+			if(!users->error_code) users->error_code = -1;
+		}
+		if(limiter && users->error_code == 6) limiter->drain(token);
+
+		if(metrics){
+			// Parsing overlapped the transfer, only its tail after the last byte is a phase
+			VK::Metrics::Sample sample;
+			if(timing->transfer > 0) sample.fill(*timing);
+			sample.request_bytes = data.size();
+			sample.error_code = users->error_code;
+			sample.retry = retries > 0;
+			sample.phases[VK::Metrics::QUEUE] = chrono::duration<double, milli>(sent - start).count();
+			sample.queued = true;
+			sample.phases[VK::Metrics::PARSE] = max(0.0, timing->total - timing->transfer);
+			sample.phases[VK::Metrics::TOTAL] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			metrics->record(method, sample);
+		}
+
+		// Users given to callback can not be taken back, failures after them are final
+		chrono::milliseconds delay;
+		if(!retry || users->delivered || !retry->next(method, users->error_code, retries, waited, delay)) return users;
+		this_thread::sleep_for(delay);
+		waited += delay;
+	}
+}
+
+VK::UsersList VK::API::usersGetStream(map<string, string> params){
+	shared_ptr<VK::UsersStream> users = streamUsers("users.get", params);
+	return VK::UsersList(std::move(users->users));
+}
+
+vector<VK::UserFull> VK::API::usersSearchStream(map<string, string> params){
+	return std::move(streamUsers("users.search", params)->users);
+}
+
+bool VK::API::usersGetStream(map<string, string> params, function<void(VK::UserFull&)> callback, VK::Timing *timing){
+	return streamUsers("users.get", params, callback, timing)->error_code == 0;
+}
+
+bool VK::API::usersSearchStream(map<string, string> params, function<void(VK::UserFull&)> callback, VK::Timing *timing){
+	return streamUsers("users.search", params, callback, timing)->error_code == 0;
+}
+
+// CURL POOL
+VK::CurlPool::CurlPool(size_t size, int idle_timeout){
+	static once_flag initialized;
+	call_once(initialized, [](){ curl_global_init(CURL_GLOBAL_ALL); });
+
+	VK::CurlPool::size = size;
+	VK::CurlPool::idle_timeout = chrono::seconds(idle_timeout);
+	stats.created = 0;
+	stats.reused = 0;
+	stats.expired = 0;
+	stats.idle = 0;
+	stats.busy = 0;
+}
+
+VK::CurlPool::~CurlPool(){
+	for(size_t i = 0; i < idle.size(); i++){
+		curl_easy_cleanup(idle[i].curl);
+	}
+}
+
+VK::CurlPool &VK::CurlPool::shared(){
+	static VK::CurlPool pool;
+	return pool;
+}
+
+CURL *VK::CurlPool::acquire(){
+	lock_guard<mutex> guard(lock);
+	expire(chrono::steady_clock::now());
+
+	CURL *curl;
+	if(!idle.empty()){
+		// Most recently used handle has the warmest connection
+		curl = idle.back().curl;
+		idle.pop_back();
+		stats.reused++;
+	}else{
+		curl = curl_easy_init();
+		if(!curl) return NULL;
+		stats.created++;
+	}
+	stats.busy++;
+	return curl;
+}
+
+void VK::CurlPool::release(CURL *curl){
+	if(!curl) return;
+	curl_easy_reset(curl);
+
+	lock_guard<mutex> guard(lock);
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	stats.busy--;
+	expire(now);
+	if(idle.size() >= size){
+		curl_easy_cleanup(curl);
+		stats.expired++;
+		return;
+	}
+	VK::CurlPool::Entry entry;
+	entry.curl = curl;
+	entry.used = now;
+	idle.push_back(entry);
+}
+
+void VK::CurlPool::expire(chrono::steady_clock::time_point now){
+	// Idle list is ordered by release time, oldest first
+	size_t n = 0;
+	while(n < idle.size() && now - idle[n].used > idle_timeout){
+		curl_easy_cleanup(idle[n].curl);
+		stats.expired++;
+		n++;
+	}
+	if(n) idle.erase(idle.begin(), idle.begin() + n);
+}
+
+void VK::CurlPool::setSize(size_t size){
+	lock_guard<mutex> guard(lock);
+	VK::CurlPool::size = size;
+	if(idle.size() <= size) return;
+
+	// Oldest handles are at the front
+	size_t excess = idle.size() - size;
+	for(size_t i = 0; i < excess; i++){
+		curl_easy_cleanup(idle[i].curl);
+	}
+	idle.erase(idle.begin(), idle.begin() + excess);
+	stats.expired += excess;
+}
+
+void VK::CurlPool::setIdleTimeout(int idle_timeout){
+	lock_guard<mutex> guard(lock);
+	VK::CurlPool::idle_timeout = chrono::seconds(idle_timeout);
+}
+
+VK::CurlPool::Stats VK::CurlPool::getStats(){
+	lock_guard<mutex> guard(lock);
+	VK::CurlPool::Stats current = stats;
+	current.idle = idle.size();
+	return current;
+}
+
+// ASYNC ENGINE
+VK::AsyncEngine::AsyncEngine(shared_ptr<VK::CurlPool> pool, size_t max_in_flight){
+	VK::AsyncEngine::pool = pool;
+	VK::AsyncEngine::max_in_flight = max_in_flight;
+	in_flight = 0;
+	stopping = false;
+	multi = curl_multi_init();
+	loop = thread(&VK::AsyncEngine::run, this);
+}
+
+VK::AsyncEngine::~AsyncEngine(){
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	curl_multi_wakeup(multi);
+	loop.join();
+	curl_multi_cleanup(multi);
+}
+
+void VK::AsyncEngine::post(const string &url, const string &data, Callback callback){
+	post(url, data, "", callback);
+}
+
+void VK::AsyncEngine::post(const string &url, const string &data, const string &key, Callback callback){
+	post(url, data, key, callback, chrono::milliseconds(0));
+}
+
+void VK::AsyncEngine::post(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay){
+	VK::AsyncEngine::Request *request = new VK::AsyncEngine::Request();
+	request->url = url;
+	request->data = data;
+	request->key = key;
+	request->queued = chrono::steady_clock::now() + delay;
+	request->due = request->queued;
+	request->callback = callback;
+	request->error[0] = 0;
+	{
+		lock_guard<mutex> guard(lock);
+		queue.push_back(request);
+	}
+	curl_multi_wakeup(multi);
+}
+
+void VK::AsyncEngine::setLimiter(shared_ptr<VK::RateLimiter> limiter){
+	{
+		lock_guard<mutex> guard(lock);
+		VK::AsyncEngine::limiter = limiter;
+	}
+	curl_multi_wakeup(multi);
+}
+
+size_t VK::AsyncEngine::pending(){
+	lock_guard<mutex> guard(lock);
+	return queue.size() + in_flight;
+}
+
+void VK::AsyncEngine::run(){
+	int running = 0;
+	while(true){
+		vector<VK::AsyncEngine::Request*> ready;
+		chrono::steady_clock::duration timeout = chrono::seconds(1);
+		{
+			lock_guard<mutex> guard(lock);
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+			// Requests of a key waiting for the limiter do not hold back other keys
+			vector<string> blocked;
+			deque<VK::AsyncEngine::Request*>::iterator it = queue.begin();
+			while(it != queue.end() && in_flight < max_in_flight){
+				VK::AsyncEngine::Request *request = *it;
+				if(request->due > now){
+					if(request->due - now < timeout) timeout = request->due - now;
+					++it;
+					continue;
+				}
+				if(limiter && !request->key.empty()){
+					if(find(blocked.begin(), blocked.end(), request->key) != blocked.end()){
+						++it;
+						continue;
+					}
+					chrono::steady_clock::duration retry;
+					if(!limiter->tryAcquire(request->key, request->queued, retry)){
+						blocked.push_back(request->key);
+						if(retry < timeout) timeout = retry;
+						++it;
+						continue;
+					}
+				}
+				ready.push_back(request);
+				it = queue.erase(it);
+				in_flight++;
+			}
+			if(stopping && queue.empty() && in_flight == 0) break;
+		}
+		for(size_t i = 0; i < ready.size(); i++){
+			start(ready[i]);
+		}
+
+		curl_multi_perform(multi, &running);
+
+		CURLMsg *msg;
+		int left;
+		while((msg = curl_multi_info_read(multi, &left))){
+			if(msg->msg == CURLMSG_DONE) finish(msg->easy_handle, msg->data.result);
+		}
+
+		int timeout_ms = (int)chrono::duration_cast<chrono::milliseconds>(timeout).count() + 1;
+		curl_multi_poll(multi, NULL, 0, timeout_ms, NULL);
+	}
+}
+
+void VK::AsyncEngine::start(VK::AsyncEngine::Request *request){
+	CURL *curl = pool->acquire();
+	if(!curl){
+		request->callback(false, "Failed to create CURL handle");
+		delete request;
+		lock_guard<mutex> guard(lock);
+		in_flight--;
+		return;
+	}
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, request->error);
+	curl_easy_setopt(curl, CURLOPT_URL, request->url.c_str());
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->data.c_str());
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, VK::Utils::CURL_WRITER);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->buffer);
+	curl_multi_add_handle(multi, curl);
+}
+
+void VK::AsyncEngine::finish(CURL *curl, CURLcode result){
+	VK::AsyncEngine::Request *request = NULL;
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&request);
+	curl_multi_remove_handle(multi, curl);
+	pool->release(curl);
+
+	if(result == CURLE_OK){
+		request->callback(true, request->buffer);
+	}else{
+		request->callback(false, request->error[0] ? string(request->error) : string(curl_easy_strerror(result)));
+	}
+	delete request;
+
+	lock_guard<mutex> guard(lock);
+	in_flight--;
+}
+
+// WORKER POOL
+VK::WorkerPool::WorkerPool(size_t threads){
+	stopping = false;
+	for(size_t i = 0; i < threads; i++){
+		VK::WorkerPool::threads.push_back(thread(&VK::WorkerPool::run, this));
+	}
+}
+
+VK::WorkerPool::~WorkerPool(){
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[i].join();
+	}
+}
+
+void VK::WorkerPool::submit(function<void()> job){
+	{
+		lock_guard<mutex> guard(lock);
+		jobs.push_back(job);
+	}
+	wake.notify_one();
+}
+
+size_t VK::WorkerPool::size(){
+	return threads.size();
+}
+
+void VK::WorkerPool::run(){
+	while(true){
+		function<void()> job;
+		{
+			unique_lock<mutex> guard(lock);
+			while(!stopping && jobs.empty()) wake.wait(guard);
+			if(jobs.empty()) return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+// RATE LIMITER
+const double VK::RateLimiter::MIN_RATE = 0.001;
+
+VK::RateLimiter::RateLimiter(double rate, double burst){
+	// Waits are divided by rate, zero, negative and NaN rates become the minimum
+	VK::RateLimiter::rate = rate > MIN_RATE ? rate : MIN_RATE;
+	VK::RateLimiter::burst = burst < 1 ? 1 : burst;
+}
+
+VK::RateLimiter::Bucket &VK::RateLimiter::bucket(const string &key){
+	map<string, VK::RateLimiter::Bucket>::iterator it = buckets.find(key);
+	if(it != buckets.end()) return it->second;
+
+	VK::RateLimiter::Bucket &bucket = buckets[key];
+	bucket.rate = rate;
+	bucket.burst = burst;
+	bucket.tokens = burst;
+	bucket.updated = chrono::steady_clock::now();
+	bucket.sequence = 0;
+	bucket.stats.granted = 0;
+	bucket.stats.delayed = 0;
+	bucket.stats.total_wait_ms = 0;
+	bucket.stats.max_wait_ms = 0;
+	bucket.stats.queued = 0;
+	return bucket;
+}
+
+void VK::RateLimiter::refill(VK::RateLimiter::Bucket &bucket, chrono::steady_clock::time_point now){
+	double elapsed = chrono::duration<double>(now - bucket.updated).count();
+	bucket.tokens = min(bucket.burst, bucket.tokens + elapsed * bucket.rate);
+	bucket.updated = now;
+}
+
+void VK::RateLimiter::record(VK::RateLimiter::Bucket &bucket, chrono::steady_clock::duration wait){
+	double ms = chrono::duration<double, milli>(wait).count();
+	bucket.tokens -= 1;
+	bucket.stats.granted++;
+	if(ms >= 1) bucket.stats.delayed++;
+	bucket.stats.total_wait_ms += ms;
+	if(ms > bucket.stats.max_wait_ms) bucket.stats.max_wait_ms = ms;
+}
+
+void VK::RateLimiter::setLimit(const string &key, double rate, double burst){
+	lock_guard<mutex> guard(lock);
+	VK::RateLimiter::Bucket &bucket = VK::RateLimiter::bucket(key);
+	refill(bucket, chrono::steady_clock::now());
+	bucket.rate = rate > MIN_RATE ? rate : MIN_RATE;
+	bucket.burst = burst < 1 ? 1 : burst;
+	if(bucket.tokens > bucket.burst) bucket.tokens = bucket.burst;
+	wake.notify_all();
+}
+
+void VK::RateLimiter::acquire(const string &key, int priority){
+	unique_lock<mutex> guard(lock);
+	chrono::steady_clock::time_point queued = chrono::steady_clock::now();
+	VK::RateLimiter::Bucket &bucket = VK::RateLimiter::bucket(key);
+
+	// Waiters are ordered by descending priority, then by arrival
+	pair<int, unsigned long> ticket(-priority, bucket.sequence++);
+	bucket.waiters[ticket] = true;
+	bucket.stats.queued++;
+
+	while(true){
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		refill(bucket, now);
+		bool first = bucket.waiters.begin()->first == ticket;
+		if(first && bucket.tokens >= 1){
+			record(bucket, now - queued);
+			break;
+		}
+		if(first){
+			double seconds = (1 - bucket.tokens) / bucket.rate;
+			wake.wait_for(guard, chrono::duration<double>(seconds));
+		}else{
+			wake.wait(guard);
+		}
+	}
+
+	bucket.waiters.erase(ticket);
+	bucket.stats.queued--;
+	wake.notify_all();
+}
+
+bool VK::RateLimiter::tryAcquire(const string &key, chrono::steady_clock::time_point queued, chrono::steady_clock::duration &retry){
+	lock_guard<mutex> guard(lock);
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	VK::RateLimiter::Bucket &bucket = VK::RateLimiter::bucket(key);
+	refill(bucket, now);
+	if(bucket.waiters.empty() && bucket.tokens >= 1){
+		record(bucket, now - queued);
+		return true;
+	}
+	double seconds = bucket.tokens >= 1 ? 0.001 : (1 - bucket.tokens) / bucket.rate;
+	retry = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+	return false;
+}
+
+void VK::RateLimiter::drain(const string &key){
+	lock_guard<mutex> guard(lock);
+	VK::RateLimiter::Bucket &bucket = VK::RateLimiter::bucket(key);
+	refill(bucket, chrono::steady_clock::now());
+	if(bucket.tokens > 0) bucket.tokens = 0;
+}
+
+VK::RateLimiter::Stats VK::RateLimiter::getStats(const string &key){
+	lock_guard<mutex> guard(lock);
+	return bucket(key).stats;
+}
+
+// RETRY POLICY
+VK::RetryPolicy::RetryPolicy(int max_retries, int base_ms, int max_ms, int budget_ms){
+	VK::RetryPolicy::max_retries = max_retries;
+	VK::RetryPolicy::base_ms = base_ms < 1 ? 1 : base_ms;
+	VK::RetryPolicy::max_ms = max_ms < VK::RetryPolicy::base_ms ? VK::RetryPolicy::base_ms : max_ms;
+	VK::RetryPolicy::budget_ms = budget_ms;
+	random.seed((unsigned)chrono::steady_clock::now().time_since_epoch().count());
+	codes.insert(-1);
+	codes.insert(1);
+	codes.insert(6);
+	codes.insert(10);
+}
+
+void VK::RetryPolicy::setRetriable(int error_code, bool retriable){
+	lock_guard<mutex> guard(lock);
+	if(retriable) codes.insert(error_code);
+	else codes.erase(error_code);
+}
+
+bool VK::RetryPolicy::isRetriable(int error_code){
+	lock_guard<mutex> guard(lock);
+	return codes.count(error_code) > 0;
+}
+
+void VK::RetryPolicy::setIdempotent(const string &method, bool idempotent){
+	lock_guard<mutex> guard(lock);
+	idempotent_methods[method] = idempotent;
+}
+
+bool VK::RetryPolicy::isIdempotent(const string &method){
+	{
+		lock_guard<mutex> guard(lock);
+		map<string, bool>::iterator it = idempotent_methods.find(method);
+		if(it != idempotent_methods.end()) return it->second;
+	}
+
+	// Reading methods are named after what they do: users.get, users.search, groups.isMember
+	static const char *const READS[] = {"get", "search", "is", "check"};
+	size_t dot = method.find('.');
+	if(dot == string::npos) return false;
+	for(size_t i = 0; i < sizeof(READS) / sizeof(READS[0]); i++){
+		size_t length = strlen(READS[i]);
+		if(method.compare(dot + 1, length, READS[i]) != 0) continue;
+		// Next letter must start a new word, users.getFollowers is a read and a method like photos.issue is not
+		char next = dot + 1 + length < method.size() ? method[dot + 1 + length] : 0;
+		if(!next || (next >= 'A' && next <= 'Z')) return true;
+	}
+	return false;
+}
+
+bool VK::RetryPolicy::next(const string &method, int error_code, int retries, chrono::milliseconds waited, chrono::milliseconds &delay){
+	if(!error_code || retries >= max_retries || !isRetriable(error_code)) return false;
+
+	// Request may have reached VK before transport failed, only reads are safe to repeat
+	if(error_code == -1 && !isIdempotent(method)) return false;
+
+	// Jitter generator is shared by calls, retries are rare enough for the lock not to matter
+	double cap = min((double)max_ms, base_ms * pow(2.0, retries));
+	double jitter;
+	{
+		lock_guard<mutex> guard(lock);
+		jitter = (double)(random() - random.min()) / (random.max() - random.min());
+	}
+	delay = chrono::milliseconds((long long)(cap * jitter));
+	if(budget_ms && waited.count() + delay.count() > budget_ms) return false;
+	return true;
+}
+
+void VK::RetryPolicy::seed(unsigned value){
+	lock_guard<mutex> guard(lock);
+	random.seed(value);
+}
+
+// RESPONSE CACHE
+VK::ResponseCache::ResponseCache(size_t max_bytes, int ttl){
+	VK::ResponseCache::max_bytes = max_bytes;
+	VK::ResponseCache::ttl = ttl;
+	ignore_token = false;
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.evictions = 0;
+	stats.entries = 0;
+	stats.bytes = 0;
+}
+
+void VK::ResponseCache::setTTL(const string &method, int ttl){
+	lock_guard<mutex> guard(lock);
+	ttls[method] = ttl;
+}
+
+void VK::ResponseCache::ignoreToken(bool ignore){
+	lock_guard<mutex> guard(lock);
+	ignore_token = ignore;
+}
+
+string VK::ResponseCache::key(const string &method, const map<string, string> &params, const string &scope, const string &token){
+	// Map is ordered, so equal parameter sets give equal keys
+	string key = method;
+	key += '?';
+	map<string, string>::const_iterator it;
+	for(it = params.begin(); it != params.end(); ++it){
+		if(it->first == "access_token") continue;
+		key += it->first;
+		key += '=';
+		VK::Utils::urlencode(it->second.data(), it->second.size(), key);
+		key += '&';
+	}
+	key += '|';
+	key += scope;
+	if(!ignore_token){
+		key += '#';
+		key += token;
+	}
+	return key;
+}
+
+int VK::ResponseCache::ttlOf(const string &method){
+	if(method == "execute") return 0;
+	map<string, int>::iterator it = ttls.find(method);
+	return it == ttls.end() ? ttl : it->second;
+}
+
+size_t VK::ResponseCache::bytesOf(const Json::Value &value){
+	size_t bytes = sizeof(Json::Value);
+	if(value.isString()){
+		bytes += strlen(value.asCString());
+	}else if(value.isArray() || value.isObject()){
+		for(Json::Value::const_iterator it = value.begin(); it != value.end(); ++it){
+			if(value.isObject()) bytes += 16 + it.key().asString().size();
+			bytes += bytesOf(*it);
+		}
+	}
+	return bytes;
+}
+
+void VK::ResponseCache::erase(list<VK::ResponseCache::Entry>::iterator it){
+	stats.bytes -= it->bytes;
+	index.erase(it->key);
+	entries.erase(it);
+	stats.entries = entries.size();
+}
+
+bool VK::ResponseCache::get(const string &method, const map<string, string> &params, const string &scope, const string &token, Json::Value &resp){
+	lock_guard<mutex> guard(lock);
+	if(ttlOf(method) <= 0) return false;
+	unordered_map<string, list<VK::ResponseCache::Entry>::iterator>::iterator it = index.find(key(method, params, scope, token));
+	if(it == index.end()){
+		stats.misses++;
+		return false;
+	}
+	if(it->second->expires < chrono::steady_clock::now()){
+		erase(it->second);
+		stats.misses++;
+		return false;
+	}
+	entries.splice(entries.begin(), entries, it->second);
+	resp = it->second->value;
+	stats.hits++;
+	return true;
+}
+
+void VK::ResponseCache::put(const string &method, const map<string, string> &params, const string &scope, const string &token, const Json::Value &resp){
+	lock_guard<mutex> guard(lock);
+	int seconds = ttlOf(method);
+	if(seconds <= 0) return;
+
+	VK::ResponseCache::Entry entry;
+	entry.key = key(method, params, scope, token);
+	entry.method = method;
+	entry.value = resp;
+	entry.expires = chrono::steady_clock::now() + chrono::seconds(seconds);
+	entry.bytes = entry.key.size() + bytesOf(resp);
+	if(entry.bytes > max_bytes) return;
+
+	unordered_map<string, list<VK::ResponseCache::Entry>::iterator>::iterator it = index.find(entry.key);
+	if(it != index.end()) erase(it->second);
+
+	while(!entries.empty() && stats.bytes + entry.bytes > max_bytes){
+		erase(--entries.end());
+		stats.evictions++;
+	}
+	stats.bytes += entry.bytes;
+	entries.push_front(entry);
+	index[entry.key] = entries.begin();
+	stats.entries = entries.size();
+}
+
+void VK::ResponseCache::invalidate(const string &method){
+	lock_guard<mutex> guard(lock);
+	list<VK::ResponseCache::Entry>::iterator it = entries.begin();
+	while(it != entries.end()){
+		list<VK::ResponseCache::Entry>::iterator current = it++;
+		if(current->method == method) erase(current);
+	}
+}
+
+void VK::ResponseCache::invalidate(const string &method, const map<string, string> &params, const string &scope, const string &token){
+	lock_guard<mutex> guard(lock);
+	unordered_map<string, list<VK::ResponseCache::Entry>::iterator>::iterator it = index.find(key(method, params, scope, token));
+	if(it != index.end()) erase(it->second);
+}
+
+void VK::ResponseCache::clear(){
+	lock_guard<mutex> guard(lock);
+	entries.clear();
+	index.clear();
+	stats.entries = 0;
+	stats.bytes = 0;
+}
 
-	data.insert(std::pair<string, string>("v", VK::API::version));
-	data.insert(std::pair<string, string>("lang", VK::API::lang));
-	data.insert(std::pair<string, string>("https", VK::API::https));
-	if(!data.count("access_token")) data.insert(std::pair<string, string>("access_token", VK::API::access_token));
+VK::ResponseCache::Stats VK::ResponseCache::getStats(){
+	lock_guard<mutex> guard(lock);
+	return stats;
+}
 
-	string resp = VK::API::post(url, Utils::data2str(data));
+// EXECUTE BATCHER
+const size_t VK::ExecuteBatcher::MAX_CALLS;
 
-	Json::Value root;
-	Json::Reader reader;
-	bool parsedSuccess = reader.parse(resp, root, false);
-	if(!parsedSuccess){
-		root["success"] = false;
-		return root;
+VK::ExecuteBatcher::ExecuteBatcher(VK::API *api, int window_ms, size_t max_calls){
+	VK::ExecuteBatcher::api = api;
+	VK::ExecuteBatcher::window = chrono::milliseconds(window_ms);
+	VK::ExecuteBatcher::max_calls = max_calls < 1 || max_calls > MAX_CALLS ? MAX_CALLS : max_calls;
+	stopping = false;
+	if(window_ms > 0) timer = thread(&VK::ExecuteBatcher::run, this);
+}
+
+VK::ExecuteBatcher::~ExecuteBatcher(){
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
 	}
+	wake.notify_all();
+	if(timer.joinable()) timer.join();
+	flush();
+}
 
-	if(root["response"].isNull()){
-		if(!root["error"].isNull()){
+future<Json::Value> VK::ExecuteBatcher::add(string method, map<string, string> params){
+	VK::ExecuteBatcher::Call call;
+	call.method = method;
+	call.params = params;
+	call.result = make_shared<promise<Json::Value> >();
+	future<Json::Value> result = call.result->get_future();
+
+	vector<VK::ExecuteBatcher::Call> full;
+	{
+		lock_guard<mutex> guard(lock);
+		if(batch.empty()){
+			deadline = chrono::steady_clock::now() + window;
+			wake.notify_all();
+		}
+		batch.push_back(call);
+		if(batch.size() >= max_calls) full.swap(batch);
+	}
+	if(!full.empty()) send(full);
+	return result;
+}
+
+void VK::ExecuteBatcher::flush(){
+	vector<VK::ExecuteBatcher::Call> calls;
+	{
+		lock_guard<mutex> guard(lock);
+		calls.swap(batch);
+	}
+	if(!calls.empty()) send(calls);
+}
+
+void VK::ExecuteBatcher::run(){
+	unique_lock<mutex> guard(lock);
+	while(!stopping){
+		if(batch.empty()){
+			wake.wait(guard);
+			continue;
+		}
+		if(chrono::steady_clock::now() < deadline){
+			wake.wait_until(guard, deadline);
+			continue;
+		}
+		vector<VK::ExecuteBatcher::Call> calls;
+		calls.swap(batch);
+		guard.unlock();
+		send(calls);
+		guard.lock();
+	}
+}
+
+string VK::ExecuteBatcher::script(const vector<pair<string, map<string, string> > > &calls){
+	Json::FastWriter writer;
+	string code = "return [";
+	for(size_t i = 0; i < calls.size(); i++){
+		Json::Value args(Json::objectValue);
+		map<string, string>::const_iterator it;
+		for(it = calls[i].second.begin(); it != calls[i].second.end(); ++it){
+			args[it->first] = it->second;
+		}
+		string json = writer.write(args);
+		if(!json.empty() && json[json.size() - 1] == '\n') json.erase(json.size() - 1);
+
+		if(i) code += ",";
+		code += "API." + calls[i].first + "(" + json + ")";
+	}
+	code += "];";
+	return code;
+}
+
+void VK::ExecuteBatcher::send(vector<VK::ExecuteBatcher::Call> calls){
+	vector<pair<string, map<string, string> > > methods;
+	for(size_t i = 0; i < calls.size(); i++){
+		methods.push_back(make_pair(calls[i].method, calls[i].params));
+	}
+	map<string, string> params;
+	params["code"] = script(methods);
+
+	api->callAsync("execute", params, [calls](Json::Value resp){
+		vector<Json::Value> roots = results(calls.size(), resp);
+		for(size_t i = 0; i < calls.size(); i++){
+			calls[i].result->set_value(roots[i]);
+		}
+	});
+}
+
+bool VK::ExecuteBatcher::batchable(const string &method){
+	size_t dot = method.find('.');
+	string name = dot == string::npos ? method : method.substr(dot + 1);
+	return name.compare(0, 2, "is") != 0 && name.compare(0, 5, "check") != 0;
+}
+
+vector<Json::Value> VK::ExecuteBatcher::results(size_t calls, const Json::Value &resp){
+	if(!resp["success"].asBool() || !resp["response"].isArray()){
+		return vector<Json::Value>(calls, resp);
+	}
+
+	const Json::Value &results = resp["response"];
+	const Json::Value &errors = resp["execute_errors"];
+	Json::Value::ArrayIndex failed = 0;
+	vector<Json::Value> roots(calls);
+	for(size_t i = 0; i < calls; i++){
+		Json::Value &root = roots[i];
+		const Json::Value &result = results[(Json::Value::ArrayIndex)i];
+		if(result.isBool() && !result.asBool()){
+			root["error"] = errors.isArray() && failed < errors.size() ? errors[failed] : Json::Value(Json::objectValue);
 			root["success"] = false;
+			failed++;
+		}else{
+			root["response"] = result;
+			root["success"] = true;
 		}
-	}else{
-		root["success"] = true;
 	}
+	return roots;
+}
 
-	return root;
+// USERS PAGER
+const size_t VK::UsersPager::SEARCH_LIMIT;
+
+VK::UsersPager::UsersPager(VK::API *api, string method, map<string, string> params, size_t prefetch, size_t limit){
+	VK::UsersPager::api = api;
+	VK::UsersPager::method = method;
+	VK::UsersPager::params = params;
+	VK::UsersPager::prefetch = prefetch;
+	fields = VK::UserFull::Fields::of(params);
+	count = -1;
+	position = 0;
+	error_code = 0;
+
+	// Largest page each method allows
+	page_size = method == "users.getSubscriptions" ? 200 : 1000;
+	map<string, string>::const_iterator it = params.find("count");
+	if(it != params.end() && atoi(it->second.c_str()) > 0) page_size = atoi(it->second.c_str());
+	it = params.find("offset");
+	start = it != params.end() ? atoi(it->second.c_str()) : 0;
+	offset = start;
+
+	stop = limit ? start + limit : (size_t)-1;
+	if(method == "users.search" && stop > SEARCH_LIMIT) stop = SEARCH_LIMIT;
+	fill(1);
 }
 
-VK::UsersList VK::API::usersGet(map<string, string> params){
-	Json::Value resp = this->call("users.get", params);
-	VK::UsersList *users;
-	if(resp["success"].asBool()){
-		 users = new VK::UsersList(resp["response"]);
+void VK::UsersPager::request(){
+	size_t size = page_size;
+	if(count >= 0 && (size_t)count < stop) stop = (size_t)count;
+	if(offset + size > stop) size = stop - offset;
+	params["offset"] = to_string(offset);
+	params["count"] = to_string(size);
+	pending.push_back(api->callAsync(method, params));
+	offset += size;
+}
+
+void VK::UsersPager::fill(size_t window){
+	while(!error_code && pending.size() < window && offset < stop && (count < 0 || offset < (size_t)count)){
+		request();
 	}
-	return *users;
 }
 
-vector<VK::UserFull> VK::API::usersSearch(map<string, string> params){
-	vector<VK::UserFull> users;
-	Json::Value resp = this->call("users.search", params);
-	if(resp["success"].asBool() && resp["response"]["items"].isArray()){
-		users = VK::UsersList::parse(resp["response"]["items"]);
-	} 
-	return users;
+bool VK::UsersPager::next(vector<VK::UserFull> &page){
+	page.clear();
+	while(page.empty()){
+		fill(1);
+		if(pending.empty()) return false;
+		Json::Value resp = pending.front().get();
+		pending.pop_front();
+
+		if(!resp["success"].asBool()){
+			error_code = resp["error"]["error_code"].asInt();
+			error_msg = resp["error"]["error_msg"].asString();
+			if(!error_code) error_code = -1;
+			pending.clear();
+			return false;
+		}
+		const Json::Value &items = resp["response"]["items"];
+		if(resp["response"]["count"].isIntegral()) count = resp["response"]["count"].asInt64();
+
+		// An empty page means the API has nothing more, whatever count says
+		if(!items.isArray() || items.empty()){
+			pending.clear();
+			return false;
+		}
+		VK::UsersList::parse(items, page, fields);
+
+		// Following pages are fetched while the caller reads this one
+		fill(prefetch);
+	}
+	return true;
 }
 
-bool VK::API::usersIsAppUser(map<string, string> params){
-	Json::Value resp = this->call("users.isAppUser", params);
-	if(resp["success"].asBool()){
-		return resp["response"] == "1" ? true : false;
-	} 
-	return false;
+bool VK::UsersPager::advance(){
+	position = 0;
+	return next(page);
 }
 
-string VK::API::post(string url, string data){
-	static char errorBuffer[CURL_ERROR_SIZE];
-	static string buffer;
+VK::UsersPager::iterator VK::UsersPager::begin(){
+	if(position >= page.size() && !advance()) return end();
+	return VK::UsersPager::iterator(this);
+}
 
-	CURL *curl;
-    CURLcode result;
-    curl = curl_easy_init();
-    if (curl){
-		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
-		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, VK::Utils::CURL_WRITER);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
-		result = curl_easy_perform(curl);
-		if (result == CURLE_OK)      
-			return buffer;             
-		else      
-			return errorBuffer; 
-	}
-	curl_easy_cleanup(curl);
-}
-
-VK::User VK::User::parse(Json::Value json){
+VK::UsersPager::iterator VK::UsersPager::end(){
+	return VK::UsersPager::iterator();
+}
+
+long long VK::UsersPager::total(){
+	return count;
+}
+
+int VK::UsersPager::errorCode(){
+	return error_code;
+}
+
+string VK::UsersPager::errorMessage(){
+	return error_msg;
+}
+
+VK::UsersPager::iterator::iterator(VK::UsersPager *pager){
+	VK::UsersPager::iterator::pager = pager;
+}
+
+const VK::UserFull &VK::UsersPager::iterator::operator*() const{
+	return pager->page[pager->position];
+}
+
+const VK::UserFull *VK::UsersPager::iterator::operator->() const{
+	return &pager->page[pager->position];
+}
+
+VK::UsersPager::iterator &VK::UsersPager::iterator::operator++(){
+	if(++pager->position >= pager->page.size() && !pager->advance()) pager = NULL;
+	return *this;
+}
+
+bool VK::UsersPager::iterator::operator==(const VK::UsersPager::iterator &other) const{
+	return pager == other.pager;
+}
+
+bool VK::UsersPager::iterator::operator!=(const VK::UsersPager::iterator &other) const{
+	return pager != other.pager;
+}
+
+// MODELS
+
+/**
+	Assign string value without creating a temporary string
+*/
+static void assign(string &out, const Json::Value &value){
+	if(value.isString()) out.assign(value.asCString());
+	else if(value.isNull()) out.clear();
+	else out = value.asString();
+}
+
+/**
+	Intern value in the current pool without creating a temporary string
+*/
+static void assign(VK::Interned &out, const Json::Value &value){
+	if(value.isString()){
+		const char *str = value.asCString();
+		out = VK::StringPool::current().intern(str, strlen(str));
+	}else if(value.isNull()){
+		out = VK::Interned();
+	}else{
+		out = value.asString();
+	}
+}
+
+VK::User VK::User::parse(const Json::Value &json){
 	VK::User user;
-	user.first_name = json["first_name"].asString();
-	user.last_name = json["last_name"].asString();
+	parse(json, user);
+	return user;
+}
+
+void VK::User::parse(const Json::Value &json, VK::User &user){
+	user.id = json["id"].asInt();
+	assign(user.first_name, json["first_name"]);
+	assign(user.last_name, json["last_name"]);
 	user.online = json["online"].asBool();
 	user.online_mobile = json["online_mobile"].asBool();
-	user.photo_50 = json["photo_50"].asString();
-	user.photo_100 = json["photo_100"].asString();
-	user.photo_200 = json["photo_200"].asString();
+	assign(user.photo_50, json["photo_50"]);
+	assign(user.photo_100, json["photo_100"]);
+	assign(user.photo_200, json["photo_200"]);
+}
+
+VK::UserFull VK::UserFull::parse(const Json::Value &json){
+	VK::UserFull user;
+	parse(json, user);
 	return user;
 }
 
-VK::UserFull VK::UserFull::parse(Json::Value json){
-	VK::UserFull *user = new VK::UserFull();
-	user->first_name = json["first_name"].asString();
-	user->last_name = json["last_name"].asString();
-	user->online = json["online"].asBool();
-	user->online_mobile = json["online_mobile"].asBool();
-	user->photo_50 = json["photo_50"].asString();
-	user->photo_100 = json["photo_100"].asString();
-	user->photo_200 = json["photo_200"].asString();
+void VK::UserFull::parse(const Json::Value &json, VK::UserFull &user){
+	parse(json, user, VK::UserFull::Fields::ALL);
+}
+
+void VK::UserFull::parse(const Json::Value &json, VK::UserFull &user, unsigned long long fields){
+	typedef VK::UserFull::Fields F;
+
+	user.id = json["id"].asInt();
+	assign(user.first_name, json["first_name"]);
+	assign(user.last_name, json["last_name"]);
+	if(fields & F::ONLINE){
+		user.online = json["online"].asBool();
+		user.online_mobile = json["online_mobile"].asBool();
+	}
+	if(fields & F::PHOTO_50) assign(user.photo_50, json["photo_50"]);
+	if(fields & F::PHOTO_100) assign(user.photo_100, json["photo_100"]);
+	if(fields & F::PHOTO_200) assign(user.photo_200, json["photo_200"]);
+
+	if(fields & F::PHOTO_ID) assign(user.photo_id, json["photo_id"]);
+	if(fields & F::VERIFIED) user.verified = json["verified"].asBool();
+	if(fields & F::BLACKLISTED) user.blacklisted = json["blacklisted"].asBool();
+	if(fields & F::SEX) user.sex = json["sex"].asInt();
+	if(fields & F::BDATE) assign(user.bdate, json["bdate"]);
+	if(fields & F::CITY) VK::City::parse(json["city"], user.city);
+	if(fields & F::COUNTRY) VK::Country::parse(json["country"], user.country);
+	if(fields & F::HOME_TOWN) assign(user.home_town, json["home_town"]);
+	if(fields & F::DOMAIN) assign(user.domain, json["domain"]);
+	if(fields & F::HAS_MOBILE) user.has_mobile = json["has_mobile"].asBool();
+	if(fields & F::CONTACTS) VK::UserFull::Contacts::parse(json["contacts"], user.contacts);
+	if(fields & F::SITE) assign(user.site, json["site"]);
+	if(fields & F::EDUCATION) VK::Education::parse(json["education"], user.education);
 
-	user->photo_id = json["photo_id"].asString();
-	user->verified = json["verified"].asBool();
-	user->blacklisted = json["blacklisted"].asBool();
-	user->sex = json["sex"].asInt();
-	user->bdate = json["last_name"].asString();
-	user->city = VK::City::parse(json["city"]);
-	user->country = VK::Country::parse(json["country"]);
-	user->home_town = json["home_town"].asString();
-	user->domain = json["domain"].asString();
-	user->has_mobile = json["has_mobile"].asBool();
-	user->contacts = VK::UserFull::Contacts::parse(json["contacts"]);
-	user->site = json["site"].asString();
-	user->education = VK::Education::parse(json["education"]);
+	if(fields & F::UNIVERSITIES){
+		const Json::Value &universities = json["universities"];
+		if(universities.isArray()){
+			user.universities.resize(universities.size());
+			for(Json::Value::ArrayIndex i = 0; i < universities.size(); i++){
+				VK::University::parse(universities[i], user.universities[i]);
+			}
+		}else{
+			user.universities.clear();
+		}
+	}
 
-	Json::Value universities = json["universities"];
-	if(universities.isArray()){
-		for(int i = 0; i < universities.size(); i++){
-			user->universities.push_back(VK::University::parse(universities[i]));
+	if(fields & F::SCHOOLS){
+		const Json::Value &schools = json["schools"];
+		if(schools.isArray()){
+			user.schools.resize(schools.size());
+			for(Json::Value::ArrayIndex i = 0; i < schools.size(); i++){
+				VK::School::parse(schools[i], user.schools[i]);
+			}
+		}else{
+			user.schools.clear();
 		}
 	}
 
-	Json::Value schools = json["schools"];
-	if(schools.isArray()){
-		for(int i = 0; i < schools.size(); i++){
-			user->schools.push_back(VK::School::parse(schools[i]));
+	if(fields & F::STATUS) assign(user.status, json["status"]);
+	if(fields & F::LAST_SEEN) VK::UserFull::Seen::parse(json["last_seen"], user.last_seen);
+	if(fields & F::FOLLOWERS_COUNT) user.followers_count = json["followers_count"].asInt();
+	if(fields & F::COMMON_COUNT) user.common_count = json["common_count"].asInt();
+
+	if(fields & F::COUNTERS){
+		user.counters.clear();
+		const Json::Value &counters = json["counters"];
+		if(counters.isObject()){
+			for(Json::Value::const_iterator it = counters.begin(); it != counters.end(); ++it){
+				user.counters[it.key().asString()] = (*it).asInt();
+			}
 		}
 	}
+}
 
-	user->status = json["status"].asString();
-	user->last_seen = VK::UserFull::Seen::parse(json["last_seen"]);
-	user->followers_count = json["followers_count"].asInt();
-	user->common_count = json["common_count"].asInt();
+unsigned long long VK::UserFull::Fields::parse(const string &fields){
+	typedef VK::UserFull::Fields F;
+	static const struct{
+		const char *name;
+		unsigned long long bit;
+	} names[] = {
+		{"online", F::ONLINE}, {"photo_50", F::PHOTO_50}, {"photo_100", F::PHOTO_100},
+		{"photo_200", F::PHOTO_200}, {"photo_id", F::PHOTO_ID}, {"verified", F::VERIFIED},
+		{"blacklisted", F::BLACKLISTED}, {"sex", F::SEX}, {"bdate", F::BDATE},
+		{"city", F::CITY}, {"country", F::COUNTRY}, {"home_town", F::HOME_TOWN},
+		{"domain", F::DOMAIN}, {"has_mobile", F::HAS_MOBILE}, {"contacts", F::CONTACTS},
+		{"site", F::SITE}, {"education", F::EDUCATION}, {"universities", F::UNIVERSITIES},
+		{"schools", F::SCHOOLS}, {"status", F::STATUS}, {"last_seen", F::LAST_SEEN},
+		{"followers_count", F::FOLLOWERS_COUNT}, {"common_count", F::COMMON_COUNT},
+		{"counters", F::COUNTERS}
+	};
 
-	Json::Value counters = json["counters"];
-	if(counters.isObject()){
-		for(Json::Value::iterator it = counters.begin(); it !=counters.end(); ++it){
-			Json::Value key = it.key();
-			Json::Value value = (*it);
-			user->counters.insert(std::pair<string, int>(key.asString(), value.asInt()));
+	unsigned long long mask = 0;
+	size_t start = 0;
+	while(start <= fields.size()){
+		size_t end = fields.find(',', start);
+		if(end == string::npos) end = fields.size();
+		size_t from = start, to = end;
+		while(from < to && fields[from] == ' ') from++;
+		while(to > from && fields[to - 1] == ' ') to--;
+		for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++){
+			if(fields.compare(from, to - from, names[i].name) == 0){
+				mask |= names[i].bit;
+				break;
+			}
 		}
+		start = end + 1;
 	}
-	
-	return *user;
+	return mask;
+}
+
+unsigned long long VK::UserFull::Fields::of(const map<string, string> &params){
+	map<string, string>::const_iterator it = params.find(VK::Parameters::FIELDS);
+	return it == params.end() ? 0 : parse(it->second);
 }
 
 
-VK::City VK::City::parse(Json::Value json){
+VK::City VK::City::parse(const Json::Value &json){
 	VK::City city;
-	city.id = json["id"].asInt();
-	city.title = json["title"].asString();
+	parse(json, city);
 	return city;
 }
 
-VK::Country VK::Country::parse(Json::Value json){
+void VK::City::parse(const Json::Value &json, VK::City &city){
+	city.id = json["id"].asInt();
+	assign(city.title, json["title"]);
+}
+
+VK::Country VK::Country::parse(const Json::Value &json){
 	VK::Country country;
-	country.id = json["id"].asInt();
-	country.title = json["title"].asString();
+	parse(json, country);
 	return country;
 }
 
-VK::Education VK::Education::parse(Json::Value json){
+void VK::Country::parse(const Json::Value &json, VK::Country &country){
+	country.id = json["id"].asInt();
+	assign(country.title, json["title"]);
+}
+
+VK::Education VK::Education::parse(const Json::Value &json){
 	VK::Education education;
+	parse(json, education);
+	return education;
+}
+
+void VK::Education::parse(const Json::Value &json, VK::Education &education){
 	education.university = json["university"].asInt();
-	education.university_name = json["university_name"].asString();
+	assign(education.university_name, json["university_name"]);
 	education.faculty = json["faculty"].asInt();
-	education.faculty_name = json["faculty_name"].asString();
+	assign(education.faculty_name, json["faculty_name"]);
 	education.graduation = json["graduation"].asInt();
-	return education;
 }
 
-VK::University VK::University::parse(Json::Value json){
+VK::University VK::University::parse(const Json::Value &json){
 	VK::University university;
+	parse(json, university);
+	return university;
+}
+
+void VK::University::parse(const Json::Value &json, VK::University &university){
 	university.id = json["id"].asInt();
 	university.country = json["country"].asInt();
 	university.city = json["city"].asInt();
-	university.name = json["name"].asString();
+	assign(university.name, json["name"]);
 	university.faculty = json["faculty"].asInt();
-	university.faculty_name = json["faculty"].asString();
-	university.chair = json["chair"].asInt();
-	university.faculty_name = json["faculty"].asString();
+	assign(university.faculty_name, json["faculty_name"]);
 	university.chair = json["chair"].asInt();
-	university.chair_name = json["chair_name"].asString();
+	assign(university.chair_name, json["chair_name"]);
 	university.graduation = json["graduation"].asInt();
-	return university;
 }
 
-VK::School VK::School::parse(Json::Value json){
+VK::School VK::School::parse(const Json::Value &json){
 	VK::School school;
+	parse(json, school);
+	return school;
+}
+
+void VK::School::parse(const Json::Value &json, VK::School &school){
 	school.id = json["id"].asInt();
 	school.country = json["country"].asInt();
 	school.city = json["city"].asInt();
-	school.name = json["name"].asString();
+	assign(school.name, json["name"]);
 	school.year_from = json["year_from"].asInt();
 	school.year_to = json["year_to"].asInt();
 	school.year_graduated = json["year_graduated"].asInt();
-	school.class_l = json["class"].asString();
-	school.speciality = json["speciality"].asString();
+	assign(school.class_l, json["class"]);
+	assign(school.speciality, json["speciality"]);
 	school.type = json["type"].asInt();
-	school.type_str = json["type_str"].asString();
-	return school;
+	assign(school.type_str, json["type_str"]);
 }
 
 
-VK::UserFull::Contacts VK::UserFull::Contacts::parse(Json::Value json){
+VK::UserFull::Contacts VK::UserFull::Contacts::parse(const Json::Value &json){
 	VK::UserFull::Contacts contacts;
-	contacts.mobile_phone = json["mobile_phone"].asString();
-	contacts.home_phone = json["home_phone"].asString();
+	parse(json, contacts);
 	return contacts;
 }
 
-VK::UserFull::Seen VK::UserFull::Seen::parse(Json::Value json){
+void VK::UserFull::Contacts::parse(const Json::Value &json, VK::UserFull::Contacts &contacts){
+	assign(contacts.mobile_phone, json["mobile_phone"]);
+	assign(contacts.home_phone, json["home_phone"]);
+}
+
+VK::UserFull::Seen VK::UserFull::Seen::parse(const Json::Value &json){
 	VK::UserFull::Seen seen;
+	parse(json, seen);
+	return seen;
+}
+
+void VK::UserFull::Seen::parse(const Json::Value &json, VK::UserFull::Seen &seen){
 	seen.time = json["time"].asInt64();
 	seen.platform = json["platform"].asInt();
-	return seen;
 }
 
+const string VK::UserFull::Occupation::TYPE_WORK = "work";
+const string VK::UserFull::Occupation::TYPE_SCHOOL = "school";
+const string VK::UserFull::Occupation::TYPE_UNIVERSITY = "university";
+
 VK::UsersList::UsersList(vector<VK::UserFull> users){
-	list = users;
+	list.swap(users);
 }	
-VK::UsersList::UsersList(Json::Value json){
-	vector<UserFull> users = parse(json);
-	list = users;	
+VK::UsersList::UsersList(const Json::Value &json){
+	parse(json, list);
 }
 vector<VK::UserFull> VK::UsersList::toVector(){
 	return list;
 }
-vector<VK::UserFull> VK::UsersList::parse(Json::Value json){
-		vector<VK::UserFull> users;
-		if(json.isArray()){
-			for(int i = 0; i < json.size(); i++){
-				users.push_back(VK::UserFull::parse(json[i]));
-			}
+vector<VK::UserFull> VK::UsersList::take(){
+	vector<VK::UserFull> users;
+	users.swap(list);
+	return users;
+}
+vector<VK::UserFull> VK::UsersList::parse(const Json::Value &json){
+	vector<VK::UserFull> users;
+	parse(json, users);
+	return users;
+}
+void VK::UsersList::parse(const Json::Value &json, vector<VK::UserFull> &users, unsigned long long fields){
+	if(!json.isArray()) return;
+	size_t offset = users.size();
+	users.resize(offset + json.size());
+	for(Json::Value::ArrayIndex i = 0; i < json.size(); i++){
+		const Json::Value &item = json[i];
+		if(item.isIntegral()){
+			users[offset] = VK::UserFull();
+			users[offset++].id = item.asInt();
+		}else if(item.isObject() && (!item.isMember("type") || item["type"].asString() == "profile")){
+			VK::UserFull::parse(item, users[offset++], fields);
 		}
-		return users;
+	}
+	users.resize(offset);
+}
+
+// INTERNED STRINGS
+static const string *emptyString(){
+	static const string empty;
+	return &empty;
+}
+
+VK::Interned::Interned(){
+	value = emptyString();
+}
+
+VK::Interned::Interned(const string *value){
+	VK::Interned::value = value;
+}
+
+VK::Interned::Interned(const string &value){
+	*this = VK::StringPool::current().intern(value);
+}
+
+VK::Interned::Interned(const char *value){
+	*this = VK::StringPool::current().intern(value, strlen(value));
+}
+
+VK::Interned &VK::Interned::operator=(const string &value){
+	return *this = VK::StringPool::current().intern(value);
+}
+
+VK::Interned &VK::Interned::operator=(const char *value){
+	return *this = VK::StringPool::current().intern(value, strlen(value));
+}
+
+VK::Interned &VK::Interned::assign(const char *value, size_t length){
+	return *this = VK::StringPool::current().intern(value, length);
+}
+
+const string &VK::Interned::str() const{
+	return *value;
+}
+
+const char *VK::Interned::c_str() const{
+	return value->c_str();
+}
+
+size_t VK::Interned::size() const{
+	return value->size();
+}
+
+size_t VK::Interned::length() const{
+	return value->size();
+}
+
+bool VK::Interned::empty() const{
+	return value->empty();
+}
+
+VK::Interned::operator const string &() const{
+	return *value;
+}
+
+bool VK::Interned::operator==(const VK::Interned &other) const{
+	return value == other.value || *value == *other.value;
+}
+
+bool VK::Interned::operator!=(const VK::Interned &other) const{
+	return !(*this == other);
+}
+
+bool VK::Interned::operator==(const string &other) const{
+	return *value == other;
+}
+
+bool VK::Interned::operator!=(const string &other) const{
+	return *value != other;
+}
+
+bool VK::Interned::operator==(const char *other) const{
+	return *value == other;
+}
+
+bool VK::Interned::operator!=(const char *other) const{
+	return *value != other;
+}
+
+ostream &VK::operator<<(ostream &out, const VK::Interned &value){
+	return out << value.str();
+}
+
+VK::StringPool::StringPool(){
+	for(size_t i = 0; i < SHARDS; i++){
+		shards[i].bytes = 0;
+		shards[i].requests = 0;
+		shards[i].saved_bytes = 0;
+	}
+}
+
+VK::StringPool &VK::StringPool::shared(){
+	static VK::StringPool *pool = new VK::StringPool();
+	return *pool;
+}
+
+/**
+	Pool of the innermost Scope of this thread
+*/
+static thread_local VK::StringPool *scoped = NULL;
+
+VK::StringPool &VK::StringPool::current(){
+	return scoped ? *scoped : shared();
+}
+
+VK::StringPool::Scope::Scope(VK::StringPool &pool){
+	previous = scoped;
+	scoped = &pool;
+}
+
+VK::StringPool::Scope::~Scope(){
+	scoped = previous;
+}
+
+VK::Interned VK::StringPool::intern(const string &value){
+	return intern(value.data(), value.size());
+}
+
+VK::Interned VK::StringPool::intern(const char *value, size_t length){
+	if(!length) return VK::Interned();
+
+	// Lookup key buffer is reused, so repeated values do not allocate
+	static thread_local string key;
+	key.assign(value, length);
+	VK::StringPool::Shard &shard = shards[hash<string>()(key) % SHARDS];
+
+	lock_guard<mutex> guard(shard.lock);
+	shard.requests++;
+	unordered_set<string>::iterator it = shard.strings.find(key);
+	if(it != shard.strings.end()){
+		shard.saved_bytes += length;
+		return VK::Interned(&*it);
+	}
+	shard.bytes += length;
+	return VK::Interned(&*shard.strings.insert(key).first);
+}
+
+VK::StringPool::Stats VK::StringPool::getStats(){
+	VK::StringPool::Stats stats;
+	stats.strings = 0;
+	stats.bytes = 0;
+	stats.requests = 0;
+	stats.saved_bytes = 0;
+	for(size_t i = 0; i < SHARDS; i++){
+		lock_guard<mutex> guard(shards[i].lock);
+		stats.strings += shards[i].strings.size();
+		stats.bytes += shards[i].bytes;
+		stats.requests += shards[i].requests;
+		stats.saved_bytes += shards[i].saved_bytes;
+	}
+	return stats;
 }
 
 // PARAMETERS
@@ -335,6 +2105,42 @@ const string VK::Parameters::REV = "rev";
 const string VK::Parameters::FEED_TYPE = "feed_type";
 const string VK::Parameters::FEED = "feed";
 
+VK::Parameters::Parameters(){
+}
+
+string VK::Parameters::join(const vector<string> &values, char separator){
+	string joined;
+	for(size_t i = 0; i < values.size(); i++){
+		if(i) joined += separator;
+		joined += values[i];
+	}
+	return joined;
+}
+
+string VK::Parameters::join(const vector<int> &values, char separator){
+	string joined;
+	for(size_t i = 0; i < values.size(); i++){
+		if(i) joined += separator;
+		joined += to_string(values[i]);
+	}
+	return joined;
+}
+
+void VK::Parameters::append(string &joined, bool &first, const string &value){
+	if(!first) joined += ',';
+	first = false;
+	joined += value;
+}
+
+void VK::Parameters::append(string &joined, bool &first, const char *value){
+	append(joined, first, string(value));
+}
+
+void VK::Parameters::append(string &joined, bool &first, char value){
+	append(joined, first, string(1, value));
+}
+
+
 
 // HTTP 
 string VK::Utils::char2hex( char dec ){
@@ -351,34 +2157,97 @@ string VK::Utils::char2hex( char dec ){
     return r;
 }
 
+// Bytes sent as is, everything else is percent encoded
+class UrlTable{
+public:
+	bool safe[256];
+
+	UrlTable(){
+		for(int c = 0; c < 256; c++){
+			safe[c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
+				|| c == '~' || c == '!' || c == '*' || c == '(' || c == ')' || c == '\'';
+		}
+	}
+};
+
+static const UrlTable URL_TABLE;
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// Length of the leading run of letters and digits, checked in 16 byte blocks.
+// Stops at the first block with another byte, the rest is left to the table
+static size_t alnumRun(const char *c, size_t size){
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i before_0 = _mm_set1_epi8('0' - 1);
+	const __m128i after_9 = _mm_set1_epi8('9' + 1);
+	const __m128i before_a = _mm_set1_epi8('a' - 1);
+	const __m128i after_z = _mm_set1_epi8('z' + 1);
+	const __m128i lower = _mm_set1_epi8(0x20);
+	for(; i + 16 <= size; i += 16){
+		__m128i block = _mm_loadu_si128((const __m128i*)(c + i));
+		// Bytes from 0x80 are negative and fail both signed range checks
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(block, before_0), _mm_cmplt_epi8(block, after_9));
+		__m128i folded = _mm_or_si128(block, lower);
+		__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(folded, before_a), _mm_cmplt_epi8(folded, after_z));
+		int mask = _mm_movemask_epi8(_mm_or_si128(digit, letter));
+		if(mask != 0xFFFF) return i + __builtin_ctz(~mask);
+	}
+#endif
+	return i;
+}
+
+void VK::Utils::urlencode(const char *c, size_t size, string &out){
+	size_t i = 0;
+	while(i < size){
+		size_t end = i + alnumRun(c + i, size - i);
+		while(end < size && URL_TABLE.safe[(unsigned char)c[end]]) end++;
+		out.append(c + i, end - i);
+		i = end;
+
+		// Escaped run is written in place after one resize
+		while(end < size && !URL_TABLE.safe[(unsigned char)c[end]]) end++;
+		if(end == i) continue;
+		size_t at = out.size();
+		out.resize(at + (end - i) * 3);
+		char *escaped = &out[at];
+		for(; i < end; i++){
+			unsigned char byte = (unsigned char)c[i];
+			*escaped++ = '%';
+			*escaped++ = HEX_DIGITS[byte >> 4];
+			*escaped++ = HEX_DIGITS[byte & 0x0F];
+		}
+	}
+}
+
 string VK::Utils::urlencode(const string &c){
-    string escaped="";
-    int max = c.length();
-    for(int i=0; i<max; i++){
-        if ( (48 <= c[i] && c[i] <= 57) ||
-             (65 <= c[i] && c[i] <= 90) ||
-             (97 <= c[i] && c[i] <= 122) || 
-             (c[i]=='~' || c[i]=='!' || c[i]=='*' || c[i]=='(' || c[i]==')' || c[i]=='\'')
-        )
-		escaped.append( &c[i], 1);
-        else{
-            escaped.append("%");
-            escaped.append( char2hex(c[i]) );
-        }
-    }
-    return escaped;
-}
-
-string VK::Utils::data2str(map<string, string> data){
-	string poststring="";
-	map<string, string>::iterator curr,end;
-    for(curr = data.begin(), end = data.end(); curr != end; curr++){
-        poststring+= curr->first + "=" + urlencode(curr->second)+ "&";
-    }
+	string escaped;
+	escaped.reserve(c.size() + c.size() / 2);
+	urlencode(c.data(), c.size(), escaped);
+	return escaped;
+}
+
+void VK::Utils::data2str(const map<string, string> &data, string &out){
+	map<string, string>::const_iterator it;
+	for(it = data.begin(); it != data.end(); ++it){
+		out += it->first;
+		out += '=';
+		urlencode(it->second.data(), it->second.size(), out);
+		out += '&';
+	}
+}
+
+string VK::Utils::data2str(const map<string, string> &data){
+	string poststring;
+	data2str(data, poststring);
 	return poststring;
 }
 
 
+size_t VK::Utils::CURL_STREAM_WRITER(char *data, size_t size, size_t nmemb, VK::JsonStream *stream){
+	if(stream == NULL || !stream->feed(data, size * nmemb)) return 0;
+	return size * nmemb;
+}
+
 int VK::Utils::CURL_WRITER(char *data, size_t size, size_t nmemb, string *buffer){
 	int result = 0;
 	if (buffer != NULL){
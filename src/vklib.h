@@ -8,6 +8,21 @@
 #include <string>
 #include <map> 
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <unordered_set>
+#include <unordered_map>
+#include <list>
+#include <ostream>
+#include <type_traits>
+#include <random>
+#include <curl/curl.h>
 #include "jsoncpp/json/json.h"
 #ifndef VKLIB_H
 #define VKLIB_H
@@ -27,16 +42,133 @@ namespace VK{
 			Model parse();
 	};
 
+	class StringPool;
+
+	/**
+		A Interned class is a string stored once in a StringPool.
+		Copies share the pooled string, values of one pool are compared by pointer
+	*/
+	class Interned{
+	public:
+		Interned();
+		Interned(const string &value);
+		Interned(const char *value);
+
+		/**
+			Intern value in StringPool::current()
+		*/
+		Interned &operator=(const string &value);
+		Interned &operator=(const char *value);
+		Interned &assign(const char *value, size_t length);
+
+		const string &str() const;
+		const char *c_str() const;
+		size_t size() const;
+		size_t length() const;
+		bool empty() const;
+		operator const string &() const;
+
+		bool operator==(const Interned &other) const;
+		bool operator!=(const Interned &other) const;
+		bool operator==(const string &other) const;
+		bool operator!=(const string &other) const;
+		bool operator==(const char *other) const;
+		bool operator!=(const char *other) const;
+
+	private:
+		friend class StringPool;
+		const string *value;
+
+		explicit Interned(const string *value);
+	};
+
+	ostream &operator<<(ostream &out, const Interned &value);
+
+	/**
+		A StringPool class is a thread-safe table of unique strings.
+		Strings live until the pool is destroyed, so a pool must outlive its Interned values
+	*/
+	class StringPool{
+	public:
+		/**
+			A Scope class makes a pool current for the calling thread while it lives.
+			Models parsed and Interned values assigned on the thread go to that pool
+		*/
+		class Scope{
+		public:
+			Scope(StringPool &pool);
+			~Scope();
+
+		private:
+			StringPool *previous;
+
+			Scope(const Scope&) = delete;
+			Scope &operator=(const Scope&) = delete;
+		};
+
+		/**
+			A Stats class describes pool usage
+		*/
+		class Stats{
+		public:
+			size_t strings;
+			size_t bytes;
+			unsigned long long requests;
+			unsigned long long saved_bytes;
+		};
+
+		StringPool();
+
+		/**
+			@param value string
+			@return pooled copy of value
+		*/
+		Interned intern(const string &value);
+		Interned intern(const char *value, size_t length);
+
+		Stats getStats();
+
+		/**
+			Pool used outside of any Scope. It is never destroyed and never shrinks,
+			every distinct string stays until the process exits, so processes reading
+			unbounded distinct values should parse within a Scope of a pool they free
+		*/
+		static StringPool &shared();
+
+		/**
+			@return pool of the innermost Scope of the calling thread, shared() without one
+		*/
+		static StringPool &current();
+
+	private:
+		static const size_t SHARDS = 16;
+
+		class Shard{
+		public:
+			mutex lock;
+			unordered_set<string> strings;
+			size_t bytes;
+			unsigned long long requests;
+			unsigned long long saved_bytes;
+		};
+
+		Shard shards[SHARDS];
+
+		StringPool(const StringPool&) = delete;
+		StringPool &operator=(const StringPool&) = delete;
+	};
+
 	/**
 		A City class describes a city.
 	*/
 	class City: public Model{
 		public:
 			int id;
-			string title;
+			Interned title;
 
 			int getId();
-			static City parse(Json::Value);
+			static City parse(const Json::Value &json);
+			static void parse(const Json::Value &json, City &city);
 	};
 	/**
 		A Country class describes a country.
@@ -44,10 +176,11 @@ namespace VK{
 	class Country: public Model{
 		public:
 			int id;
-			string title;
+			Interned title;
 
 			int getId();
-			static Country parse(Json::Value);
+			static Country parse(const Json::Value &json);
+			static void parse(const Json::Value &json, Country &country);
 	};
 
 	/**
@@ -56,9 +189,9 @@ namespace VK{
 	class Education: public Model{
 	public: 
 		int university;
-		string university_name;
+		Interned university_name;
 		int faculty;
-		string faculty_name;
+		Interned faculty_name;
 		int graduation;
 
 		/**
@@ -67,7 +200,15 @@ namespace VK{
 			@param json Json Value Object
 			@return Education object
 		*/
-		static Education parse(Json::Value json);
+		static Education parse(const Json::Value &json);
+
+		/**
+			Parse Education object from Json Value object into existing object
+
+			@param json Json Value Object
+			@param education Education object to fill
+		*/
+		static void parse(const Json::Value &json, Education &education);
 	};
 
 	/**
@@ -78,11 +219,11 @@ namespace VK{
 		int id;
 		int country;
 		int city;
-		string name;
+		Interned name;
 		int faculty;
-		string faculty_name;
+		Interned faculty_name;
 		int chair;
-		string chair_name;
+		Interned chair_name;
 		int graduation;
 
 		/**
@@ -91,7 +232,15 @@ namespace VK{
 			@param json Json Value Object
 			@return University object
 		*/
-		static University parse(Json::Value json);
+		static University parse(const Json::Value &json);
+
+		/**
+			Parse University object from Json Value object into existing object
+
+			@param json Json Value Object
+			@param university University object to fill
+		*/
+		static void parse(const Json::Value &json, University &university);
 	};
 	
 	/**
@@ -102,14 +251,14 @@ namespace VK{
 		int id;
 		int country;
 		int city;
-		string name;
+		Interned name;
 		int year_from;
 		int year_to;
 		int year_graduated;
 		string class_l;
 		string speciality;
 		int type;
-		string type_str;
+		Interned type_str;
 
 		/**
 			Parse School object from Json Value object
@@ -117,7 +266,15 @@ namespace VK{
 			@param json Json Value Object
 			@return School object
 		*/
-		static School parse(Json::Value json);
+		static School parse(const Json::Value &json);
+
+		/**
+			Parse School object from Json Value object into existing object
+
+			@param json Json Value Object
+			@param school School object to fill
+		*/
+		static void parse(const Json::Value &json, School &school);
 	};
 
 	/**
@@ -125,6 +282,7 @@ namespace VK{
 	*/
 	class User: public Model{
 		public:
+			int id;
 			string first_name;
 			string last_name;
 			bool online;
@@ -139,7 +297,15 @@ namespace VK{
 				@param json Json Value Object
 				@return User object
 			*/
-			static User parse(Json::Value json);
+			static User parse(const Json::Value &json);
+
+			/**
+				Parse user from Json Value Object into existing object
+
+				@param json Json Value Object
+				@param user User object to fill
+			*/
+			static void parse(const Json::Value &json, User &user);
 		private:
 
 	};
@@ -164,7 +330,8 @@ namespace VK{
 					string mobile_phone;
 					string home_phone;
 
-					static UserFull::Contacts parse(Json::Value);
+					static UserFull::Contacts parse(const Json::Value &json);
+					static void parse(const Json::Value &json, UserFull::Contacts &contacts);
 			};
 
 			/**
@@ -172,9 +339,9 @@ namespace VK{
 			*/
 			class Occupation: public Model{
 			public:
-				const string TYPE_WORK = "work";
-				const string TYPE_SCHOOL = "school";
-				const string TYPE_UNIVERSITY = "university";
+				static const string TYPE_WORK;
+				static const string TYPE_SCHOOL;
+				static const string TYPE_UNIVERSITY;
 
 				string type;
 				int id;
@@ -243,6 +410,52 @@ namespace VK{
 				const string PARENT = "parent";
 			};
 		public:
+			/**
+				A Fields class describes bits of a fields mask, one bit for each value of "fields" parameter
+			*/
+			class Fields{
+			public:
+				static const unsigned long long ONLINE = 1ULL << 0;
+				static const unsigned long long PHOTO_50 = 1ULL << 1;
+				static const unsigned long long PHOTO_100 = 1ULL << 2;
+				static const unsigned long long PHOTO_200 = 1ULL << 3;
+				static const unsigned long long PHOTO_ID = 1ULL << 4;
+				static const unsigned long long VERIFIED = 1ULL << 5;
+				static const unsigned long long BLACKLISTED = 1ULL << 6;
+				static const unsigned long long SEX = 1ULL << 7;
+				static const unsigned long long BDATE = 1ULL << 8;
+				static const unsigned long long CITY = 1ULL << 9;
+				static const unsigned long long COUNTRY = 1ULL << 10;
+				static const unsigned long long HOME_TOWN = 1ULL << 11;
+				static const unsigned long long DOMAIN = 1ULL << 12;
+				static const unsigned long long HAS_MOBILE = 1ULL << 13;
+				static const unsigned long long CONTACTS = 1ULL << 14;
+				static const unsigned long long SITE = 1ULL << 15;
+				static const unsigned long long EDUCATION = 1ULL << 16;
+				static const unsigned long long UNIVERSITIES = 1ULL << 17;
+				static const unsigned long long SCHOOLS = 1ULL << 18;
+				static const unsigned long long STATUS = 1ULL << 19;
+				static const unsigned long long LAST_SEEN = 1ULL << 20;
+				static const unsigned long long FOLLOWERS_COUNT = 1ULL << 21;
+				static const unsigned long long COMMON_COUNT = 1ULL << 22;
+				static const unsigned long long COUNTERS = 1ULL << 23;
+				static const unsigned long long ALL = ~0ULL;
+
+				/**
+					Build mask from "fields" parameter value. Unknown fields are ignored
+
+					@param fields comma separated fields, e.g. "photo_100,city"
+					@return fields mask
+				*/
+				static unsigned long long parse(const string &fields);
+
+				/**
+					@param params map of data
+					@return fields mask of Parameters::FIELDS value
+				*/
+				static unsigned long long of(const map<string, string> &params);
+			};
+
 			/**
 				A Seen class describes a user seen (Time & Platform)
 			*/
@@ -260,7 +473,8 @@ namespace VK{
 				int platform;
 
 				static string getPlatformName(int platform);
-				static UserFull::Seen parse(Json::Value);
+				static UserFull::Seen parse(const Json::Value &json);
+				static void parse(const Json::Value &json, UserFull::Seen &seen);
 			};
 
 
@@ -320,171 +534,1451 @@ namespace VK{
 				@param json Json Value Object
 				@return UserFull object
 			*/
-			static UserFull parse(Json::Value);
-	};
+			static UserFull parse(const Json::Value &json);
 
-	class Utils{
-		public:
-			static string data2str(map<string, string>);
-			static string urlencode(const string &c);
-			static string char2hex(char);
-			static int CURL_WRITER(char *data, size_t size, size_t nmemb, string *buffer);
+			/**
+				Parse user from Json Value Object into existing object.
+				Strings and vectors of the object keep their capacity
+
+				@param json Json Value Object
+				@param user UserFull object to fill
+			*/
+			static void parse(const Json::Value &json, UserFull &user);
+
+			/**
+				Parse only requested fields of user. id, first_name and last_name are always parsed,
+				members outside of the mask are left untouched
+
+				@param json Json Value Object
+				@param user UserFull object to fill
+				@param fields mask of UserFull::Fields constants
+			*/
+			static void parse(const Json::Value &json, UserFull &user, unsigned long long fields);
 	};
 
-	class Parameters: public map<string, string>{
+	/**
+		A CurlPool class keeps reusable keep-alive CURL easy handles,
+		so consecutive requests to the same host skip TCP and TLS handshakes
+	*/
+	class CurlPool{
 	public:
-		//Commons
-	    static const string USER_ID;
-	    static const string USER_IDS;
-	    static const string FIELDS;
-	    static const string SORT;
-	    static const string OFFSET;
-	    static const string COUNT;
-	    static const string OWNER_ID;
+		/**
+			A Stats class describes handles usage of the pool
+		*/
+		class Stats{
+		public:
+			unsigned long created;
+			unsigned long reused;
+			unsigned long expired;
+			size_t idle;
+			size_t busy;
+		};
 
-	    //auth
-	    static const string VERSION;
-	    static const string HTTPS;
-	    static const string LANG;
-	    static const string ACCESS_TOKEN;
-	    static const string SIG;
+		/**
+			CurlPool constructor
 
-	    //get users
-	    static const string NAME_CASE;
+			@param size Maximum number of idle handles kept in pool
+			@param idle_timeout Seconds after which an idle handle is cleaned up
+		*/
+		CurlPool(size_t size = 8, int idle_timeout = 60);
+		~CurlPool();
 
-	    //Get subscriptions
-	    static const string EXTENDED;
+		/**
+			Check out a handle. Reuses the most recently returned handle
+			or creates a new one when the pool is empty
 
-	    //Search
-	    static const string Q;
-	    static const string CITY;
-	    static const string COUNTRY;
-	    static const string HOMETOWN;
-	    static const string UNIVERSITY_COUNTRY;
-	    static const string UNIVERSITY;
-	    static const string UNIVERSITY_YEAR;
-	    static const string SEX;
-	    static const string STATUS;
-	    static const string AGE_FROM;
-	    static const string AGE_TO;
-	    static const string BIRTH_DAY;
-	    static const string BIRTH_MONTH;
-	    static const string BIRTH_YEAR;
-	    static const string ONLINE;
-	    static const string HAS_PHOTO;
-	    static const string SCHOOL_COUNTRY;
-	    static const string SCHOOL_CITY;
-	    static const string SCHOOL;
-	    static const string SCHOOL_YEAR;
-	    static const string RELIGION;
-	    static const string INTERESTS;
-	    static const string COMPANY;
-	    static const string POSITION;
-	    static const string GROUP_ID;
+			@return CURL easy handle
+		*/
+		CURL *acquire();
 
-	    static const string FRIENDS_ONLY;
-	    static const string FROM_GROUP;
-	    static const string MESSAGE;
-	    static const string ATTACHMENTS;
-	    static const string SERVICES;
-	    static const string SIGNED;
-	    static const string PUBLISH_DATE;
-	    static const string LAT;
-	    static const string LONG;
-	    static const string PLACE_ID;
-	    static const string POST_ID;
+		/**
+			Return handle to the pool. Options are reset, live connections are kept
 
-	    //Errors
-	    static const string ERROR_CODE;
-	    static const string ERROR_MSG;
-	    static const string REQUEST_PARAMS;
+			@param curl CURL easy handle from acquire()
+		*/
+		void release(CURL *curl);
 
-	    //Captcha
-	    static const string CAPTCHA_IMG;
-	    static const string CAPTCHA_SID;
-	    static const string CAPTCHA_KEY;
-	    static const string REDIRECT_URI;
+		void setSize(size_t size);
+		void setIdleTimeout(int idle_timeout);
+		Stats getStats();
 
-	    //Photos
-	    static const string PHOTO;
-	    static const string PHOTOS;
-	    static const string ALBUM_ID;
-	    static const string PHOTO_IDS;
-	    static const string PHOTO_SIZES;
-	    static const string REV;
-	    static const string FEED_TYPE;
-	    static const string FEED;
+		/**
+			Pool used by API::post when no pool is given
+		*/
+		static CurlPool &shared();
 
-	    Parameters();
-	    //Parameters(map<string, string> data);
-	    string join(string...);
-	};
-	
-	class UsersList: public Model{
-	public:
-		vector<UserFull> list;
-		UsersList(vector<VK::UserFull> users);
-		UsersList(Json::Value json);
-		
-		vector<UserFull> toVector();
-		
-		static vector<UserFull> parse(Json::Value json);
-	};
-	
-	class  Response{
-	public:
-		
+	private:
+		class Entry{
+		public:
+			CURL *curl;
+			chrono::steady_clock::time_point used;
+		};
+
+		mutex lock;
+		vector<Entry> idle;
+		size_t size;
+		chrono::seconds idle_timeout;
+		Stats stats;
+
+		void expire(chrono::steady_clock::time_point now);
+
+		CurlPool(const CurlPool&) = delete;
+		CurlPool &operator=(const CurlPool&) = delete;
 	};
-	
+
 	/**
-		@brief API class
+		A RateLimiter class is a token bucket scheduler keyed by access token.
+		Callers wait in FIFO order, higher priority callers go first
 	*/
-	class API{
+	class RateLimiter{
+	public:
+		/**
+			A Stats class describes waiting of requests for one key
+		*/
+		class Stats{
 		public:
-			static string api_url;
-			string access_token;
-			int user_id;
-			string version;
-			string lang;
-			string https;
+			unsigned long granted;
+			unsigned long delayed;
+			double total_wait_ms;
+			double max_wait_ms;
+			size_t queued;
+		};
 
-			/**
-				API constructor
+		/**
+			Lowest rate, smaller ones are raised to it. One request in 1000 seconds
+		*/
+		static const double MIN_RATE;
 
-				@param version Api version
-				@param lang Api language
-				@param https Api requests via https
-				@param access_token Access token for requests
-			*/
-			API(string version, string lang, bool https, string access_token);
+		/**
+			RateLimiter constructor
 
-			/**
-				HTTP Post request
+			@param rate Requests per second for each key, at least MIN_RATE
+			@param burst Maximum number of requests sent at once, at least 1
+		*/
+		RateLimiter(double rate = 3, double burst = 3);
 
-				@param url request url
-				@param data data string
-				@return json string
-			*/
-			static string post(string url, string data);
+		/**
+			Set own rate for a key
 
-			/**
-				HTTP Post request
+			@param key access token
+			@param rate Requests per second, at least MIN_RATE
+			@param burst Maximum number of requests sent at once, at least 1
+		*/
+		void setLimit(const string &key, double rate, double burst);
 
-				@param url method name
-				@param data map of data
-				@return json Json Value Object
-			*/
-			Json::Value call(string method, map<string, string> params);
+		/**
+			Block until a request for the key may be sent
 
-			UsersList usersGet(map<string, string> params);
-			vector<UserFull> usersSearch(map<string, string> params);
-			bool usersIsAppUser(map<string, string> params);
-			vector<UserFull> usersGetSubscriptions(map<string, string> params);
-			vector<UserFull> usersGetFollowers(map<string, string> params);
-			vector<UserFull> usersReport(int user_id, string type, map<string, string> params);
-			vector<UserFull> usersGetNearby(double latitude, double longitude, map<string, string> params);
-		
-		private:
+			@param key access token
+			@param priority callers with higher priority are served first
+		*/
+		void acquire(const string &key, int priority = 0);
+
+		/**
+			Take a request slot without blocking. Fails while blocking callers are waiting
+
+			@param key access token
+			@param queued time when the request was queued, used for wait statistics
+			@param retry time until the next slot on failure
+			@return true if request may be sent
+		*/
+		bool tryAcquire(const string &key, chrono::steady_clock::time_point queued, chrono::steady_clock::duration &retry);
+
+		/**
+			Empty the bucket after VK answered "too many requests"
+
+			@param key access token
+		*/
+		void drain(const string &key);
+
+		Stats getStats(const string &key);
+
+	private:
+		class Bucket{
+		public:
+			double rate;
+			double burst;
+			double tokens;
+			chrono::steady_clock::time_point updated;
+			map<pair<int, unsigned long>, bool> waiters;
+			unsigned long sequence;
+			Stats stats;
+		};
+
+		double rate;
+		double burst;
+		mutex lock;
+		condition_variable wake;
+		map<string, Bucket> buckets;
+
+		Bucket &bucket(const string &key);
+		void refill(Bucket &bucket, chrono::steady_clock::time_point now);
+		void record(Bucket &bucket, chrono::steady_clock::duration wait);
+	};
+
+	/**
+		A AsyncEngine class runs many HTTP requests concurrently on one
+		curl_multi event loop thread. Completion callbacks are invoked on that thread,
+		so they should be short and must not block on other async requests
+	*/
+	class AsyncEngine{
+	public:
+		/**
+			Completion callback
+
+			@param ok true when transfer succeeded
+			@param body response body or curl error text
+		*/
+		typedef function<void(bool ok, const string &body)> Callback;
+
+		/**
+			AsyncEngine constructor. Starts the event loop thread
+
+			@param pool handles pool
+			@param max_in_flight Maximum number of simultaneous transfers
+		*/
+		AsyncEngine(shared_ptr<CurlPool> pool, size_t max_in_flight = 256);
+
+		/**
+			Waits until all queued and running requests are completed
+		*/
+		~AsyncEngine();
+
+		/**
+			Queue HTTP Post request
+
+			@param url request url
+			@param data data string
+			@param callback completion callback
+		*/
+		void post(const string &url, const string &data, Callback callback);
+
+		/**
+			Queue HTTP Post request which waits for a slot of the rate limiter
+
+			@param url request url
+			@param data data string
+			@param key rate limiter key
+			@param callback completion callback
+		*/
+		void post(const string &url, const string &data, const string &key, Callback callback);
+
+		/**
+			Queue HTTP Post request which is started not earlier than after delay
+
+			@param url request url
+			@param data data string
+			@param key rate limiter key, empty when not limited
+			@param callback completion callback
+			@param delay time to wait before starting
+		*/
+		void post(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay);
+
+		/**
+			Set rate limiter consulted before starting requests with a key
+
+			@param limiter RateLimiter object or NULL
+		*/
+		void setLimiter(shared_ptr<RateLimiter> limiter);
+
+		/**
+			@return number of queued and running requests
+		*/
+		size_t pending();
+
+	private:
+		class Request{
+		public:
+			string url;
+			string data;
+			string key;
+			chrono::steady_clock::time_point queued;
+			chrono::steady_clock::time_point due;
+			Callback callback;
+			string buffer;
+			char error[CURL_ERROR_SIZE];
+		};
+
+		shared_ptr<CurlPool> pool;
+		shared_ptr<RateLimiter> limiter;
+		CURLM *multi;
+		size_t max_in_flight;
+		size_t in_flight;
+		mutex lock;
+		deque<Request*> queue;
+		bool stopping;
+		thread loop;
+
+		void run();
+		void start(Request *request);
+		void finish(CURL *curl, CURLcode result);
+
+		AsyncEngine(const AsyncEngine&) = delete;
+		AsyncEngine &operator=(const AsyncEngine&) = delete;
+	};
+
+	/**
+		A ResponseCache class is a byte size bounded LRU cache of successful
+		API responses keyed by method, normalized parameters, API settings and
+		token, with per-method TTL. It may be shared by API objects of any version
+		and language. execute is never cached, a successful reply may hold errors of its calls
+	*/
+	class ResponseCache{
+	public:
+		/**
+			A Stats class describes cache usage
+		*/
+		class Stats{
+		public:
+			unsigned long long hits;
+			unsigned long long misses;
+			unsigned long long evictions;
+			size_t entries;
+			size_t bytes;
+		};
+
+		/**
+			ResponseCache constructor
+
+			@param max_bytes Maximum estimated size of cached responses
+			@param ttl Seconds a response is kept for methods without own TTL
+		*/
+		ResponseCache(size_t max_bytes = 64 * 1024 * 1024, int ttl = 60);
+
+		/**
+			Set TTL of a method
+
+			@param method method name
+			@param ttl seconds, 0 disables caching of the method
+		*/
+		void setTTL(const string &method, int ttl);
+
+		/**
+			Exclude access token from keys, so users of different tokens share responses
+
+			@param ignore true to exclude token
+		*/
+		void ignoreToken(bool ignore);
+
+		/**
+			Find fresh response
+
+			@param method method name
+			@param params map of data
+			@param scope API settings of request, see API::cacheScope
+			@param token access token used for request
+			@param resp found response
+			@return true on hit
+		*/
+		bool get(const string &method, const map<string, string> &params, const string &scope, const string &token, Json::Value &resp);
+
+		/**
+			Store successful response
+		*/
+		void put(const string &method, const map<string, string> &params, const string &scope, const string &token, const Json::Value &resp);
+
+		/**
+			Drop all responses of a method
+		*/
+		void invalidate(const string &method);
+
+		/**
+			Drop response of a call
+		*/
+		void invalidate(const string &method, const map<string, string> &params, const string &scope, const string &token);
+
+		void clear();
+		Stats getStats();
+
+	private:
+		class Entry{
+		public:
+			string key;
+			string method;
+			Json::Value value;
+			chrono::steady_clock::time_point expires;
+			size_t bytes;
+		};
+
+		mutex lock;
+		list<Entry> entries;
+		unordered_map<string, list<Entry>::iterator> index;
+		map<string, int> ttls;
+		size_t max_bytes;
+		int ttl;
+		bool ignore_token;
+		Stats stats;
+
+		string key(const string &method, const map<string, string> &params, const string &scope, const string &token);
+		int ttlOf(const string &method);
+		void erase(list<Entry>::iterator it);
+		static size_t bytesOf(const Json::Value &value);
+	};
+
+	/**
+		A RetryPolicy class decides which failed requests are sent again and
+		after what delay. Delay grows exponentially from base to cap and is
+		drawn uniformly below the grown value, so clients throttled at the same
+		moment do not come back at the same moment. Retriable by default are
+		transport and malformed response errors (-1), 1 (unknown error),
+		6 (too many requests per second) and 10 (internal server error).
+		Transport errors are retried only for idempotent methods, a write may
+		have been done before the connection broke
+	*/
+	class RetryPolicy{
+	public:
+		/**
+			RetryPolicy constructor
+
+			@param max_retries Maximum number of retries of one call
+			@param base_ms Delay cap of the first retry
+			@param max_ms Maximum delay cap
+			@param budget_ms Maximum time one call spends waiting for retries, 0 for no limit
+		*/
+		RetryPolicy(int max_retries = 3, int base_ms = 100, int max_ms = 5000, int budget_ms = 30000);
+
+		/**
+			Set whether requests failed with error code are retried
+
+			@param error_code VK error code, -1 for transport errors
+			@param retriable true to retry
+		*/
+		void setRetriable(int error_code, bool retriable);
+		bool isRetriable(int error_code);
+
+		/**
+			Set whether method may be sent again after a transport error
+
+			@param method method name
+			@param idempotent true if repeating method has no side effects
+		*/
+		void setIdempotent(const string &method, bool idempotent);
+
+		/**
+			@param method method name
+			@return true if method was set idempotent or is named as a read: get, search, is or check with a following word
+		*/
+		bool isIdempotent(const string &method);
+
+		/**
+			Decide whether failed request is sent again
+
+			@param method method name
+			@param error_code VK error code, -1 for transport errors, 0 on success
+			@param retries retries already made
+			@param waited time already spent waiting for retries
+			@param delay time to wait before retry
+			@return true if request should be sent again
+		*/
+		bool next(const string &method, int error_code, int retries, chrono::milliseconds waited, chrono::milliseconds &delay);
+
+		/**
+			Seed jitter, so delays repeat from run to run
+
+			@param value seed
+		*/
+		void seed(unsigned value);
+
+	private:
+		int max_retries;
+		int base_ms;
+		int max_ms;
+		int budget_ms;
+		unordered_set<int> codes;
+		map<string, bool> idempotent_methods;
+		minstd_rand random;
+		mutex lock;
+
+		RetryPolicy(const RetryPolicy&) = delete;
+		RetryPolicy &operator=(const RetryPolicy&) = delete;
+	};
+
+	class API;
+	class Params;
+	class Transport;
+	class Metrics;
+	class JsonStream;
+	class UsersStream;
+
+	/**
+		A ExecuteBatcher class packs calls issued within a short window into
+		a single "execute" request (up to 25 calls) and demultiplexes the results.
+		A failed call returns false inside execute, so only methods which never
+		return false themselves are batched, see batchable()
+	*/
+	class ExecuteBatcher{
+	public:
+		/**
+			Maximum number of API calls VK allows in one execute request
+		*/
+		static const size_t MAX_CALLS = 25;
+
+		/**
+			ExecuteBatcher constructor
+
+			@param api API object used to send execute requests. Must outlive the batcher
+			@param window_ms Milliseconds to wait for more calls before sending, 0 sends only on flush() or when batch is full
+			@param max_calls Maximum number of calls in one execute request
+		*/
+		ExecuteBatcher(API *api, int window_ms = 10, size_t max_calls = MAX_CALLS);
+
+		/**
+			Sends pending calls and stops the window timer
+		*/
+		~ExecuteBatcher();
+
+		/**
+			Add call to the current batch
+
+			@param method method name
+			@param params map of data
+			@return future of json Json Value Object in the same form as API::call returns
+		*/
+		future<Json::Value> add(string method, map<string, string> params);
+
+		/**
+			Send current batch now
+		*/
+		void flush();
+
+		/**
+			Build VKScript code for calls
+
+			@param calls list of method name and params pairs
+			@return code string
+		*/
+		static string script(const vector<pair<string, map<string, string> > > &calls);
+
+		/**
+			Check if method can be sent inside execute. Checks (is*, check*) return
+			a boolean and their false result can not be told from a failed call
+
+			@param method method name
+			@return true if method response is never false
+		*/
+		static bool batchable(const string &method);
+
+		/**
+			Split execute response into results of its calls. Every failed call returns
+			false and has an entry in execute_errors, in the order calls were made,
+			so the n-th false result gets the n-th error
+
+			@param calls number of calls in execute request
+			@param resp execute response in the form API::call returns
+			@return results in the form API::call returns
+		*/
+		static vector<Json::Value> results(size_t calls, const Json::Value &resp);
+
+	private:
+		class Call{
+		public:
+			string method;
+			map<string, string> params;
+			shared_ptr<promise<Json::Value> > result;
+		};
+
+		API *api;
+		chrono::milliseconds window;
+		size_t max_calls;
+		mutex lock;
+		condition_variable wake;
+		vector<Call> batch;
+		chrono::steady_clock::time_point deadline;
+		bool stopping;
+		thread timer;
+
+		void run();
+		void send(vector<Call> calls);
+
+		ExecuteBatcher(const ExecuteBatcher&) = delete;
+		ExecuteBatcher &operator=(const ExecuteBatcher&) = delete;
+	};
+
+	/**
+		A UsersPager class iterates over all users of a paginated method
+		(users.search, users.getFollowers, users.getSubscriptions). While the
+		caller reads one page, the following pages are already being fetched.
+		At most prefetch pages are requested or buffered besides the page being read
+
+			VK::UsersPager pager = api.usersSearchPages(params, 2);
+			for(const VK::UserFull &user : pager){ ... }
+	*/
+	class UsersPager{
+	public:
+		/**
+			users.search returns no more than 1000 users for any query
+		*/
+		static const size_t SEARCH_LIMIT = 1000;
+
+		/**
+			A iterator class walks users of all pages, loading pages on demand
+		*/
+		class iterator{
+		public:
+			iterator(UsersPager *pager = NULL);
+
+			const UserFull &operator*() const;
+			const UserFull *operator->() const;
+			iterator &operator++();
+			bool operator==(const iterator &other) const;
+			bool operator!=(const iterator &other) const;
+
+		private:
+			UsersPager *pager;
+		};
+
+		/**
+			UsersPager constructor. Sends request for the first page
+
+			@param api API object used to send requests. Must outlive the pager
+			@param method method name
+			@param params map of data, "offset" and "count" give first offset and page size
+			@param prefetch number of pages fetched ahead of the page being read
+			@param limit maximum number of users, 0 for all
+		*/
+		UsersPager(API *api, string method, map<string, string> params, size_t prefetch = 1, size_t limit = 0);
+
+		/**
+			Wait for next page and start fetching the pages after it
+
+			@param page vector to fill with users of the page
+			@return false when all users are read or request failed
+		*/
+		bool next(vector<UserFull> &page);
+
+		/**
+			@return iterator over users not read by next() yet
+		*/
+		iterator begin();
+		iterator end();
+
+		/**
+			@return number of users reported by API, -1 before the first page
+		*/
+		long long total();
+
+		/**
+			@return error code of failed request, 0 if none
+		*/
+		int errorCode();
+		string errorMessage();
+
+	private:
+		API *api;
+		string method;
+		map<string, string> params;
+		unsigned long long fields;
+		size_t page_size;
+		size_t prefetch;
+		size_t start;
+		size_t stop;
+		size_t offset;
+		long long count;
+		deque<future<Json::Value> > pending;
+		vector<UserFull> page;
+		size_t position;
+		int error_code;
+		string error_msg;
+
+		void fill(size_t window);
+		void request();
+		bool advance();
+	};
+
+	class Utils{
+		public:
+			static string data2str(const map<string, string> &data);
+
+			/**
+				Append params to request body
+
+				@param data map of data
+				@param out buffer to append to
+			*/
+			static void data2str(const map<string, string> &data, string &out);
+			static string urlencode(const string &c);
+
+			/**
+				Append URL encoded characters to buffer. Bytes are classified by a table,
+				runs of letters and digits are found 16 bytes at a time when SSE2 is available
+
+				@param c characters
+				@param size number of characters
+				@param out buffer to append to
+			*/
+			static void urlencode(const char *c, size_t size, string &out);
+			static string char2hex(char);
+			static int CURL_WRITER(char *data, size_t size, size_t nmemb, string *buffer);
+
+			/**
+				CURL write callback which feeds received bytes into a streaming parser
+			*/
+			static size_t CURL_STREAM_WRITER(char *data, size_t size, size_t nmemb, JsonStream *stream);
+	};
+
+	class Parameters: public map<string, string>{
+	public:
+		//Commons
+	    static const string USER_ID;
+	    static const string USER_IDS;
+	    static const string FIELDS;
+	    static const string SORT;
+	    static const string OFFSET;
+	    static const string COUNT;
+	    static const string OWNER_ID;
+
+	    //auth
+	    static const string VERSION;
+	    static const string HTTPS;
+	    static const string LANG;
+	    static const string ACCESS_TOKEN;
+	    static const string SIG;
+
+	    //get users
+	    static const string NAME_CASE;
+
+	    //Get subscriptions
+	    static const string EXTENDED;
+
+	    //Search
+	    static const string Q;
+	    static const string CITY;
+	    static const string COUNTRY;
+	    static const string HOMETOWN;
+	    static const string UNIVERSITY_COUNTRY;
+	    static const string UNIVERSITY;
+	    static const string UNIVERSITY_YEAR;
+	    static const string SEX;
+	    static const string STATUS;
+	    static const string AGE_FROM;
+	    static const string AGE_TO;
+	    static const string BIRTH_DAY;
+	    static const string BIRTH_MONTH;
+	    static const string BIRTH_YEAR;
+	    static const string ONLINE;
+	    static const string HAS_PHOTO;
+	    static const string SCHOOL_COUNTRY;
+	    static const string SCHOOL_CITY;
+	    static const string SCHOOL;
+	    static const string SCHOOL_YEAR;
+	    static const string RELIGION;
+	    static const string INTERESTS;
+	    static const string COMPANY;
+	    static const string POSITION;
+	    static const string GROUP_ID;
+
+	    static const string FRIENDS_ONLY;
+	    static const string FROM_GROUP;
+	    static const string MESSAGE;
+	    static const string ATTACHMENTS;
+	    static const string SERVICES;
+	    static const string SIGNED;
+	    static const string PUBLISH_DATE;
+	    static const string LAT;
+	    static const string LONG;
+	    static const string PLACE_ID;
+	    static const string POST_ID;
+
+	    //Errors
+	    static const string ERROR_CODE;
+	    static const string ERROR_MSG;
+	    static const string REQUEST_PARAMS;
+
+	    //Captcha
+	    static const string CAPTCHA_IMG;
+	    static const string CAPTCHA_SID;
+	    static const string CAPTCHA_KEY;
+	    static const string REDIRECT_URI;
+
+	    //Photos
+	    static const string PHOTO;
+	    static const string PHOTOS;
+	    static const string ALBUM_ID;
+	    static const string PHOTO_IDS;
+	    static const string PHOTO_SIZES;
+	    static const string REV;
+	    static const string FEED_TYPE;
+	    static const string FEED;
+
+	    Parameters();
+	    //Parameters(map<string, string> data);
+
+	    /**
+	    	Join values with separator, as list parameters are sent
+
+	    	@param values list of values
+	    	@param separator values separator
+	    	@return joined string
+	    */
+	    static string join(const vector<string> &values, char separator = ',');
+	    static string join(const vector<int> &values, char separator = ',');
+
+	    /**
+	    	Join strings and numbers with commas: join(1, 5, "durov")
+
+	    	@return joined string
+	    */
+	    template<typename... Values> static string join(const Values&... values){
+	    	string joined;
+	    	bool first = true;
+	    	int expand[] = {0, (append(joined, first, values), 0)...};
+	    	(void)expand;
+	    	return joined;
+	    }
+
+	private:
+	    static void append(string &joined, bool &first, const string &value);
+	    static void append(string &joined, bool &first, const char *value);
+	    static void append(string &joined, bool &first, char value);
+
+	    /**
+	    	Numbers of any integral type, overloads for some types would make others ambiguous.
+	    	A char is a character, not its code
+	    */
+	    template<typename T> static typename enable_if<is_integral<T>::value && !is_same<T, char>::value>::type append(string &joined, bool &first, T value){
+	    	append(joined, first, to_string(value));
+	    }
+	};
+	
+	class UsersList: public Model{
+	public:
+		vector<UserFull> list;
+		UsersList(vector<VK::UserFull> users);
+		UsersList(const Json::Value &json);
+		
+		vector<UserFull> toVector();
+
+		/**
+			Move users out without copying, the list is left empty
+		*/
+		vector<UserFull> take();
+		
+		static vector<UserFull> parse(const Json::Value &json);
+
+		/**
+			Parse users from Json array and append them to vector.
+			Plain ids give users with only id set, items of other types than "profile" are skipped
+
+			@param json Json Value Object
+			@param users vector to append users to
+			@param fields mask of UserFull::Fields constants to parse
+		*/
+		static void parse(const Json::Value &json, vector<UserFull> &users, unsigned long long fields = UserFull::Fields::ALL);
+	};
+
+	/**
+		A BulkUsers class is the result of API::usersGetBulk. User i belongs
+		to requested id i, users of ids VK did not return and of failed chunks have id 0
+	*/
+	class BulkUsers{
+	public:
+		/**
+			A Failure class describes a chunk of ids which was not received
+		*/
+		class Failure{
+		public:
+			size_t offset;
+			size_t count;
+			int error_code;
+			string error_msg;
+		};
+
+		vector<UserFull> users;
+		vector<Failure> failures;
+
+		/**
+			Number of users received
+		*/
+		size_t found;
+	};
+	
+	class  Response{
+	public:
+		
+	};
+	
+	/**
+		A WorkerPool class runs submitted jobs on a fixed number of threads
+	*/
+	class WorkerPool{
+	public:
+		/**
+			WorkerPool constructor. Starts threads
+
+			@param threads number of threads
+		*/
+		WorkerPool(size_t threads);
+
+		/**
+			Waits until all submitted jobs are done and stops threads
+		*/
+		~WorkerPool();
+
+		/**
+			Queue job
+
+			@param job function to run on a worker thread
+		*/
+		void submit(function<void()> job);
+
+		size_t size();
+
+	private:
+		mutex lock;
+		condition_variable wake;
+		deque<function<void()> > jobs;
+		vector<thread> threads;
+		bool stopping;
+
+		void run();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool &operator=(const WorkerPool&) = delete;
+	};
+
+	/**
+		A Timing class describes where the time of one request went.
+		Times are milliseconds since the request was started
+	*/
+	class Timing{
+	public:
+		double connect;
+
+		/**
+			TLS handshake finished, 0 for plain http and reused connections
+		*/
+		double tls;
+		double first_byte;
+		double transfer;
+
+		/**
+			Response parsed. Parsing that overlapped the transfer is inside transfer,
+			total - transfer is the parsing left after the last byte
+		*/
+		double total;
+
+		/**
+			Response bytes on the wire, compressed if server used gzip
+		*/
+		size_t downloaded;
+
+		/**
+			Response bytes after decompression
+		*/
+		size_t received;
+	};
+
+	/**
+		@brief API class
+
+		call(), post() and the users methods are safe to call from many threads on
+		one API object: every request has its own buffers and the shared pool,
+		limiter and engine are synchronized. Configuration members and setters
+		(setRateLimit, setWorkers, enableBatching, ...) must not race with calls.
+
+		Worker mode: setWorkers(n) starts n threads and dispatch() runs blocking
+		calls on them, so one API object spreads work across cores:
+
+			api.setWorkers(8);
+			future<Json::Value> resp = api.dispatch("users.get", params);
+	*/
+	class API{
+		public:
+			static string api_url;
+
+			/**
+				Maximum number of ids in one users.get request
+			*/
+			static const size_t USERS_GET_LIMIT = 1000;
+
+			string access_token;
+			int user_id;
+			string version;
+			string lang;
+			string https;
+
+			/**
+				Pool of keep-alive handles used by call(). May be shared between API objects
+			*/
+			shared_ptr<CurlPool> pool;
+
+			/**
+				Rate limiter keyed by access token. Disabled when NULL, may be shared between API objects
+			*/
+			shared_ptr<RateLimiter> limiter;
+
+			/**
+				Cache of responses used by call() and callAsync(). Disabled when NULL
+			*/
+			shared_ptr<ResponseCache> cache;
+
+			/**
+				Transport of call(), callAsync() and streamed methods. Requests go
+				through libcurl on pool when NULL
+			*/
+			shared_ptr<Transport> transport;
+
+			/**
+				Per-method request metrics, nothing is measured when NULL. May be shared between API objects
+			*/
+			shared_ptr<Metrics> metrics;
+
+			/**
+				Policy of retrying failed call(), callAsync() and streamed requests. Failures are final when NULL
+			*/
+			shared_ptr<RetryPolicy> retry;
+
+			/**
+				API constructor
+
+				@param version Api version
+				@param lang Api language
+				@param https Api requests via https
+				@param access_token Access token for requests
+			*/
+			API(string version, string lang, bool https, string access_token);
+
+			/**
+				HTTP Post request
+
+				@param url request url
+				@param data data string
+				@return json string
+			*/
+			static string post(string url, string data);
+
+			/**
+				HTTP Post request on a handle checked out from pool
+
+				@param url request url
+				@param data data string
+				@param pool handles pool
+				@return json string
+			*/
+			static string post(string url, string data, CurlPool &pool);
+
+			/**
+				HTTP Post request which parses response while it is received
+
+				@param url request url
+				@param data data string
+				@param pool handles pool
+				@param stream parser fed with response bytes
+				@param error curl error text on failure
+				@param timing filled with request timing when not NULL
+				@return true if transfer succeeded and response is a complete JSON document
+			*/
+			static bool post(string url, string data, CurlPool &pool, JsonStream &stream, string &error, Timing *timing = NULL);
+
+			/**
+				Limit rate of requests per access token
+
+				@param rate Requests per second
+				@param burst Maximum number of requests sent at once
+			*/
+			void setRateLimit(double rate, double burst);
+
+			/**
+				Send requests through transport, e.g. ReplayTransport in tests
+
+				@param transport Transport object or NULL for libcurl
+			*/
+			void setTransport(shared_ptr<Transport> transport);
+
+			/**
+				Enable response cache
+
+				@param max_bytes Maximum estimated size of cached responses
+				@param ttl Seconds a response is kept for methods without own TTL
+			*/
+			void enableCache(size_t max_bytes = 64 * 1024 * 1024, int ttl = 60);
+
+			/**
+				Record count, bytes, error codes and phase latencies of requests in metrics
+			*/
+			void enableMetrics();
+
+			/**
+				Retry failed requests with jittered exponential backoff. Responses
+				of retried calls have "retries" field with the number of retries
+
+				@param max_retries Maximum number of retries of one call
+				@param base_ms Delay cap of the first retry
+				@param max_ms Maximum delay cap
+				@param budget_ms Maximum time one call spends waiting for retries, 0 for no limit
+			*/
+			void setRetryPolicy(int max_retries = 3, int base_ms = 100, int max_ms = 5000, int budget_ms = 30000);
+
+			/**
+				Start worker threads used by dispatch()
+
+				@param threads number of threads, 0 stops workers
+			*/
+			void setWorkers(size_t threads);
+
+			/**
+				Run blocking call() on a worker thread. Runs on the calling thread
+				when workers are not started
+
+				@param method method name
+				@param params map of data
+				@param priority rate limiter priority, higher is served first
+				@return future of json Json Value Object
+			*/
+			future<Json::Value> dispatch(string method, map<string, string> params, int priority = 0);
+
+			/**
+				Event loop used by async calls. Started on first use
+
+				@return AsyncEngine object
+			*/
+			AsyncEngine &async();
+
+			/**
+				HTTP Post request
+
+				@param url method name
+				@param data map of data
+				@param priority rate limiter priority, higher is served first
+				@return json Json Value Object
+			*/
+			Json::Value call(string method, const map<string, string> &params, int priority = 0);
+
+			/**
+				HTTP Post request with typed parameters. Calls with response cache
+				enabled are sent with params converted to map
+
+				@param method method name
+				@param params Params object
+				@param priority rate limiter priority, higher is served first
+				@return json Json Value Object
+			*/
+			Json::Value call(string method, const Params &params, int priority = 0);
+
+			/**
+				Asynchronous API call
+
+				@param method method name
+				@param params map of data
+				@return future of json Json Value Object
+			*/
+			future<Json::Value> callAsync(string method, map<string, string> params);
+
+			/**
+				Asynchronous API call with completion callback.
+				Callback is invoked on the event loop thread, or on the calling thread on a cache hit
+
+				@param method method name
+				@param params map of data
+				@param callback completion callback
+			*/
+			void callAsync(string method, map<string, string> params, function<void(Json::Value)> callback);
+
+			/**
+				@return version, language and https setting of requests, responses
+				of API objects with other settings are kept apart in the cache
+			*/
+			string cacheScope();
+
+			/**
+				Enable packing of callBatched() calls into execute requests
+
+				@param window_ms Milliseconds to collect calls, 0 collects until flushBatch()
+				@param max_calls Maximum number of calls in one execute request
+			*/
+			void enableBatching(int window_ms = 10, size_t max_calls = ExecuteBatcher::MAX_CALLS);
+
+			/**
+				Send pending batched calls and disable batching
+			*/
+			void disableBatching();
+
+			/**
+				API call which is sent inside an execute request when batching is enabled.
+				Calls with their own access_token, v, lang or https and methods which may
+				return false are sent directly
+
+				@param method method name
+				@param params map of data
+				@return future of json Json Value Object
+			*/
+			future<Json::Value> callBatched(string method, map<string, string> params);
+
+			/**
+				Send pending batched calls now
+			*/
+			void flushBatch();
+
+			UsersList usersGet(map<string, string> params);
+
+			/**
+				users.get of any number of ids. Ids are sent in chunks, up to
+				parallel chunks are in flight at once
+
+				@param ids user ids
+				@param params map of data without user_ids
+				@param parallel maximum number of chunks in flight
+				@param chunk ids in one request, at most USERS_GET_LIMIT
+				@return BulkUsers object with users in order of ids
+			*/
+			BulkUsers usersGetBulk(const vector<int> &ids, map<string, string> params, size_t parallel = 8, size_t chunk = USERS_GET_LIMIT);
+			vector<UserFull> usersSearch(map<string, string> params);
+			bool usersIsAppUser(map<string, string> params);
+			vector<UserFull> usersGetSubscriptions(map<string, string> params);
+			vector<UserFull> usersGetFollowers(map<string, string> params);
+			vector<UserFull> usersReport(int user_id, string type, map<string, string> params);
+			vector<UserFull> usersGetNearby(double latitude, double longitude, map<string, string> params);
+
+			/**
+				All users found by users.search, pages are fetched ahead of reading
+
+				@param params map of data
+				@param prefetch number of pages fetched ahead
+				@param limit maximum number of users, 0 for all
+				@return UsersPager object
+			*/
+			UsersPager usersSearchPages(map<string, string> params, size_t prefetch = 1, size_t limit = 0);
+			UsersPager usersGetFollowersPages(map<string, string> params, size_t prefetch = 1, size_t limit = 0);
+
+			/**
+				Profiles the user is subscribed to, communities are skipped
+
+				@param params map of data
+				@param prefetch number of pages fetched ahead
+				@param limit maximum number of subscriptions, 0 for all
+				@return UsersPager object
+			*/
+			UsersPager usersGetSubscriptionsPages(map<string, string> params, size_t prefetch = 1, size_t limit = 0);
+
+			/**
+				users.get parsed straight from received bytes into UserFull objects,
+				without building a Json Value tree
+
+				@param params map of data
+				@return UsersList object
+			*/
+			UsersList usersGetStream(map<string, string> params);
+
+			/**
+				users.search parsed straight from received bytes into UserFull objects
+
+				@param params map of data
+				@return vector of UserFull objects
+			*/
+			vector<UserFull> usersSearchStream(map<string, string> params);
+
+			/**
+				users.get with every user handed to callback as soon as it is parsed,
+				while later users are still being received
+
+				@param params map of data
+				@param callback called on the calling thread for every user
+				@param timing filled with request timing when not NULL
+				@return false on transfer or API error
+			*/
+			bool usersGetStream(map<string, string> params, function<void(UserFull&)> callback, Timing *timing = NULL);
+
+			/**
+				users.search with every user handed to callback as soon as it is parsed
+
+				@param params map of data
+				@param callback called on the calling thread for every user
+				@param timing filled with request timing when not NULL
+				@return false on transfer or API error
+			*/
+			bool usersSearchStream(map<string, string> params, function<void(UserFull&)> callback, Timing *timing = NULL);
+
+			future<UsersList> usersGetAsync(map<string, string> params);
+			future<vector<UserFull> > usersSearchAsync(map<string, string> params);
+			future<bool> usersIsAppUserAsync(map<string, string> params);
+		
+		private:
+			shared_ptr<AsyncEngine> engine;
+
+			/**
+				Guards creation of engine. Shared with copies, so API objects stay copyable
+			*/
+			shared_ptr<mutex> engine_lock;
+			shared_ptr<ExecuteBatcher> batcher;
+			shared_ptr<WorkerPool> workers;
+
+			/**
+				A Prepared class is a "name=value&" part of request body encoded once
+			*/
+			class Prepared{
+			public:
+				string value;
+				string encoded;
+			};
+
+			/**
+				Version, language, https and token parts, in the order of PREPARED_NAMES
+			*/
+			Prepared prepared[4];
+			static const char *const PREPARED_NAMES[4];
+
+			/**
+				Encode version, language, https and token parts of request body
+			*/
+			void prepare();
+
+			/**
+				Build request body: params with version, language and token
+
+				@param params map of data
+				@return data string
+			*/
+			string requestData(const map<string, string> &params);
+			string requestData(const Params &params);
+
+			/**
+				Append prepared parts of request body
+
+				@param body request body
+				@param given bit i is set when caller gave parameter PREPARED_NAMES[i]
+			*/
+			void appendPrepared(string &body, unsigned given);
+
+			/**
+				@param params map of data
+				@return access token used for request
+			*/
+			string tokenOf(const map<string, string> &params);
+
+			/**
+				Tell rate limiter about "too many requests" error
+
+				@param token access token
+				@param resp json Json Value Object
+			*/
+			void throttled(const string &token, const Json::Value &resp);
+
+			/**
+				A AsyncCall class is a callAsync() request kept across its retries
+			*/
+			class AsyncCall{
+			public:
+				string method;
+				string url;
+				string data;
+				string token;
+				string scope;
+				map<string, string> params;
+				function<void(Json::Value)> callback;
+				shared_ptr<RateLimiter> limiter;
+				shared_ptr<ResponseCache> cache;
+				shared_ptr<Metrics> metrics;
+				shared_ptr<RetryPolicy> retry;
+				weak_ptr<Transport> transport;
+				weak_ptr<AsyncEngine> engine;
+				int retries;
+				chrono::milliseconds waited;
+				chrono::steady_clock::time_point start;
+			};
+
+			/**
+				Send request of call, retrying it while retry policy allows
+
+				@param method method name
+				@param token access token of request
+				@param data data string
+				@param priority rate limiter priority
+				@param retries number of retries made
+				@return json Json Value Object
+			*/
+			Json::Value send(const string &method, const string &token, const string &data, int priority, int &retries);
+
+			/**
+				Wait for rate limiter, send request once and parse response. Request is added to metrics
+
+				@param method method name
+				@param token access token of request
+				@param data data string
+				@param priority rate limiter priority
+				@param retried true if this is a retry
+				@return json Json Value Object
+			*/
+			Json::Value attempt(const string &method, const string &token, const string &data, int priority, bool retried);
+
+			/**
+				Queue request of async call through its transport or event loop
+
+				@param call call state
+				@param delay time to wait before sending
+			*/
+			static void sendAsync(shared_ptr<AsyncCall> call, chrono::milliseconds delay);
+
+			/**
+				Handle response of async call: retry it or hand result to callback
+			*/
+			static void complete(shared_ptr<AsyncCall> call, bool ok, const string &body);
+
+			/**
+				Move users of a users.get chunk to positions of their ids
+
+				@param ids requested ids
+				@param offset first id of chunk
+				@param count ids in chunk
+				@param list received users
+				@param users output with a place for every id
+				@return number of users received
+			*/
+			static size_t match(const vector<int> &ids, size_t offset, size_t count, vector<UserFull> &list, vector<UserFull> &users);
+
+			/**
+				@param resp parsed response
+				@return VK error code, -1 for transport and malformed response errors, 0 on success
+			*/
+			static int errorCode(const Json::Value &resp);
+
+			/**
+				@param message transport error text
+				@return failed response with error code -1
+			*/
+			static Json::Value transportError(const string &message);
+
+			/**
+				HTTP Post request through transport, or on pool when transport is not set
+
+				@param url request url
+				@param data data string
+				@param resp response body, or error text on failure
+				@param timing filled with request timing when not NULL
+				@return true if transfer succeeded
+			*/
+			bool request(const string &url, const string &data, string &resp, Timing *timing = NULL);
+
+			/**
+				HTTP Post request through transport which parses response while it is received
+
+				@param url request url
+				@param data data string
+				@param stream parser fed with response bytes
+				@param error error text on failure
+				@param timing filled with request timing when not NULL
+				@return true if transfer succeeded and response is a complete JSON document
+			*/
+			bool request(const string &url, const string &data, JsonStream &stream, string &error, Timing *timing = NULL);
+
+			/**
+				Send request and parse users from response while it is received.
+				Only fields named by "fields" parameter are read from users
+
+				@param method method name
+				@param params map of data
+				@param callback users receiver, NULL keeps users in parser
+				@param timing filled with request timing when not NULL
+				@return users parser with parsed users and error
+			*/
+			shared_ptr<UsersStream> streamUsers(string method, map<string, string> params, function<void(UserFull&)> callback = nullptr, Timing *timing = NULL);
+
+			/**
+				Parse response body and mark it with "success" field
+
+				@param resp response body
+				@return json Json Value Object
+			*/
+			static Json::Value parseResponse(const string &resp);
 
 	};
 }
@@ -0,0 +1,205 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "vkmetrics.h"
+
+using namespace std;
+
+const char *const VK::Metrics::PHASE_NAMES[VK::Metrics::PHASES] = {"queue", "connect", "tls", "wait", "transfer", "parse", "total"};
+const double VK::Metrics::BOUNDS[VK::Metrics::BUCKETS] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+// HISTOGRAM
+VK::Metrics::Histogram::Histogram(){
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	sum = 0;
+}
+
+void VK::Metrics::Histogram::observe(double ms){
+	double seconds = ms / 1000;
+	int bucket = upper_bound(BOUNDS, BOUNDS + BUCKETS, seconds) - BOUNDS;
+	// Values equal to a bound belong to its bucket ("le")
+	if(bucket > 0 && BOUNDS[bucket - 1] == seconds) bucket--;
+	buckets[bucket]++;
+	count++;
+	sum += ms;
+}
+
+double VK::Metrics::Histogram::quantile(double q) const{
+	if(!count) return 0;
+	double rank = q * count;
+	uint64_t seen = 0;
+	for(int i = 0; i <= BUCKETS; i++){
+		if(!buckets[i] || seen + buckets[i] < rank){
+			seen += buckets[i];
+			continue;
+		}
+		double lower = i > 0 ? BOUNDS[i - 1] : 0;
+		// Unbounded bucket has no width, its lower bound is the best guess
+		if(i == BUCKETS) return lower * 1000;
+		double upper = BOUNDS[i];
+		return (lower + (upper - lower) * (rank - seen) / buckets[i]) * 1000;
+	}
+	return BOUNDS[BUCKETS - 1] * 1000;
+}
+
+// SAMPLE
+VK::Metrics::Sample::Sample(){
+	memset(phases, 0, sizeof(phases));
+	request_bytes = 0;
+	response_bytes = 0;
+	error_code = 0;
+	timed = false;
+	queued = false;
+	retry = false;
+}
+
+void VK::Metrics::Sample::fill(const VK::Timing &timing){
+	// Curl times are counted from request start, phases are differences
+	double ready = max(timing.connect, timing.tls);
+	phases[CONNECT] = timing.connect;
+	phases[TLS] = timing.tls > timing.connect ? timing.tls - timing.connect : 0;
+	phases[WAIT] = max(0.0, timing.first_byte - ready);
+	phases[TRANSFER] = max(0.0, timing.transfer - max(timing.first_byte, ready));
+	response_bytes = timing.downloaded;
+	timed = true;
+}
+
+// STATS
+VK::Metrics::Stats::Stats(){
+	requests = 0;
+	failures = 0;
+	retries = 0;
+	request_bytes = 0;
+	response_bytes = 0;
+}
+
+// METRICS
+VK::Metrics::Metrics(){
+}
+
+shared_ptr<VK::Metrics::Entry> VK::Metrics::entry(const string &method){
+	lock_guard<mutex> guard(lock);
+	shared_ptr<VK::Metrics::Entry> &entry = entries[method];
+	if(!entry) entry = make_shared<VK::Metrics::Entry>();
+	return entry;
+}
+
+void VK::Metrics::record(const string &method, const VK::Metrics::Sample &sample){
+	shared_ptr<VK::Metrics::Entry> entry = VK::Metrics::entry(method);
+	lock_guard<mutex> guard(entry->lock);
+	VK::Metrics::Stats &stats = entry->stats;
+	stats.requests++;
+	if(sample.retry) stats.retries++;
+	stats.request_bytes += sample.request_bytes;
+	stats.response_bytes += sample.response_bytes;
+	if(sample.error_code){
+		stats.failures++;
+		stats.errors[sample.error_code]++;
+	}
+	for(int phase = 0; phase < PHASES; phase++){
+		if(phase == QUEUE && !sample.queued) continue;
+		if(!sample.timed && phase != QUEUE && phase != PARSE && phase != TOTAL) continue;
+		stats.phases[phase].observe(sample.phases[phase]);
+	}
+}
+
+map<string, VK::Metrics::Stats> VK::Metrics::getStats(){
+	vector<pair<string, shared_ptr<VK::Metrics::Entry> > > list;
+	{
+		lock_guard<mutex> guard(lock);
+		list.assign(entries.begin(), entries.end());
+	}
+	map<string, VK::Metrics::Stats> stats;
+	for(size_t i = 0; i < list.size(); i++){
+		lock_guard<mutex> guard(list[i].second->lock);
+		stats[list[i].first] = list[i].second->stats;
+	}
+	return stats;
+}
+
+void VK::Metrics::reset(){
+	lock_guard<mutex> guard(lock);
+	entries.clear();
+}
+
+/**
+	Escape label value of Prometheus text format
+*/
+static string label(const string &value){
+	string escaped;
+	for(size_t i = 0; i < value.size(); i++){
+		if(value[i] == '\\' || value[i] == '"') escaped += '\\';
+		if(value[i] == '\n') escaped += "\\n";
+		else escaped += value[i];
+	}
+	return escaped;
+}
+
+/**
+	Append "# HELP" and "# TYPE" lines
+*/
+static void header(string &out, const string &name, const char *type, const char *help){
+	out += "# HELP " + name + " " + help + "\n";
+	out += "# TYPE " + name + " " + type + "\n";
+}
+
+string VK::Metrics::prometheus(const string &prefix){
+	map<string, VK::Metrics::Stats> stats = getStats();
+	map<string, VK::Metrics::Stats>::iterator it;
+	char number[64];
+	string out;
+
+	header(out, prefix + "_requests_total", "counter", "Requests sent");
+	for(it = stats.begin(); it != stats.end(); it++){
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)it->second.requests);
+		out += prefix + "_requests_total{method=\"" + label(it->first) + "\"} " + number + "\n";
+	}
+	header(out, prefix + "_retries_total", "counter", "Requests sent again after a failure");
+	for(it = stats.begin(); it != stats.end(); it++){
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)it->second.retries);
+		out += prefix + "_retries_total{method=\"" + label(it->first) + "\"} " + number + "\n";
+	}
+	header(out, prefix + "_request_bytes_total", "counter", "Request body bytes");
+	for(it = stats.begin(); it != stats.end(); it++){
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)it->second.request_bytes);
+		out += prefix + "_request_bytes_total{method=\"" + label(it->first) + "\"} " + number + "\n";
+	}
+	header(out, prefix + "_response_bytes_total", "counter", "Response bytes on the wire");
+	for(it = stats.begin(); it != stats.end(); it++){
+		snprintf(number, sizeof(number), "%llu", (unsigned long long)it->second.response_bytes);
+		out += prefix + "_response_bytes_total{method=\"" + label(it->first) + "\"} " + number + "\n";
+	}
+	header(out, prefix + "_errors_total", "counter", "Failed requests by VK error code, -1 for transport errors");
+	for(it = stats.begin(); it != stats.end(); it++){
+		for(map<int, uint64_t>::iterator error = it->second.errors.begin(); error != it->second.errors.end(); error++){
+			snprintf(number, sizeof(number), "\"} %llu\n", (unsigned long long)error->second);
+			out += prefix + "_errors_total{method=\"" + label(it->first) + "\",code=\"" + to_string(error->first) + number;
+		}
+	}
+
+	string name = prefix + "_phase_seconds";
+	header(out, name, "histogram", "Time of request phases");
+	for(it = stats.begin(); it != stats.end(); it++){
+		for(int phase = 0; phase < PHASES; phase++){
+			const VK::Metrics::Histogram &histogram = it->second.phases[phase];
+			if(!histogram.count) continue;
+			string labels = "method=\"" + label(it->first) + "\",phase=\"" + PHASE_NAMES[phase] + "\"";
+			uint64_t cumulative = 0;
+			for(int i = 0; i <= BUCKETS; i++){
+				cumulative += histogram.buckets[i];
+				if(i < BUCKETS) snprintf(number, sizeof(number), "%g\"} %llu\n", BOUNDS[i], (unsigned long long)cumulative);
+				else snprintf(number, sizeof(number), "+Inf\"} %llu\n", (unsigned long long)cumulative);
+				out += name + "_bucket{" + labels + ",le=\"" + number;
+			}
+			snprintf(number, sizeof(number), "%.6f", histogram.sum / 1000);
+			out += name + "_sum{" + labels + "} " + number + "\n";
+			snprintf(number, sizeof(number), "%llu", (unsigned long long)histogram.count);
+			out += name + "_count{" + labels + "} " + number + "\n";
+		}
+	}
+	return out;
+}
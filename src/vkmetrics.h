@@ -0,0 +1,180 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains per-method request metrics with Prometheus text export
+*/
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "vklib.h"
+#ifndef VKMETRICS_H
+#define VKMETRICS_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A Metrics class counts requests, bytes and error codes and keeps
+		latency histograms of request phases for every API method.
+		Recording takes short locks of the methods table and of the method,
+		API does not measure anything while its metrics are not enabled
+	*/
+	class Metrics{
+	public:
+		/**
+			Request phases, every one has own histogram
+		*/
+		enum Phase{
+			QUEUE,		///< waiting for rate limiter
+			CONNECT,	///< TCP connect, 0 on reused connection
+			TLS,		///< TLS handshake
+			WAIT,		///< request sent, waiting for first byte
+			TRANSFER,	///< receiving response
+			PARSE,		///< parsing left after the last byte
+			TOTAL,		///< whole call
+			PHASES
+		};
+
+		static const char *const PHASE_NAMES[PHASES];
+
+		/**
+			Upper bounds of histogram buckets in seconds, the last bucket is unbounded
+		*/
+		static const int BUCKETS = 14;
+		static const double BOUNDS[BUCKETS];
+
+		/**
+			A Histogram class counts observations in buckets of BOUNDS
+		*/
+		class Histogram{
+		public:
+			uint64_t buckets[BUCKETS + 1];
+			uint64_t count;
+			double sum;
+
+			Histogram();
+
+			/**
+				@param ms observed time in milliseconds
+			*/
+			void observe(double ms);
+
+			/**
+				Quantile estimated by interpolation inside its bucket
+
+				@param q quantile from 0 to 1
+				@return milliseconds, 0 when empty
+			*/
+			double quantile(double q) const;
+		};
+
+		/**
+			A Sample class describes one finished request. Phases not known for
+			the request are left 0 and not observed
+		*/
+		class Sample{
+		public:
+			double phases[PHASES];
+			size_t request_bytes;
+			size_t response_bytes;
+
+			/**
+				VK error code, -1 for transport and malformed response errors, 0 on success
+			*/
+			int error_code;
+
+			/**
+				Phases were measured by libcurl, otherwise only QUEUE, PARSE and TOTAL may be known
+			*/
+			bool timed;
+
+			/**
+				QUEUE was measured, calls queued on the event loop only know TOTAL
+			*/
+			bool queued;
+
+			/**
+				Request is a retry of a failed one
+			*/
+			bool retry;
+
+			Sample();
+
+			/**
+				Split curl timing of request into phases
+
+				@param timing filled request timing
+			*/
+			void fill(const Timing &timing);
+		};
+
+		/**
+			A Stats class describes requests of one method
+		*/
+		class Stats{
+		public:
+			uint64_t requests;
+			uint64_t failures;
+			uint64_t retries;
+			uint64_t request_bytes;
+			uint64_t response_bytes;
+			Histogram phases[PHASES];
+
+			/**
+				Number of failed requests by error code
+			*/
+			map<int, uint64_t> errors;
+
+			Stats();
+		};
+
+		Metrics();
+
+		/**
+			Add finished request
+
+			@param method method name
+			@param sample request sample
+		*/
+		void record(const string &method, const Sample &sample);
+
+		/**
+			@return copy of stats of every method
+		*/
+		map<string, Stats> getStats();
+
+		/**
+			Stats in Prometheus text exposition format
+
+			@param prefix metric names prefix
+			@return text to serve on /metrics
+		*/
+		string prometheus(const string &prefix = "vk_api");
+
+		/**
+			Forget all recorded requests
+		*/
+		void reset();
+
+	private:
+		class Entry{
+		public:
+			mutex lock;
+			Stats stats;
+		};
+
+		mutex lock;
+		unordered_map<string, shared_ptr<Entry> > entries;
+
+		shared_ptr<Entry> entry(const string &method);
+
+		Metrics(const Metrics&) = delete;
+		Metrics &operator=(const Metrics&) = delete;
+	};
+}
+#endif
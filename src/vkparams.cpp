@@ -0,0 +1,227 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "vkparams.h"
+#include "vklib.h"
+
+using namespace std;
+
+const size_t VK::Params::INLINE;
+
+/**
+	Minus is percent encoded like VK::Utils::urlencode does, so encode() and data2str() agree
+*/
+static void appendNumber(string &out, long long value, bool encoded){
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *begin = end;
+	unsigned long long number = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+	do{
+		*--begin = (char)('0' + number % 10);
+		number /= 10;
+	}while(number);
+	if(value < 0) out += encoded ? "%2d" : "-";
+	out.append(begin, end - begin);
+}
+
+VK::Params::Params(){
+	count = 0;
+}
+
+VK::Params::Entry &VK::Params::at(size_t i){
+	return i < INLINE ? entries[i] : overflow[i - INLINE];
+}
+
+const VK::Params::Entry &VK::Params::at(size_t i) const{
+	return i < INLINE ? entries[i] : overflow[i - INLINE];
+}
+
+const char *VK::Params::nameOf(const VK::Params::Entry &entry) const{
+	return entry.name ? entry.name : chars.data() + entry.name_offset;
+}
+
+int VK::Params::find(const char *name, size_t length) const{
+	for(size_t i = 0; i < count; i++){
+		const VK::Params::Entry &entry = at(i);
+		// Typed keys are literals, so the same key is usually the same pointer
+		if(entry.name == name) return (int)i;
+		if(entry.name_length == length && memcmp(nameOf(entry), name, length) == 0) return (int)i;
+	}
+	return -1;
+}
+
+VK::Params::Entry &VK::Params::slot(const char *name, size_t length, uint8_t type){
+	int i = find(name, length);
+	bool found = i >= 0;
+	if(!found){
+		i = (int)count++;
+		if(count > INLINE) overflow.resize(count - INLINE);
+		at(i).name = name;
+		at(i).name_offset = 0;
+		at(i).name_length = (uint32_t)length;
+	}
+	// A value of the same type keeps its place, place() writes over it when the new one fits
+	VK::Params::Entry &entry = at(i);
+	if(entry.type != type || !found){
+		entry.offset = 0;
+		entry.length = 0;
+	}
+	entry.type = type;
+	entry.number = 0;
+	return entry;
+}
+
+uint32_t VK::Params::place(VK::Params::Entry &entry, size_t length){
+	if(length > entry.length){
+		entry.offset = (uint32_t)chars.size();
+		chars.resize(chars.size() + length);
+	}
+	entry.length = (uint32_t)length;
+	return entry.offset;
+}
+
+VK::Params &VK::Params::set(VK::Key<int> key, long long value){
+	slot(key.name, key.length, INT).number = value;
+	return *this;
+}
+
+VK::Params &VK::Params::set(VK::Key<bool> key, bool value){
+	slot(key.name, key.length, BOOL).number = value ? 1 : 0;
+	return *this;
+}
+
+VK::Params &VK::Params::set(VK::Key<double> key, double value){
+	slot(key.name, key.length, DOUBLE).real = value;
+	return *this;
+}
+
+VK::Params &VK::Params::set(VK::Key<string> key, const string &value){
+	VK::Params::Entry &entry = slot(key.name, key.length, STRING);
+	chars.replace(place(entry, value.size()), value.size(), value);
+	return *this;
+}
+
+VK::Params &VK::Params::set(VK::Key<vector<int> > key, const vector<int> &value){
+	VK::Params::Entry &entry = slot(key.name, key.length, INT_LIST);
+	if(value.size() > entry.length){
+		entry.offset = (uint32_t)numbers.size();
+		numbers.resize(numbers.size() + value.size());
+	}
+	entry.length = (uint32_t)value.size();
+	copy(value.begin(), value.end(), numbers.begin() + entry.offset);
+	return *this;
+}
+
+VK::Params &VK::Params::set(VK::Key<vector<string> > key, const vector<string> &value){
+	// Lists of strings are sent joined, so they are joined once here
+	VK::Params::Entry &entry = slot(key.name, key.length, STRING);
+	size_t length = value.empty() ? 0 : value.size() - 1;
+	for(size_t i = 0; i < value.size(); i++) length += value[i].size();
+	uint32_t offset = place(entry, length);
+	for(size_t i = 0; i < value.size(); i++){
+		if(i) chars[offset++] = ',';
+		chars.replace(offset, value[i].size(), value[i]);
+		offset += (uint32_t)value[i].size();
+	}
+	return *this;
+}
+
+VK::Params &VK::Params::set(const string &name, const string &value){
+	int i = find(name.data(), name.size());
+	bool literal = i >= 0 && at(i).name;
+	uint32_t name_offset = i >= 0 ? at(i).name_offset : (uint32_t)chars.size();
+	if(i < 0) chars.append(name);
+
+	VK::Params::Entry &entry = slot(name.data(), name.size(), STRING);
+	if(!literal){
+		entry.name = NULL;
+		entry.name_offset = name_offset;
+	}
+	chars.replace(place(entry, value.size()), value.size(), value);
+	return *this;
+}
+
+bool VK::Params::has(const char *name) const{
+	return find(name, strlen(name)) >= 0;
+}
+
+bool VK::Params::get(const char *name, string &value) const{
+	int i = find(name, strlen(name));
+	if(i < 0) return false;
+	value.clear();
+	format(at(i), value, false);
+	return true;
+}
+
+size_t VK::Params::size() const{
+	return count;
+}
+
+void VK::Params::clear(){
+	count = 0;
+	overflow.clear();
+	chars.clear();
+	numbers.clear();
+}
+
+void VK::Params::format(const VK::Params::Entry &entry, string &out, bool encoded) const{
+	switch(entry.type){
+	case INT:
+	case BOOL:
+		appendNumber(out, entry.number, encoded);
+		break;
+	case DOUBLE:{
+		char text[32];
+		int length = snprintf(text, sizeof(text), "%.15g", entry.real);
+		if(encoded) VK::Utils::urlencode(text, length, out);
+		else out.append(text, length);
+		break;
+	}
+	case STRING:
+		if(encoded) VK::Utils::urlencode(chars.data() + entry.offset, entry.length, out);
+		else out.append(chars, entry.offset, entry.length);
+		break;
+	case INT_LIST:
+		for(uint32_t i = 0; i < entry.length; i++){
+			if(i) out += encoded ? "%2c" : ",";
+			appendNumber(out, numbers[entry.offset + i], encoded);
+		}
+		break;
+	}
+}
+
+void VK::Params::encode(string &out) const{
+	for(size_t i = 0; i < count; i++){
+		const VK::Params::Entry &entry = at(i);
+		out.append(nameOf(entry), entry.name_length);
+		out += '=';
+		format(entry, out, true);
+		out += '&';
+	}
+}
+
+size_t VK::Params::encodedSize() const{
+	size_t size = 0;
+	for(size_t i = 0; i < count; i++){
+		const VK::Params::Entry &entry = at(i);
+		size += entry.name_length + 2;
+		if(entry.type == STRING) size += entry.length * 3;
+		else if(entry.type == INT_LIST) size += entry.length * 16;
+		else if(entry.type == DOUBLE) size += 32 * 3;
+		else size += 24;
+	}
+	return size;
+}
+
+map<string, string> VK::Params::toMap() const{
+	map<string, string> data;
+	for(size_t i = 0; i < count; i++){
+		const VK::Params::Entry &entry = at(i);
+		string &value = data[string(nameOf(entry), entry.name_length)];
+		format(entry, value, false);
+	}
+	return data;
+}
@@ -0,0 +1,212 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains typed request parameters with compile-time keys
+*/
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#ifndef VKPARAMS_H
+#define VKPARAMS_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A Key class names a request parameter and fixes the type of its value,
+		so misspelled keys and values of a wrong type do not compile
+	*/
+	template<typename T> class Key{
+	public:
+		const char *name;
+		size_t length;
+
+		template<size_t N> constexpr explicit Key(const char (&name)[N]): name(name), length(N - 1){}
+	};
+
+	/**
+		Typed keys of the parameters listed in Parameters
+	*/
+	namespace Keys{
+		//Commons
+		constexpr Key<int> USER_ID("user_id");
+		constexpr Key<vector<int> > USER_IDS("user_ids");
+		constexpr Key<vector<string> > FIELDS("fields");
+		constexpr Key<int> SORT("sort");
+		constexpr Key<int> OFFSET("offset");
+		constexpr Key<int> COUNT("count");
+		constexpr Key<int> OWNER_ID("owner_id");
+
+		//Auth
+		constexpr Key<string> VERSION("v");
+		constexpr Key<bool> HTTPS("https");
+		constexpr Key<string> LANG("lang");
+		constexpr Key<string> ACCESS_TOKEN("access_token");
+		constexpr Key<string> SIG("sig");
+
+		//Get users
+		constexpr Key<string> NAME_CASE("name_case");
+
+		//Users Subscriptions
+		constexpr Key<bool> EXTENDED("extended");
+
+		//Search
+		constexpr Key<string> Q("q");
+		constexpr Key<int> CITY("city");
+		constexpr Key<int> COUNTRY("country");
+		constexpr Key<string> HOMETOWN("hometown");
+		constexpr Key<int> UNIVERSITY_COUNTRY("university_country");
+		constexpr Key<int> UNIVERSITY("university");
+		constexpr Key<int> UNIVERSITY_YEAR("university_year");
+		constexpr Key<int> SEX("sex");
+		constexpr Key<int> STATUS("status");
+		constexpr Key<int> AGE_FROM("age_from");
+		constexpr Key<int> AGE_TO("age_to");
+		constexpr Key<int> BIRTH_DAY("birth_day");
+		constexpr Key<int> BIRTH_MONTH("birth_month");
+		constexpr Key<int> BIRTH_YEAR("birth_year");
+		constexpr Key<bool> ONLINE("online");
+		constexpr Key<bool> HAS_PHOTO("has_photo");
+		constexpr Key<int> SCHOOL_COUNTRY("school_country");
+		constexpr Key<int> SCHOOL_CITY("school_city");
+		constexpr Key<int> SCHOOL("school");
+		constexpr Key<int> SCHOOL_YEAR("school_year");
+		constexpr Key<string> RELIGION("religion");
+		constexpr Key<string> INTERESTS("interests");
+		constexpr Key<string> COMPANY("company");
+		constexpr Key<string> POSITION("position");
+		constexpr Key<int> GROUP_ID("group_id");
+
+		//Wall
+		constexpr Key<bool> FRIENDS_ONLY("friends_only");
+		constexpr Key<bool> FROM_GROUP("from_group");
+		constexpr Key<string> MESSAGE("message");
+		constexpr Key<vector<string> > ATTACHMENTS("attachments");
+		constexpr Key<string> SERVICES("services");
+		constexpr Key<bool> SIGNED("signed");
+		constexpr Key<int> PUBLISH_DATE("publish_date");
+		constexpr Key<double> LAT("lat");
+		constexpr Key<double> LONG("long");
+		constexpr Key<int> PLACE_ID("place_id");
+		constexpr Key<int> POST_ID("post_id");
+
+		//Captcha
+		constexpr Key<string> CAPTCHA_SID("captcha_sid");
+		constexpr Key<string> CAPTCHA_KEY("captcha_key");
+		constexpr Key<string> REDIRECT_URI("redirect_uri");
+
+		//Photos
+		constexpr Key<string> PHOTO("photo");
+		constexpr Key<string> PHOTOS("photos");
+		constexpr Key<int> ALBUM_ID("album_id");
+		constexpr Key<vector<string> > PHOTO_IDS("photo_ids");
+		constexpr Key<bool> PHOTO_SIZES("photo_sizes");
+		constexpr Key<bool> REV("rev");
+		constexpr Key<string> FEED_TYPE("feed_type");
+		constexpr Key<string> FEED("feed");
+	}
+
+	/**
+		A Params class holds request parameters without a tree of string nodes.
+		Numbers, flags and id lists are kept as values and formatted only when
+		the request is encoded. Up to INLINE parameters live inside the object,
+		strings and lists share two buffers. A value set again is written over
+		the old one when it fits, so params reused for every page do not grow
+
+			VK::Params params;
+			params.set(VK::Keys::USER_IDS, ids).set(VK::Keys::FIELDS, fields);
+			Json::Value resp = api.call("users.get", params);
+	*/
+	class Params{
+	public:
+		static const size_t INLINE = 16;
+
+		Params();
+
+		Params &set(Key<int> key, long long value);
+		Params &set(Key<bool> key, bool value);
+		Params &set(Key<double> key, double value);
+		Params &set(Key<string> key, const string &value);
+		Params &set(Key<vector<int> > key, const vector<int> &value);
+		Params &set(Key<vector<string> > key, const vector<string> &value);
+
+		/**
+			Set parameter which has no typed key
+
+			@param name parameter name
+			@param value parameter value
+		*/
+		Params &set(const string &name, const string &value);
+
+		bool has(const char *name) const;
+
+		/**
+			@param name parameter name
+			@param value formatted value
+			@return false if parameter is not set
+		*/
+		bool get(const char *name, string &value) const;
+
+		size_t size() const;
+		void clear();
+
+		/**
+			Append parameters as URL encoded request body
+
+			@param out buffer to append to
+		*/
+		void encode(string &out) const;
+
+		/**
+			@return upper bound of encoded size
+		*/
+		size_t encodedSize() const;
+
+		map<string, string> toMap() const;
+
+	private:
+		enum Type{ INT, BOOL, DOUBLE, STRING, INT_LIST };
+
+		/**
+			A Entry class is one parameter. Name points to a key literal or, when
+			name is NULL, is stored in chars like string values
+		*/
+		class Entry{
+		public:
+			const char *name;
+			uint32_t name_offset;
+			uint32_t name_length;
+			uint8_t type;
+			union{
+				long long number;
+				double real;
+			};
+			uint32_t offset;
+			uint32_t length;
+		};
+
+		Entry entries[INLINE];
+		vector<Entry> overflow;
+		size_t count;
+		string chars;
+		vector<long long> numbers;
+
+		Entry &at(size_t i);
+		const Entry &at(size_t i) const;
+		const char *nameOf(const Entry &entry) const;
+		int find(const char *name, size_t length) const;
+		Entry &slot(const char *name, size_t length, uint8_t type);
+
+		/**
+			Make room for value of entry in chars, over the old value if it fits
+
+			@return offset of value
+		*/
+		uint32_t place(Entry &entry, size_t length);
+		void format(const Entry &entry, string &out, bool encoded) const;
+	};
+}
+#endif
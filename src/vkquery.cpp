@@ -0,0 +1,250 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <type_traits>
+#include "vkquery.h"
+
+using namespace std;
+
+const size_t VK::UsersQuery::BLOCK;
+const size_t VK::UsersQuery::MIN_ROWS;
+
+VK::UsersQuery::Group::Group(){
+	count = 0;
+	sum = 0;
+}
+
+VK::UsersQuery::UsersQuery(const VK::UsersColumns &users): users(users){
+	workers = 0;
+}
+
+VK::UsersQuery &VK::UsersQuery::where(VK::UsersQuery::Field field, long long value){
+	return where(field, value, value);
+}
+
+VK::UsersQuery &VK::UsersQuery::where(VK::UsersQuery::Field field, long long min, long long max){
+	VK::UsersQuery::Condition condition;
+	condition.field = field;
+	condition.min = min;
+	condition.max = max;
+	conditions.push_back(condition);
+	return *this;
+}
+
+VK::UsersQuery &VK::UsersQuery::threads(size_t threads){
+	workers = threads;
+	return *this;
+}
+
+// EVALUATION
+/**
+	Rows of the inner loops of conditions. Loops of a known trip count over
+	pointers which do not alias are vectorized at -O2 already
+*/
+static const size_t LANES = 16;
+
+/**
+	Narrow mask to rows with column value from min to max. Unsigned
+	difference from min turns the range check into one comparison
+*/
+template<typename T> static void range(const T *__restrict__ column, size_t size, long long min, long long max, uint8_t *__restrict__ mask){
+	typedef typename make_unsigned<T>::type U;
+	if(min > max || min > (long long)numeric_limits<T>::max() || max < (long long)numeric_limits<T>::min()){
+		memset(mask, 0, size);
+		return;
+	}
+	U low = (U)(T)std::max(min, (long long)numeric_limits<T>::min());
+	U span = (U)((U)(T)std::min(max, (long long)numeric_limits<T>::max()) - low);
+	size_t i = 0;
+	for(; i + LANES <= size; i += LANES){
+		for(size_t j = i; j < i + LANES; j++) mask[j] &= (U)((U)column[j] - low) <= span;
+	}
+	for(; i < size; i++) mask[i] &= (U)((U)column[i] - low) <= span;
+}
+
+/**
+	Narrow mask to rows with flag set or cleared as value range asks
+*/
+static void flag(const uint16_t *__restrict__ flags, size_t size, uint16_t bit, long long min, long long max, uint8_t *__restrict__ mask){
+	bool cleared = min <= 0 && max >= 0;
+	bool set = min <= 1 && max >= 1;
+	if(cleared && set) return;
+	if(!cleared && !set){
+		memset(mask, 0, size);
+		return;
+	}
+	uint16_t want = set ? bit : 0;
+	size_t i = 0;
+	for(; i + LANES <= size; i += LANES){
+		for(size_t j = i; j < i + LANES; j++) mask[j] &= (flags[j] & bit) == want;
+	}
+	for(; i < size; i++) mask[i] &= (flags[i] & bit) == want;
+}
+
+template<typename T> static void widen(const T *column, size_t size, long long *values){
+	for(size_t i = 0; i < size; i++){
+		values[i] = column[i];
+	}
+}
+
+void VK::UsersQuery::filter(size_t begin, size_t size, uint8_t *mask) const{
+	memset(mask, 1, size);
+	for(size_t c = 0; c < conditions.size(); c++){
+		const VK::UsersQuery::Condition &condition = conditions[c];
+		switch(condition.field){
+			case SEX: range(users.sex.data() + begin, size, condition.min, condition.max, mask); break;
+			case CITY: range(users.city.data() + begin, size, condition.min, condition.max, mask); break;
+			case COUNTRY: range(users.country.data() + begin, size, condition.min, condition.max, mask); break;
+			case ONLINE: flag(users.flags.data() + begin, size, VK::UsersColumns::ONLINE, condition.min, condition.max, mask); break;
+			case LAST_SEEN: range(users.last_seen.data() + begin, size, condition.min, condition.max, mask); break;
+			case FOLLOWERS_COUNT: range(users.followers_count.data() + begin, size, condition.min, condition.max, mask); break;
+			default: memset(mask, 0, size);
+		}
+	}
+}
+
+void VK::UsersQuery::gather(VK::UsersQuery::Field field, size_t begin, size_t size, long long *values) const{
+	switch(field){
+		case SEX: widen(users.sex.data() + begin, size, values); break;
+		case CITY: widen(users.city.data() + begin, size, values); break;
+		case COUNTRY: widen(users.country.data() + begin, size, values); break;
+		case ONLINE:
+			for(size_t i = 0; i < size; i++){
+				values[i] = (users.flags[begin + i] & VK::UsersColumns::ONLINE) != 0;
+			}
+			break;
+		case LAST_SEEN: widen(users.last_seen.data() + begin, size, values); break;
+		case FOLLOWERS_COUNT: widen(users.followers_count.data() + begin, size, values); break;
+		default: memset(values, 0, size * sizeof(long long));
+	}
+}
+
+size_t VK::UsersQuery::parts() const{
+	size_t threads = workers ? workers : thread::hardware_concurrency();
+	size_t parts = std::min(std::max(threads, (size_t)1), users.size() / MIN_ROWS);
+	return std::max(parts, (size_t)1);
+}
+
+void VK::UsersQuery::scan(const VK::UsersQuery::Visitor &visitor) const{
+	size_t parts = VK::UsersQuery::parts();
+	size_t rows = users.size();
+
+	// Parts are whole blocks, so every block but the last one is full
+	size_t blocks = (rows + BLOCK - 1) / BLOCK;
+	auto run = [&](size_t part){
+		uint8_t mask[BLOCK];
+		size_t first = blocks * part / parts;
+		size_t last = blocks * (part + 1) / parts;
+		for(size_t block = first; block < last; block++){
+			size_t begin = block * BLOCK;
+			size_t size = std::min(BLOCK, rows - begin);
+			filter(begin, size, mask);
+			visitor(part, begin, size, mask);
+		}
+	};
+
+	vector<thread> threads;
+	for(size_t part = 1; part < parts; part++){
+		threads.push_back(thread(run, part));
+	}
+	run(0);
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[i].join();
+	}
+}
+
+// RESULTS
+size_t VK::UsersQuery::count() const{
+	vector<size_t> counts(parts());
+	scan([&](size_t part, size_t, size_t size, const uint8_t *mask){
+		size_t count = 0;
+		for(size_t i = 0; i < size; i++){
+			count += mask[i];
+		}
+		counts[part] += count;
+	});
+
+	size_t count = 0;
+	for(size_t i = 0; i < counts.size(); i++){
+		count += counts[i];
+	}
+	return count;
+}
+
+vector<size_t> VK::UsersQuery::rows() const{
+	vector<vector<size_t> > found(parts());
+	scan([&](size_t part, size_t begin, size_t size, const uint8_t *mask){
+		for(size_t i = 0; i < size; i++){
+			if(mask[i]) found[part].push_back(begin + i);
+		}
+	});
+
+	vector<size_t> rows = found[0];
+	for(size_t i = 1; i < found.size(); i++){
+		rows.insert(rows.end(), found[i].begin(), found[i].end());
+	}
+	return rows;
+}
+
+vector<int> VK::UsersQuery::ids() const{
+	vector<size_t> rows = VK::UsersQuery::rows();
+	vector<int> ids(rows.size());
+	for(size_t i = 0; i < rows.size(); i++){
+		ids[i] = users.id[rows[i]];
+	}
+	return ids;
+}
+
+map<long long, size_t> VK::UsersQuery::countBy(VK::UsersQuery::Field by) const{
+	vector<unordered_map<long long, size_t> > partial(parts());
+	scan([&](size_t part, size_t begin, size_t size, const uint8_t *mask){
+		long long keys[BLOCK];
+		gather(by, begin, size, keys);
+		unordered_map<long long, size_t> &groups = partial[part];
+		for(size_t i = 0; i < size; i++){
+			if(mask[i]) groups[keys[i]]++;
+		}
+	});
+
+	map<long long, size_t> groups;
+	for(size_t i = 0; i < partial.size(); i++){
+		unordered_map<long long, size_t>::iterator it;
+		for(it = partial[i].begin(); it != partial[i].end(); ++it){
+			groups[it->first] += it->second;
+		}
+	}
+	return groups;
+}
+
+map<long long, VK::UsersQuery::Group> VK::UsersQuery::groupBy(VK::UsersQuery::Field by, VK::UsersQuery::Field sum) const{
+	vector<unordered_map<long long, VK::UsersQuery::Group> > partial(parts());
+	scan([&](size_t part, size_t begin, size_t size, const uint8_t *mask){
+		long long keys[BLOCK];
+		long long values[BLOCK];
+		gather(by, begin, size, keys);
+		gather(sum, begin, size, values);
+		unordered_map<long long, VK::UsersQuery::Group> &groups = partial[part];
+		for(size_t i = 0; i < size; i++){
+			if(!mask[i]) continue;
+			VK::UsersQuery::Group &group = groups[keys[i]];
+			group.count++;
+			group.sum += values[i];
+		}
+	});
+
+	map<long long, VK::UsersQuery::Group> groups;
+	for(size_t i = 0; i < partial.size(); i++){
+		unordered_map<long long, VK::UsersQuery::Group>::iterator it;
+		for(it = partial[i].begin(); it != partial[i].end(); ++it){
+			VK::UsersQuery::Group &group = groups[it->first];
+			group.count += it->second.count;
+			group.sum += it->second.sum;
+		}
+	}
+	return groups;
+}
@@ -0,0 +1,176 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains filter and aggregate queries over columnar users
+*/
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <stdint.h>
+#include "vkcolumns.h"
+#ifndef VKQUERY_H
+#define VKQUERY_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A UsersQuery class filters and aggregates users of UsersColumns.
+		Rows are evaluated in blocks: every condition narrows a byte mask of
+		the block with a branchless loop over one column, which compilers turn
+		into SIMD code. Large columns are split between threads, every thread
+		evaluates its own range and results are merged. Columns must not be
+		changed while a query runs
+	*/
+	class UsersQuery{
+	public:
+		/**
+			Fields conditions and groups can refer to
+		*/
+		enum Field{
+			SEX,				///< 0 unknown, 1 female, 2 male
+			CITY,				///< city id
+			COUNTRY,			///< country id
+			ONLINE,				///< 1 online, 0 offline
+			LAST_SEEN,			///< last seen unix time
+			FOLLOWERS_COUNT,	///< number of followers
+			FIELDS
+		};
+
+		/**
+			A Group class describes users with one value of group field
+		*/
+		class Group{
+		public:
+			size_t count;
+
+			/**
+				Sum of summed field
+			*/
+			long long sum;
+
+			Group();
+		};
+
+		/**
+			Rows of one block
+		*/
+		static const size_t BLOCK = 4096;
+
+		/**
+			Minimum rows of one thread, smaller queries run on the calling thread
+		*/
+		static const size_t MIN_ROWS = 65536;
+
+		/**
+			@param users columns to query, must outlive the query
+		*/
+		UsersQuery(const UsersColumns &users);
+
+		/**
+			Keep users with field equal to value
+
+			@param field field
+			@param value value
+		*/
+		UsersQuery &where(Field field, long long value);
+
+		/**
+			Keep users with field from min to max, both included
+
+			@param field field
+			@param min minimum value
+			@param max maximum value
+		*/
+		UsersQuery &where(Field field, long long min, long long max);
+
+		/**
+			Set number of threads, 0 for number of cores
+
+			@param threads number of threads
+		*/
+		UsersQuery &threads(size_t threads);
+
+		/**
+			@return number of matching users
+		*/
+		size_t count() const;
+
+		/**
+			@return ascending indexes of matching users in columns
+		*/
+		vector<size_t> rows() const;
+
+		/**
+			@return ids of matching users in columns order
+		*/
+		vector<int> ids() const;
+
+		/**
+			Count matching users by value of field
+
+			@param by group field
+			@return number of users of every value
+		*/
+		map<long long, size_t> countBy(Field by) const;
+
+		/**
+			Count matching users and sum field by value of another, e.g. followers by city
+
+			@param by group field
+			@param sum summed field
+			@return group of every value
+		*/
+		map<long long, Group> groupBy(Field by, Field sum) const;
+
+	private:
+		class Condition{
+		public:
+			Field field;
+			long long min;
+			long long max;
+		};
+
+		/**
+			Receives mask of a block
+
+			@param part thread part index
+			@param begin first row of block
+			@param size rows in block
+			@param mask 1 for matching rows
+		*/
+		typedef function<void(size_t part, size_t begin, size_t size, const uint8_t *mask)> Visitor;
+
+		const UsersColumns &users;
+		vector<Condition> conditions;
+		size_t workers;
+
+		/**
+			@return number of thread parts the rows are split into
+		*/
+		size_t parts() const;
+
+		/**
+			Evaluate conditions of every block, blocks of one part are visited in order
+
+			@param visitor block receiver
+		*/
+		void scan(const Visitor &visitor) const;
+
+		void filter(size_t begin, size_t size, uint8_t *mask) const;
+
+		/**
+			Copy values of field of a block
+
+			@param field field
+			@param begin first row
+			@param size rows
+			@param values output
+		*/
+		void gather(Field field, size_t begin, size_t size, long long *values) const;
+	};
+}
+#endif
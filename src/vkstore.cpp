@@ -0,0 +1,1168 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vkstore.h"
+
+using namespace std;
+
+// BINARY WRITER
+VK::BinaryWriter::BinaryWriter(string &out): out(out){
+}
+
+void VK::BinaryWriter::putByte(uint8_t value){
+	out += (char)value;
+}
+
+void VK::BinaryWriter::putVarint(uint64_t value){
+	while(value >= 0x80){
+		out += (char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+void VK::BinaryWriter::putSigned(int64_t value){
+	putVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void VK::BinaryWriter::putString(const string &value){
+	putString(value.data(), value.size());
+}
+
+void VK::BinaryWriter::putString(const char *value, size_t length){
+	putVarint(length);
+	out.append(value, length);
+}
+
+void VK::BinaryWriter::putFixed32(uint32_t value){
+	for(int i = 0; i < 4; i++){
+		out += (char)(value >> (8 * i));
+	}
+}
+
+void VK::BinaryWriter::putFixed64(uint64_t value){
+	for(int i = 0; i < 8; i++){
+		out += (char)(value >> (8 * i));
+	}
+}
+
+// BINARY READER
+VK::BinaryReader::BinaryReader(const char *data, size_t size){
+	VK::BinaryReader::data = data;
+	VK::BinaryReader::size = size;
+	pos = 0;
+	error = false;
+}
+
+bool VK::BinaryReader::failed(){
+	return error;
+}
+
+size_t VK::BinaryReader::position(){
+	return pos;
+}
+
+uint8_t VK::BinaryReader::getByte(){
+	if(pos >= size){
+		error = true;
+		return 0;
+	}
+	return (uint8_t)data[pos++];
+}
+
+uint64_t VK::BinaryReader::getVarint(){
+	uint64_t value = 0;
+	for(int shift = 0; shift < 64; shift += 7){
+		if(pos >= size){
+			error = true;
+			return 0;
+		}
+		uint8_t byte = (uint8_t)data[pos++];
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if(!(byte & 0x80)) return value;
+	}
+	error = true;
+	return 0;
+}
+
+int64_t VK::BinaryReader::getSigned(){
+	uint64_t value = getVarint();
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+uint32_t VK::BinaryReader::getFixed32(){
+	if(size - pos < 4 || pos > size){
+		error = true;
+		return 0;
+	}
+	uint32_t value = 0;
+	for(int i = 0; i < 4; i++){
+		value |= (uint32_t)(uint8_t)data[pos++] << (8 * i);
+	}
+	return value;
+}
+
+uint64_t VK::BinaryReader::getFixed64(){
+	if(size - pos < 8 || pos > size){
+		error = true;
+		return 0;
+	}
+	uint64_t value = 0;
+	for(int i = 0; i < 8; i++){
+		value |= (uint64_t)(uint8_t)data[pos++] << (8 * i);
+	}
+	return value;
+}
+
+const char *VK::BinaryReader::getString(size_t &length){
+	length = (size_t)getVarint();
+	if(error || length > size - pos){
+		error = true;
+		length = 0;
+		return data + pos;
+	}
+	const char *value = data + pos;
+	pos += length;
+	return value;
+}
+
+void VK::BinaryReader::getString(string &value){
+	size_t length;
+	const char *chars = getString(length);
+	value.assign(chars, length);
+}
+
+// CHECKSUM
+/**
+	CRC-32 of data, as zlib computes it
+
+	@param data bytes
+	@param size number of bytes
+	@param crc checksum of preceding bytes, 0 at the start
+	@return checksum of preceding bytes and data
+*/
+static uint32_t checksum(const char *data, size_t size, uint32_t crc = 0){
+	static const struct Table{
+		uint32_t values[256];
+
+		Table(){
+			for(uint32_t i = 0; i < 256; i++){
+				uint32_t value = i;
+				for(int bit = 0; bit < 8; bit++) value = value & 1 ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+				values[i] = value;
+			}
+		}
+	} table;
+
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++){
+		crc = table.values[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// USER CODEC
+const uint8_t VK::UserCodec::VERSION;
+
+static void readString(VK::BinaryReader &in, VK::Interned &value){
+	size_t length;
+	const char *chars = in.getString(length);
+	value.assign(chars, length);
+}
+
+static void writeUniversity(VK::BinaryWriter &out, const VK::University &university){
+	out.putSigned(university.id);
+	out.putSigned(university.country);
+	out.putSigned(university.city);
+	out.putString(university.name);
+	out.putSigned(university.faculty);
+	out.putString(university.faculty_name);
+	out.putSigned(university.chair);
+	out.putString(university.chair_name);
+	out.putSigned(university.graduation);
+}
+
+static void readUniversity(VK::BinaryReader &in, VK::University &university){
+	university.id = (int)in.getSigned();
+	university.country = (int)in.getSigned();
+	university.city = (int)in.getSigned();
+	readString(in, university.name);
+	university.faculty = (int)in.getSigned();
+	readString(in, university.faculty_name);
+	university.chair = (int)in.getSigned();
+	readString(in, university.chair_name);
+	university.graduation = (int)in.getSigned();
+}
+
+static void writeSchool(VK::BinaryWriter &out, const VK::School &school){
+	out.putSigned(school.id);
+	out.putSigned(school.country);
+	out.putSigned(school.city);
+	out.putString(school.name);
+	out.putSigned(school.year_from);
+	out.putSigned(school.year_to);
+	out.putSigned(school.year_graduated);
+	out.putString(school.class_l);
+	out.putString(school.speciality);
+	out.putSigned(school.type);
+	out.putString(school.type_str);
+}
+
+static void readSchool(VK::BinaryReader &in, VK::School &school){
+	school.id = (int)in.getSigned();
+	school.country = (int)in.getSigned();
+	school.city = (int)in.getSigned();
+	readString(in, school.name);
+	school.year_from = (int)in.getSigned();
+	school.year_to = (int)in.getSigned();
+	school.year_graduated = (int)in.getSigned();
+	in.getString(school.class_l);
+	in.getString(school.speciality);
+	school.type = (int)in.getSigned();
+	readString(in, school.type_str);
+}
+
+void VK::UserCodec::encode(const VK::UserFull &user, string &out){
+	typedef VK::UserFull::Fields F;
+	VK::BinaryWriter writer(out);
+
+	writer.putByte(VERSION);
+	writer.putSigned(user.id);
+	writer.putString(user.first_name);
+	writer.putString(user.last_name);
+
+	uint64_t flags = 0;
+	if(user.online) flags |= 1 << 0;
+	if(user.online_mobile) flags |= 1 << 1;
+	if(user.verified) flags |= 1 << 2;
+	if(user.blacklisted) flags |= 1 << 3;
+	if(user.has_mobile) flags |= 1 << 4;
+	writer.putVarint(flags);
+
+	// Only fields with values are written, the bitmap tells which
+	uint64_t fields = 0;
+	if(!user.photo_50.empty()) fields |= F::PHOTO_50;
+	if(!user.photo_100.empty()) fields |= F::PHOTO_100;
+	if(!user.photo_200.empty()) fields |= F::PHOTO_200;
+	if(!user.photo_id.empty()) fields |= F::PHOTO_ID;
+	if(user.sex) fields |= F::SEX;
+	if(!user.bdate.empty()) fields |= F::BDATE;
+	if(user.city.id || !user.city.title.empty()) fields |= F::CITY;
+	if(user.country.id || !user.country.title.empty()) fields |= F::COUNTRY;
+	if(!user.home_town.empty()) fields |= F::HOME_TOWN;
+	if(!user.domain.empty()) fields |= F::DOMAIN;
+	if(!user.contacts.mobile_phone.empty() || !user.contacts.home_phone.empty()) fields |= F::CONTACTS;
+	if(!user.site.empty()) fields |= F::SITE;
+	if(user.education.university || user.education.faculty || user.education.graduation
+		|| !user.education.university_name.empty() || !user.education.faculty_name.empty()) fields |= F::EDUCATION;
+	if(!user.universities.empty()) fields |= F::UNIVERSITIES;
+	if(!user.schools.empty()) fields |= F::SCHOOLS;
+	if(!user.status.empty()) fields |= F::STATUS;
+	if(user.last_seen.time || user.last_seen.platform) fields |= F::LAST_SEEN;
+	if(user.followers_count) fields |= F::FOLLOWERS_COUNT;
+	if(user.common_count) fields |= F::COMMON_COUNT;
+	if(!user.counters.empty()) fields |= F::COUNTERS;
+	writer.putVarint(fields);
+
+	if(fields & F::PHOTO_50) writer.putString(user.photo_50);
+	if(fields & F::PHOTO_100) writer.putString(user.photo_100);
+	if(fields & F::PHOTO_200) writer.putString(user.photo_200);
+	if(fields & F::PHOTO_ID) writer.putString(user.photo_id);
+	if(fields & F::SEX) writer.putSigned(user.sex);
+	if(fields & F::BDATE) writer.putString(user.bdate);
+	if(fields & F::CITY){
+		writer.putSigned(user.city.id);
+		writer.putString(user.city.title);
+	}
+	if(fields & F::COUNTRY){
+		writer.putSigned(user.country.id);
+		writer.putString(user.country.title);
+	}
+	if(fields & F::HOME_TOWN) writer.putString(user.home_town);
+	if(fields & F::DOMAIN) writer.putString(user.domain);
+	if(fields & F::CONTACTS){
+		writer.putString(user.contacts.mobile_phone);
+		writer.putString(user.contacts.home_phone);
+	}
+	if(fields & F::SITE) writer.putString(user.site);
+	if(fields & F::EDUCATION){
+		writer.putSigned(user.education.university);
+		writer.putString(user.education.university_name);
+		writer.putSigned(user.education.faculty);
+		writer.putString(user.education.faculty_name);
+		writer.putSigned(user.education.graduation);
+	}
+	if(fields & F::UNIVERSITIES){
+		writer.putVarint(user.universities.size());
+		for(size_t i = 0; i < user.universities.size(); i++){
+			writeUniversity(writer, user.universities[i]);
+		}
+	}
+	if(fields & F::SCHOOLS){
+		writer.putVarint(user.schools.size());
+		for(size_t i = 0; i < user.schools.size(); i++){
+			writeSchool(writer, user.schools[i]);
+		}
+	}
+	if(fields & F::STATUS) writer.putString(user.status);
+	if(fields & F::LAST_SEEN){
+		writer.putSigned(user.last_seen.time);
+		writer.putSigned(user.last_seen.platform);
+	}
+	if(fields & F::FOLLOWERS_COUNT) writer.putSigned(user.followers_count);
+	if(fields & F::COMMON_COUNT) writer.putSigned(user.common_count);
+	if(fields & F::COUNTERS){
+		writer.putVarint(user.counters.size());
+		map<string, int>::const_iterator it;
+		for(it = user.counters.begin(); it != user.counters.end(); ++it){
+			writer.putString(it->first);
+			writer.putSigned(it->second);
+		}
+	}
+}
+
+bool VK::UserCodec::decode(const char *data, size_t size, VK::UserFull &user){
+	typedef VK::UserFull::Fields F;
+	VK::BinaryReader reader(data, size);
+
+	if(reader.getByte() != VERSION) return false;
+	user.id = (int)reader.getSigned();
+	reader.getString(user.first_name);
+	reader.getString(user.last_name);
+
+	uint64_t flags = reader.getVarint();
+	user.online = (flags & (1 << 0)) != 0;
+	user.online_mobile = (flags & (1 << 1)) != 0;
+	user.verified = (flags & (1 << 2)) != 0;
+	user.blacklisted = (flags & (1 << 3)) != 0;
+	user.has_mobile = (flags & (1 << 4)) != 0;
+
+	uint64_t fields = reader.getVarint();
+	if(fields & F::PHOTO_50) reader.getString(user.photo_50); else user.photo_50.clear();
+	if(fields & F::PHOTO_100) reader.getString(user.photo_100); else user.photo_100.clear();
+	if(fields & F::PHOTO_200) reader.getString(user.photo_200); else user.photo_200.clear();
+	if(fields & F::PHOTO_ID) reader.getString(user.photo_id); else user.photo_id.clear();
+	user.sex = fields & F::SEX ? (int)reader.getSigned() : 0;
+	if(fields & F::BDATE) reader.getString(user.bdate); else user.bdate.clear();
+	if(fields & F::CITY){
+		user.city.id = (int)reader.getSigned();
+		readString(reader, user.city.title);
+	}else{
+		user.city = VK::City();
+		user.city.id = 0;
+	}
+	if(fields & F::COUNTRY){
+		user.country.id = (int)reader.getSigned();
+		readString(reader, user.country.title);
+	}else{
+		user.country = VK::Country();
+		user.country.id = 0;
+	}
+	if(fields & F::HOME_TOWN) reader.getString(user.home_town); else user.home_town.clear();
+	if(fields & F::DOMAIN) reader.getString(user.domain); else user.domain.clear();
+	if(fields & F::CONTACTS){
+		reader.getString(user.contacts.mobile_phone);
+		reader.getString(user.contacts.home_phone);
+	}else{
+		user.contacts.mobile_phone.clear();
+		user.contacts.home_phone.clear();
+	}
+	if(fields & F::SITE) reader.getString(user.site); else user.site.clear();
+	if(fields & F::EDUCATION){
+		user.education.university = (int)reader.getSigned();
+		readString(reader, user.education.university_name);
+		user.education.faculty = (int)reader.getSigned();
+		readString(reader, user.education.faculty_name);
+		user.education.graduation = (int)reader.getSigned();
+	}else{
+		user.education = VK::Education();
+		user.education.university = 0;
+		user.education.faculty = 0;
+		user.education.graduation = 0;
+	}
+
+	user.universities.clear();
+	if(fields & F::UNIVERSITIES){
+		size_t count = (size_t)reader.getVarint();
+		for(size_t i = 0; i < count && !reader.failed(); i++){
+			user.universities.push_back(VK::University());
+			readUniversity(reader, user.universities.back());
+		}
+	}
+	user.schools.clear();
+	if(fields & F::SCHOOLS){
+		size_t count = (size_t)reader.getVarint();
+		for(size_t i = 0; i < count && !reader.failed(); i++){
+			user.schools.push_back(VK::School());
+			readSchool(reader, user.schools.back());
+		}
+	}
+
+	if(fields & F::STATUS) reader.getString(user.status); else user.status.clear();
+	if(fields & F::LAST_SEEN){
+		user.last_seen.time = reader.getSigned();
+		user.last_seen.platform = (int)reader.getSigned();
+	}else{
+		user.last_seen.time = 0;
+		user.last_seen.platform = 0;
+	}
+	user.followers_count = fields & F::FOLLOWERS_COUNT ? (int)reader.getSigned() : 0;
+	user.common_count = fields & F::COMMON_COUNT ? (int)reader.getSigned() : 0;
+
+	user.counters.clear();
+	if(fields & F::COUNTERS){
+		size_t count = (size_t)reader.getVarint();
+		string key;
+		for(size_t i = 0; i < count && !reader.failed(); i++){
+			reader.getString(key);
+			user.counters[key] = (int)reader.getSigned();
+		}
+	}
+	return !reader.failed();
+}
+
+// STRING REF
+VK::StringRef::StringRef(){
+	data = "";
+	length = 0;
+}
+
+string VK::StringRef::str() const{
+	return string(data, length);
+}
+
+bool VK::StringRef::empty() const{
+	return !length;
+}
+
+bool VK::StringRef::operator==(const string &other) const{
+	return other.size() == length && !memcmp(other.data(), data, length);
+}
+
+bool VK::StringRef::operator!=(const string &other) const{
+	return !(*this == other);
+}
+
+// USER VIEW
+static void readRef(VK::BinaryReader &in, VK::StringRef &value){
+	value.data = in.getString(value.length);
+}
+
+static void skipUniversity(VK::BinaryReader &in){
+	size_t length;
+	for(int i = 0; i < 3; i++) in.getSigned();
+	in.getString(length);
+	in.getSigned();
+	in.getString(length);
+	in.getSigned();
+	in.getString(length);
+	in.getSigned();
+}
+
+static void skipSchool(VK::BinaryReader &in){
+	size_t length;
+	for(int i = 0; i < 3; i++) in.getSigned();
+	in.getString(length);
+	for(int i = 0; i < 3; i++) in.getSigned();
+	in.getString(length);
+	in.getString(length);
+	in.getSigned();
+	in.getString(length);
+}
+
+VK::UserView::UserView(){
+	clear();
+}
+
+void VK::UserView::clear(){
+	id = 0;
+	first_name = last_name = VK::StringRef();
+	online = online_mobile = verified = blacklisted = has_mobile = false;
+	fields = 0;
+	photo_50 = photo_100 = photo_200 = photo_id = VK::StringRef();
+	sex = 0;
+	bdate = VK::StringRef();
+	city_id = country_id = 0;
+	city_title = country_title = VK::StringRef();
+	home_town = domain = mobile_phone = home_phone = site = VK::StringRef();
+	university = faculty = graduation = 0;
+	university_name = faculty_name = VK::StringRef();
+	universities = schools = counters = 0;
+	status = VK::StringRef();
+	last_seen_time = 0;
+	last_seen_platform = 0;
+	followers_count = 0;
+	common_count = 0;
+}
+
+bool VK::UserView::read(const char *data, size_t size){
+	typedef VK::UserFull::Fields F;
+	VK::BinaryReader reader(data, size);
+	clear();
+
+	if(reader.getByte() != VK::UserCodec::VERSION) return false;
+	id = (int)reader.getSigned();
+	readRef(reader, first_name);
+	readRef(reader, last_name);
+
+	uint64_t flags = reader.getVarint();
+	online = (flags & (1 << 0)) != 0;
+	online_mobile = (flags & (1 << 1)) != 0;
+	verified = (flags & (1 << 2)) != 0;
+	blacklisted = (flags & (1 << 3)) != 0;
+	has_mobile = (flags & (1 << 4)) != 0;
+
+	fields = reader.getVarint();
+	if(fields & F::PHOTO_50) readRef(reader, photo_50);
+	if(fields & F::PHOTO_100) readRef(reader, photo_100);
+	if(fields & F::PHOTO_200) readRef(reader, photo_200);
+	if(fields & F::PHOTO_ID) readRef(reader, photo_id);
+	if(fields & F::SEX) sex = (int)reader.getSigned();
+	if(fields & F::BDATE) readRef(reader, bdate);
+	if(fields & F::CITY){
+		city_id = (int)reader.getSigned();
+		readRef(reader, city_title);
+	}
+	if(fields & F::COUNTRY){
+		country_id = (int)reader.getSigned();
+		readRef(reader, country_title);
+	}
+	if(fields & F::HOME_TOWN) readRef(reader, home_town);
+	if(fields & F::DOMAIN) readRef(reader, domain);
+	if(fields & F::CONTACTS){
+		readRef(reader, mobile_phone);
+		readRef(reader, home_phone);
+	}
+	if(fields & F::SITE) readRef(reader, site);
+	if(fields & F::EDUCATION){
+		university = (int)reader.getSigned();
+		readRef(reader, university_name);
+		faculty = (int)reader.getSigned();
+		readRef(reader, faculty_name);
+		graduation = (int)reader.getSigned();
+	}
+	if(fields & F::UNIVERSITIES){
+		universities = (size_t)reader.getVarint();
+		for(size_t i = 0; i < universities && !reader.failed(); i++) skipUniversity(reader);
+	}
+	if(fields & F::SCHOOLS){
+		schools = (size_t)reader.getVarint();
+		for(size_t i = 0; i < schools && !reader.failed(); i++) skipSchool(reader);
+	}
+	if(fields & F::STATUS) readRef(reader, status);
+	if(fields & F::LAST_SEEN){
+		last_seen_time = reader.getSigned();
+		last_seen_platform = (int)reader.getSigned();
+	}
+	if(fields & F::FOLLOWERS_COUNT) followers_count = (int)reader.getSigned();
+	if(fields & F::COMMON_COUNT) common_count = (int)reader.getSigned();
+	if(fields & F::COUNTERS){
+		counters = (size_t)reader.getVarint();
+		size_t length;
+		for(size_t i = 0; i < counters && !reader.failed(); i++){
+			reader.getString(length);
+			reader.getSigned();
+		}
+	}
+	return !reader.failed();
+}
+
+// SNAPSHOT WRITER
+const uint32_t VK::SnapshotWriter::MAGIC;
+const uint8_t VK::SnapshotWriter::VERSION;
+const size_t VK::SnapshotWriter::BLOCK;
+
+VK::SnapshotWriter::SnapshotWriter(ostream &out): out(out){
+	count = 0;
+	crc = 0;
+	finished = false;
+	buffer.reserve(BLOCK + 4096);
+	VK::BinaryWriter writer(buffer);
+	writer.putFixed32(MAGIC);
+	writer.putByte(VERSION);
+}
+
+VK::SnapshotWriter::~SnapshotWriter(){
+	finish();
+}
+
+void VK::SnapshotWriter::write(const VK::UserFull &user){
+	record.clear();
+	VK::UserCodec::encode(user, record);
+	size_t start = buffer.size();
+	VK::BinaryWriter writer(buffer);
+	writer.putString(record);
+	crc = checksum(buffer.data() + start, buffer.size() - start, crc);
+	count++;
+	if(buffer.size() >= BLOCK) flush();
+}
+
+void VK::SnapshotWriter::write(const vector<VK::UserFull> &users){
+	for(size_t i = 0; i < users.size(); i++){
+		write(users[i]);
+	}
+}
+
+void VK::SnapshotWriter::write(const VK::UsersList &users){
+	write(users.list);
+}
+
+bool VK::SnapshotWriter::flush(){
+	out.write(buffer.data(), buffer.size());
+	buffer.clear();
+	return out.good();
+}
+
+bool VK::SnapshotWriter::finish(){
+	if(finished) return out.good();
+	finished = true;
+
+	// Records are never empty, zero length marks the end
+	VK::BinaryWriter writer(buffer);
+	writer.putVarint(0);
+	writer.putFixed64(count);
+	writer.putFixed32(crc);
+	bool written = flush();
+	out.flush();
+	return written && out.good();
+}
+
+size_t VK::SnapshotWriter::size(){
+	return count;
+}
+
+bool VK::SnapshotWriter::save(const string &path, const VK::UsersList &users){
+	ofstream file(path.c_str(), ios::binary | ios::trunc);
+	if(!file.is_open()) return false;
+	VK::SnapshotWriter writer(file);
+	writer.write(users);
+	return writer.finish();
+}
+
+// SNAPSHOT READER
+VK::SnapshotReader::SnapshotReader(const char *data, size_t size){
+	VK::SnapshotReader::data = data;
+	length = size;
+	mapped = NULL;
+	start();
+}
+
+VK::SnapshotReader::SnapshotReader(const string &path){
+	data = NULL;
+	length = 0;
+	mapped = NULL;
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat info;
+	if(fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0){
+		void *memory = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(memory != MAP_FAILED){
+			// Records are read once from start to end
+			madvise(memory, (size_t)info.st_size, MADV_SEQUENTIAL);
+			mapped = memory;
+			data = (const char*)memory;
+			length = (size_t)info.st_size;
+		}
+	}
+	if(fd >= 0) ::close(fd);
+	start();
+}
+
+VK::SnapshotReader::~SnapshotReader(){
+	if(mapped) munmap(mapped, length);
+}
+
+void VK::SnapshotReader::start(){
+	pos = 0;
+	count = 0;
+	crc = 0;
+	ended = false;
+	VK::BinaryReader reader(data, length);
+	open = reader.getFixed32() == VK::SnapshotWriter::MAGIC && reader.getByte() == VK::SnapshotWriter::VERSION && !reader.failed();
+	error = !open;
+	pos = reader.position();
+}
+
+bool VK::SnapshotReader::isOpen(){
+	return open;
+}
+
+const char *VK::SnapshotReader::record(size_t &size){
+	if(ended || error) return NULL;
+	VK::BinaryReader reader(data + pos, length - pos);
+	const char *value = reader.getString(size);
+	if(!reader.failed() && !size){
+		ended = true;
+		error = reader.getFixed64() != count || reader.getFixed32() != crc || reader.failed();
+		return NULL;
+	}
+	if(reader.failed()){
+		error = true;
+		return NULL;
+	}
+	crc = checksum(data + pos, reader.position(), crc);
+	pos += reader.position();
+	count++;
+	return value;
+}
+
+bool VK::SnapshotReader::next(VK::UserFull &user){
+	size_t size;
+	const char *value = record(size);
+	if(!value) return false;
+	if(VK::UserCodec::decode(value, size, user)) return true;
+	error = true;
+	return false;
+}
+
+bool VK::SnapshotReader::next(VK::UserView &user){
+	size_t size;
+	const char *value = record(size);
+	if(!value) return false;
+	if(user.read(value, size)) return true;
+	error = true;
+	return false;
+}
+
+bool VK::SnapshotReader::complete(){
+	return ended && !error;
+}
+
+size_t VK::SnapshotReader::size(){
+	return count;
+}
+
+bool VK::SnapshotReader::load(const string &path, vector<VK::UserFull> &users){
+	VK::SnapshotReader reader(path);
+	if(!reader.isOpen()) return false;
+	while(true){
+		users.push_back(VK::UserFull());
+		if(!reader.next(users.back())) break;
+	}
+	users.pop_back();
+	return reader.complete();
+}
+
+// USER STORE
+VK::UserStore::UserStore(){
+	garbage = 0;
+}
+
+void VK::UserStore::reserve(size_t users, size_t bytes){
+	slots.reserve(users);
+	ids.reserve(users);
+	if(bytes) records.reserve(bytes);
+}
+
+void VK::UserStore::keys(const VK::UserFull &user, int keys[INDEXES]){
+	keys[CITY] = user.city.id;
+	keys[COUNTRY] = user.country.id;
+	keys[SEX] = user.sex;
+	keys[ONLINE] = user.online ? 1 : 0;
+}
+
+void VK::UserStore::link(uint32_t slot, int index){
+	vector<uint32_t> &list = indexes[index][slots[slot].keys[index]];
+	slots[slot].positions[index] = (uint32_t)list.size();
+	list.push_back(slot);
+}
+
+void VK::UserStore::unlink(uint32_t slot, int index){
+	VK::UserStore::Lists::iterator it = indexes[index].find(slots[slot].keys[index]);
+	vector<uint32_t> &list = it->second;
+
+	// The last slot of the list takes place of the removed one
+	uint32_t position = slots[slot].positions[index];
+	uint32_t moved = list.back();
+	list[position] = moved;
+	slots[moved].positions[index] = position;
+	list.pop_back();
+	if(list.empty()) indexes[index].erase(it);
+}
+
+bool VK::UserStore::put(const VK::UserFull &user){
+	record.clear();
+	VK::UserCodec::encode(user, record);
+	int keys[INDEXES];
+	VK::UserStore::keys(user, keys);
+
+	pair<unordered_map<int, uint32_t>::iterator, bool> inserted = ids.insert(make_pair(user.id, (uint32_t)slots.size()));
+	uint32_t slot = inserted.first->second;
+	if(inserted.second){
+		slots.push_back(VK::UserStore::Slot());
+		slots[slot].id = user.id;
+		for(int i = 0; i < INDEXES; i++){
+			slots[slot].keys[i] = keys[i];
+			link(slot, i);
+		}
+	}else{
+		garbage += slots[slot].length;
+		for(int i = 0; i < INDEXES; i++){
+			if(slots[slot].keys[i] == keys[i]) continue;
+			unlink(slot, i);
+			slots[slot].keys[i] = keys[i];
+			link(slot, i);
+		}
+	}
+	slots[slot].offset = records.size();
+	slots[slot].length = (uint32_t)record.size();
+	records.append(record);
+
+	if(garbage > 1048576 && garbage > records.size() / 2) compact();
+	return inserted.second;
+}
+
+void VK::UserStore::put(const vector<VK::UserFull> &users){
+	for(size_t i = 0; i < users.size(); i++){
+		put(users[i]);
+	}
+}
+
+void VK::UserStore::put(const VK::UsersList &users){
+	put(users.list);
+}
+
+bool VK::UserStore::get(int id, VK::UserFull &user) const{
+	unordered_map<int, uint32_t>::const_iterator it = ids.find(id);
+	if(it == ids.end()) return false;
+	const VK::UserStore::Slot &slot = slots[it->second];
+	return VK::UserCodec::decode(records.data() + slot.offset, slot.length, user);
+}
+
+bool VK::UserStore::view(int id, VK::UserView &user) const{
+	unordered_map<int, uint32_t>::const_iterator it = ids.find(id);
+	if(it == ids.end()) return false;
+	const VK::UserStore::Slot &slot = slots[it->second];
+	return user.read(records.data() + slot.offset, slot.length);
+}
+
+bool VK::UserStore::contains(int id) const{
+	return ids.find(id) != ids.end();
+}
+
+bool VK::UserStore::remove(int id){
+	unordered_map<int, uint32_t>::iterator it = ids.find(id);
+	if(it == ids.end()) return false;
+	uint32_t slot = it->second;
+	ids.erase(it);
+	for(int i = 0; i < INDEXES; i++){
+		unlink(slot, i);
+	}
+	garbage += slots[slot].length;
+
+	// The last slot is moved into the hole, its id and index entries follow it
+	uint32_t last = (uint32_t)slots.size() - 1;
+	if(slot != last){
+		slots[slot] = slots[last];
+		ids[slots[slot].id] = slot;
+		for(int i = 0; i < INDEXES; i++){
+			indexes[i][slots[slot].keys[i]][slots[slot].positions[i]] = slot;
+		}
+	}
+	slots.pop_back();
+	return true;
+}
+
+vector<int> VK::UserStore::find(VK::UserStore::Index index, int key) const{
+	vector<int> found;
+	VK::UserStore::Lists::const_iterator it = indexes[index].find(key);
+	if(it == indexes[index].end()) return found;
+	found.reserve(it->second.size());
+	for(size_t i = 0; i < it->second.size(); i++){
+		found.push_back(slots[it->second[i]].id);
+	}
+	return found;
+}
+
+size_t VK::UserStore::count(VK::UserStore::Index index, int key) const{
+	VK::UserStore::Lists::const_iterator it = indexes[index].find(key);
+	return it == indexes[index].end() ? 0 : it->second.size();
+}
+
+map<int, size_t> VK::UserStore::groups(VK::UserStore::Index index) const{
+	map<int, size_t> groups;
+	VK::UserStore::Lists::const_iterator it;
+	for(it = indexes[index].begin(); it != indexes[index].end(); ++it){
+		groups[it->first] = it->second.size();
+	}
+	return groups;
+}
+
+size_t VK::UserStore::size() const{
+	return slots.size();
+}
+
+void VK::UserStore::clear(){
+	records.clear();
+	garbage = 0;
+	slots.clear();
+	ids.clear();
+	for(int i = 0; i < INDEXES; i++){
+		indexes[i].clear();
+	}
+}
+
+void VK::UserStore::compact(){
+	string compacted;
+	compacted.reserve(records.size() - garbage);
+	for(size_t i = 0; i < slots.size(); i++){
+		uint64_t offset = compacted.size();
+		compacted.append(records, slots[i].offset, slots[i].length);
+		slots[i].offset = offset;
+	}
+	records.swap(compacted);
+	garbage = 0;
+}
+
+VK::UserStore::Stats VK::UserStore::getStats() const{
+	VK::UserStore::Stats stats;
+	stats.users = slots.size();
+	stats.records = records.size() - garbage;
+	stats.garbage = garbage;
+
+	// Nodes of unordered_map hold the value and the next pointer, buckets one pointer
+	size_t node = sizeof(void*) + sizeof(pair<int, uint32_t>);
+	stats.memory = records.capacity() + slots.capacity() * sizeof(VK::UserStore::Slot)
+		+ ids.size() * node + ids.bucket_count() * sizeof(void*);
+	for(int i = 0; i < INDEXES; i++){
+		VK::UserStore::Lists::const_iterator it;
+		for(it = indexes[i].begin(); it != indexes[i].end(); ++it){
+			stats.memory += it->second.capacity() * sizeof(uint32_t) + sizeof(void*) + sizeof(*it);
+		}
+		stats.memory += indexes[i].bucket_count() * sizeof(void*);
+	}
+	return stats;
+}
+
+// PROFILE STORE
+const uint32_t VK::ProfileStore::MAGIC;
+const size_t VK::ProfileStore::HEADER;
+const size_t VK::ProfileStore::RECORD_HEADER;
+const size_t VK::ProfileStore::COMPACT_BUFFER;
+
+/**
+	Write whole buffer at offset, one pwrite may write less than asked
+*/
+static bool writeAll(int fd, const char *data, size_t size, size_t offset){
+	while(size){
+		ssize_t written = pwrite(fd, data, size, (off_t)offset);
+		if(written < 0 && errno == EINTR) continue;
+		if(written <= 0) return false;
+		data += written;
+		size -= (size_t)written;
+		offset += (size_t)written;
+	}
+	return true;
+}
+
+VK::ProfileStore::ProfileStore(const string &path){
+	VK::ProfileStore::path = path;
+	fd = -1;
+	mapped = NULL;
+	mapped_size = 0;
+	file_size = 0;
+	if(!open()) close();
+}
+
+VK::ProfileStore::~ProfileStore(){
+	close();
+}
+
+bool VK::ProfileStore::isOpen(){
+	return fd >= 0;
+}
+
+bool VK::ProfileStore::open(){
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if(fd < 0) return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0) return false;
+	file_size = (size_t)info.st_size;
+
+	if(file_size < HEADER){
+		string header;
+		VK::BinaryWriter writer(header);
+		writer.putFixed32(MAGIC);
+		writer.putFixed32(VK::UserCodec::VERSION);
+		if(ftruncate(fd, 0) != 0 || !writeAll(fd, header.data(), header.size(), 0)) return false;
+		file_size = HEADER;
+	}
+	return remap() && scan();
+}
+
+void VK::ProfileStore::close(){
+	if(mapped) munmap(mapped, mapped_size);
+	mapped = NULL;
+	mapped_size = 0;
+	if(fd >= 0) ::close(fd);
+	fd = -1;
+	index.clear();
+}
+
+bool VK::ProfileStore::remap(){
+	if(mapped) munmap(mapped, mapped_size);
+	mapped = NULL;
+	mapped_size = 0;
+	if(!file_size) return true;
+
+	void *memory = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(memory == MAP_FAILED) return false;
+	mapped = (char*)memory;
+	mapped_size = file_size;
+	return true;
+}
+
+bool VK::ProfileStore::scan(){
+	VK::BinaryReader header(mapped, mapped_size);
+	if(header.getFixed32() != MAGIC) return false;
+	if(header.getFixed32() != VK::UserCodec::VERSION) return false;
+
+	// Payloads are decoded on demand, here they are only checked against their checksums
+	size_t offset = HEADER;
+	while(offset + RECORD_HEADER <= mapped_size){
+		VK::BinaryReader reader(mapped + offset, RECORD_HEADER);
+		uint32_t length = reader.getFixed32();
+		uint32_t crc = reader.getFixed32();
+		int id = (int)reader.getFixed32();
+		int64_t fetched = (int64_t)reader.getFixed64();
+		if(offset + RECORD_HEADER + length > mapped_size) break;
+		if(checksum(mapped + offset + 8, RECORD_HEADER - 8 + length) != crc) break;
+
+		VK::ProfileStore::Location location;
+		location.offset = offset + RECORD_HEADER;
+		location.length = length;
+		location.fetched = fetched;
+		index[id] = location;
+		offset += RECORD_HEADER + length;
+	}
+
+	// Drop the tail of an interrupted append, records after a damaged one can not be trusted
+	if(offset < file_size){
+		if(ftruncate(fd, offset) != 0) return false;
+		file_size = offset;
+		return remap();
+	}
+	return true;
+}
+
+bool VK::ProfileStore::append(const VK::UserFull &user, long long fetched){
+	record.resize(RECORD_HEADER);
+	VK::UserCodec::encode(user, record);
+
+	// Checksum covers id, fetch time and payload
+	string header;
+	VK::BinaryWriter writer(header);
+	writer.putFixed32((uint32_t)user.id);
+	writer.putFixed64((uint64_t)fetched);
+	record.replace(8, RECORD_HEADER - 8, header);
+	header.clear();
+	writer.putFixed32((uint32_t)(record.size() - RECORD_HEADER));
+	writer.putFixed32(checksum(record.data() + 8, record.size() - 8));
+	record.replace(0, 8, header);
+
+	if(!writeAll(fd, record.data(), record.size(), file_size)) return false;
+
+	VK::ProfileStore::Location location;
+	location.offset = file_size + RECORD_HEADER;
+	location.length = (uint32_t)(record.size() - RECORD_HEADER);
+	location.fetched = fetched;
+	index[user.id] = location;
+	file_size += record.size();
+	return true;
+}
+
+bool VK::ProfileStore::put(const VK::UserFull &user, long long fetched){
+	lock_guard<mutex> guard(lock);
+	if(fd < 0) return false;
+	return append(user, fetched ? fetched : (long long)time(NULL));
+}
+
+bool VK::ProfileStore::put(const VK::UsersList &users, long long fetched){
+	lock_guard<mutex> guard(lock);
+	if(fd < 0) return false;
+	if(!fetched) fetched = (long long)time(NULL);
+	for(size_t i = 0; i < users.list.size(); i++){
+		if(!append(users.list[i], fetched)) return false;
+	}
+	return true;
+}
+
+bool VK::ProfileStore::get(int id, VK::UserFull &user, long long max_age){
+	lock_guard<mutex> guard(lock);
+	unordered_map<int, VK::ProfileStore::Location>::iterator it = index.find(id);
+	if(it == index.end()) return false;
+	if(max_age > 0 && (long long)time(NULL) - it->second.fetched > max_age) return false;
+
+	// Records appended after the last mapping need a bigger mapping
+	if(it->second.offset + it->second.length > mapped_size && !remap()) return false;
+	return VK::UserCodec::decode(mapped + it->second.offset, it->second.length, user);
+}
+
+long long VK::ProfileStore::fetchedAt(int id){
+	lock_guard<mutex> guard(lock);
+	unordered_map<int, VK::ProfileStore::Location>::iterator it = index.find(id);
+	return it == index.end() ? 0 : it->second.fetched;
+}
+
+size_t VK::ProfileStore::size(){
+	lock_guard<mutex> guard(lock);
+	return index.size();
+}
+
+bool VK::ProfileStore::sync(){
+	lock_guard<mutex> guard(lock);
+	return fd >= 0 && fsync(fd) == 0;
+}
+
+bool VK::ProfileStore::compact(){
+	lock_guard<mutex> guard(lock);
+	if(fd < 0) return false;
+	if(file_size > mapped_size && !remap()) return false;
+
+	string temporary = path + ".compact";
+	int out = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(out < 0) return false;
+
+	// Records are copied from the mapping through a bounded buffer
+	string buffer(mapped, HEADER);
+	size_t written = 0;
+	bool failed = false;
+	unordered_map<int, VK::ProfileStore::Location> compacted;
+	unordered_map<int, VK::ProfileStore::Location>::iterator it;
+	for(it = index.begin(); it != index.end() && !failed; ++it){
+		VK::ProfileStore::Location location = it->second;
+		size_t start = written + buffer.size();
+		buffer.append(mapped + location.offset - RECORD_HEADER, RECORD_HEADER + location.length);
+		location.offset = start + RECORD_HEADER;
+		compacted[it->first] = location;
+		if(buffer.size() >= COMPACT_BUFFER){
+			failed = !writeAll(out, buffer.data(), buffer.size(), written);
+			written += buffer.size();
+			buffer.clear();
+		}
+	}
+	failed = failed || !writeAll(out, buffer.data(), buffer.size(), written) || fsync(out) != 0;
+	written += buffer.size();
+
+	::close(out);
+	if(failed || rename(temporary.c_str(), path.c_str()) != 0){
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	close();
+	fd = ::open(path.c_str(), O_RDWR);
+	if(fd < 0) return false;
+	file_size = written;
+	index.swap(compacted);
+	return remap();
+}
@@ -0,0 +1,588 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains binary encoding of users, snapshots, indexed user store and persistent profile store
+*/
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+#include "vklib.h"
+#ifndef VKSTORE_H
+#define VKSTORE_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A BinaryWriter class appends varints and length prefixed strings to a buffer
+	*/
+	class BinaryWriter{
+	public:
+		/**
+			@param out buffer to append to
+		*/
+		BinaryWriter(string &out);
+
+		void putByte(uint8_t value);
+		void putVarint(uint64_t value);
+
+		/**
+			Zigzag encoded varint, small negative numbers stay short
+		*/
+		void putSigned(int64_t value);
+		void putString(const string &value);
+		void putString(const char *value, size_t length);
+		void putFixed32(uint32_t value);
+		void putFixed64(uint64_t value);
+
+	private:
+		string &out;
+	};
+
+	/**
+		A BinaryReader class reads values written by BinaryWriter.
+		Reading past the end sets failed() and returns zeros
+	*/
+	class BinaryReader{
+	public:
+		BinaryReader(const char *data, size_t size);
+
+		uint8_t getByte();
+		uint64_t getVarint();
+		int64_t getSigned();
+		uint32_t getFixed32();
+		uint64_t getFixed64();
+		void getString(string &value);
+
+		/**
+			Read string without copying
+
+			@param length string length
+			@return pointer to string characters inside the buffer
+		*/
+		const char *getString(size_t &length);
+
+		bool failed();
+		size_t position();
+
+	private:
+		const char *data;
+		size_t size;
+		size_t pos;
+		bool error;
+	};
+
+	/**
+		A UserCodec class encodes UserFull objects into a compact binary form:
+		varint numbers, length prefixed strings, packed bools and a bitmap of present fields
+	*/
+	class UserCodec{
+	public:
+		static const uint8_t VERSION = 1;
+
+		/**
+			Append encoded user to buffer
+
+			@param user UserFull object
+			@param out buffer
+		*/
+		static void encode(const UserFull &user, string &out);
+
+		/**
+			Decode user
+
+			@param data encoded user
+			@param size size of data
+			@param user UserFull object to fill
+			@return false if data is malformed
+		*/
+		static bool decode(const char *data, size_t size, UserFull &user);
+	};
+
+	/**
+		A StringRef class points to string characters inside an encoded buffer,
+		it is valid while the buffer is
+	*/
+	class StringRef{
+	public:
+		const char *data;
+		size_t length;
+
+		StringRef();
+		string str() const;
+		bool empty() const;
+		bool operator==(const string &other) const;
+		bool operator!=(const string &other) const;
+	};
+
+	/**
+		A UserView class reads fields of a user encoded by UserCodec without
+		copying strings. Universities, schools and counters are skipped, their
+		numbers are kept. Fields which are not present are 0 or empty
+	*/
+	class UserView{
+	public:
+		int id;
+		StringRef first_name;
+		StringRef last_name;
+		bool online;
+		bool online_mobile;
+		bool verified;
+		bool blacklisted;
+		bool has_mobile;
+
+		/**
+			Mask of UserFull::Fields constants present in the record
+		*/
+		uint64_t fields;
+
+		StringRef photo_50;
+		StringRef photo_100;
+		StringRef photo_200;
+		StringRef photo_id;
+		int sex;
+		StringRef bdate;
+		int city_id;
+		StringRef city_title;
+		int country_id;
+		StringRef country_title;
+		StringRef home_town;
+		StringRef domain;
+		StringRef mobile_phone;
+		StringRef home_phone;
+		StringRef site;
+		int university;
+		StringRef university_name;
+		int faculty;
+		StringRef faculty_name;
+		int graduation;
+		size_t universities;
+		size_t schools;
+		StringRef status;
+		long long last_seen_time;
+		int last_seen_platform;
+		int followers_count;
+		int common_count;
+		size_t counters;
+
+		UserView();
+		void clear();
+
+		/**
+			Read user
+
+			@param data encoded user
+			@param size size of data
+			@return false if data is malformed
+		*/
+		bool read(const char *data, size_t size);
+	};
+
+	/**
+		A SnapshotWriter class streams users into a snapshot: a header with magic
+		and format version, every user as varint length and UserCodec record,
+		and an end mark with the number of users and CRC-32 of the records, so a
+		truncated or damaged snapshot is told from a complete one. Records are
+		buffered and written in large blocks
+	*/
+	class SnapshotWriter{
+	public:
+		static const uint32_t MAGIC = 0x4e534b56;
+		static const uint8_t VERSION = 2;
+
+		/**
+			@param out stream to write to, binary mode
+		*/
+		SnapshotWriter(ostream &out);
+
+		/**
+			Finishes snapshot if finish was not called
+		*/
+		~SnapshotWriter();
+
+		void write(const UserFull &user);
+		void write(const vector<UserFull> &users);
+		void write(const UsersList &users);
+
+		/**
+			Write end mark and flush
+
+			@return false on write error
+		*/
+		bool finish();
+
+		/**
+			@return number of written users
+		*/
+		size_t size();
+
+		/**
+			Write users to file
+
+			@param path file path
+			@param users UsersList object
+			@return false on write error
+		*/
+		static bool save(const string &path, const UsersList &users);
+
+	private:
+		static const size_t BLOCK = 65536;
+
+		ostream &out;
+		string buffer;
+		string record;
+		size_t count;
+		uint32_t crc;
+		bool finished;
+
+		bool flush();
+
+		SnapshotWriter(const SnapshotWriter&) = delete;
+		SnapshotWriter &operator=(const SnapshotWriter&) = delete;
+	};
+
+	/**
+		A SnapshotReader class reads users of a snapshot one by one from memory
+		or from a memory mapped file. Records are decoded into UserFull objects
+		or read in place with UserView
+	*/
+	class SnapshotReader{
+	public:
+		/**
+			Read snapshot in memory, data must outlive the reader
+
+			@param data snapshot bytes
+			@param size size of data
+		*/
+		SnapshotReader(const char *data, size_t size);
+
+		/**
+			Map snapshot file
+
+			@param path file path
+		*/
+		SnapshotReader(const string &path);
+		~SnapshotReader();
+
+		/**
+			@return true if header is valid
+		*/
+		bool isOpen();
+
+		/**
+			Decode next user
+
+			@param user UserFull object to fill
+			@return false at the end or on malformed record
+		*/
+		bool next(UserFull &user);
+
+		/**
+			Read next user in place
+
+			@param user UserView object to fill, valid while the reader is
+			@return false at the end or on malformed record
+		*/
+		bool next(UserView &user);
+
+		/**
+			@return true if the end mark was read and number of users and checksum
+			match it. Users read before a damaged record was found are not taken back
+		*/
+		bool complete();
+
+		/**
+			@return number of users read
+		*/
+		size_t size();
+
+		/**
+			Read all users of file
+
+			@param path file path
+			@param users vector to append users to
+			@return false if file can not be read or snapshot is incomplete
+		*/
+		static bool load(const string &path, vector<UserFull> &users);
+
+	private:
+		const char *data;
+		size_t length;
+		size_t pos;
+		size_t count;
+		uint32_t crc;
+		bool open;
+		bool ended;
+		bool error;
+		void *mapped;
+
+		void start();
+
+		/**
+			@param size size of next record
+			@return pointer to next record, NULL at the end
+		*/
+		const char *record(size_t &size);
+
+		SnapshotReader(const SnapshotReader&) = delete;
+		SnapshotReader &operator=(const SnapshotReader&) = delete;
+	};
+
+	/**
+		A UserStore class keeps users in memory encoded by UserCodec and finds
+		them by id in O(1). Secondary indexes list users by city id, country id,
+		sex and online status. Putting a user with a known id replaces the old
+		profile, space of replaced records is reclaimed when it outgrows the live
+		ones. Not thread safe, concurrent readers are fine without writers
+	*/
+	class UserStore{
+	public:
+		/**
+			Secondary indexes
+		*/
+		enum Index{
+			CITY,		///< city id, 0 when unknown
+			COUNTRY,	///< country id, 0 when unknown
+			SEX,		///< 0 unknown, 1 female, 2 male
+			ONLINE,		///< 1 online, 0 offline
+			INDEXES
+		};
+
+		/**
+			A Stats class describes memory of the store
+		*/
+		class Stats{
+		public:
+			size_t users;
+
+			/**
+				Bytes of live records
+			*/
+			size_t records;
+
+			/**
+				Bytes of replaced and removed records not reclaimed yet
+			*/
+			size_t garbage;
+
+			/**
+				Estimated bytes of records, slots, id table and indexes
+			*/
+			size_t memory;
+		};
+
+		UserStore();
+
+		/**
+			Reserve space for users
+
+			@param users number of users
+			@param bytes bytes of encoded records
+		*/
+		void reserve(size_t users, size_t bytes = 0);
+
+		/**
+			Add user or replace user with the same id
+
+			@param user UserFull object
+			@return true if user was added, false if replaced
+		*/
+		bool put(const UserFull &user);
+		void put(const vector<UserFull> &users);
+		void put(const UsersList &users);
+
+		/**
+			Decode user
+
+			@param id user id
+			@param user UserFull object to fill
+			@return false if user is unknown
+		*/
+		bool get(int id, UserFull &user) const;
+
+		/**
+			Read user in place
+
+			@param id user id
+			@param user UserView object to fill, valid until the store is changed
+			@return false if user is unknown
+		*/
+		bool view(int id, UserView &user) const;
+
+		bool contains(int id) const;
+
+		/**
+			@param id user id
+			@return false if user is unknown
+		*/
+		bool remove(int id);
+
+		/**
+			@param index secondary index
+			@param key city id, country id, sex or online status
+			@return ids of users with key, in no particular order
+		*/
+		vector<int> find(Index index, int key) const;
+
+		/**
+			@param index secondary index
+			@param key city id, country id, sex or online status
+			@return number of users with key
+		*/
+		size_t count(Index index, int key) const;
+
+		/**
+			@param index secondary index
+			@return number of users of every key
+		*/
+		map<int, size_t> groups(Index index) const;
+
+		size_t size() const;
+		void clear();
+
+		/**
+			Rewrite records dropping replaced and removed ones
+		*/
+		void compact();
+
+		Stats getStats() const;
+
+	private:
+		class Slot{
+		public:
+			uint64_t offset;
+			uint32_t length;
+			int id;
+			int keys[INDEXES];
+
+			/**
+				Position of slot in the list of its key of every index
+			*/
+			uint32_t positions[INDEXES];
+		};
+
+		typedef unordered_map<int, vector<uint32_t> > Lists;
+
+		string records;
+		size_t garbage;
+		vector<Slot> slots;
+		unordered_map<int, uint32_t> ids;
+		Lists indexes[INDEXES];
+		string record;
+
+		void link(uint32_t slot, int index);
+		void unlink(uint32_t slot, int index);
+		static void keys(const UserFull &user, int keys[INDEXES]);
+	};
+
+	/**
+		A ProfileStore class keeps UserFull objects on disk keyed by user id.
+		Writes are appended to the file, reads go through a memory mapping of it.
+		Every record has the time it was fetched, so stale profiles can be refetched
+	*/
+	class ProfileStore{
+	public:
+		/**
+			Open store, file is created if it does not exist. Records are checked
+			against their checksums, the file is truncated at the first truncated
+			or damaged record. A file written with another UserCodec version is not opened
+
+			@param path file path
+		*/
+		ProfileStore(const string &path);
+		~ProfileStore();
+
+		bool isOpen();
+
+		/**
+			Append user, replaces earlier record with the same id
+
+			@param user UserFull object
+			@param fetched unix time when user was fetched, 0 for now
+			@return false on write error
+		*/
+		bool put(const UserFull &user, long long fetched = 0);
+
+		/**
+			Append users
+
+			@param users UsersList object
+			@param fetched unix time when users were fetched, 0 for now
+			@return false on write error
+		*/
+		bool put(const UsersList &users, long long fetched = 0);
+
+		/**
+			Read user
+
+			@param id user id
+			@param user UserFull object to fill
+			@param max_age maximum age of record in seconds, 0 accepts any age
+			@return false if user is unknown or stale
+		*/
+		bool get(int id, UserFull &user, long long max_age = 0);
+
+		/**
+			@param id user id
+			@return unix time when user was fetched, 0 if unknown
+		*/
+		long long fetchedAt(int id);
+
+		/**
+			@return number of stored users
+		*/
+		size_t size();
+
+		/**
+			Flush appended records to disk
+		*/
+		bool sync();
+
+		/**
+			Rewrite file keeping only the latest record of each user
+		*/
+		bool compact();
+
+	private:
+		class Location{
+		public:
+			uint64_t offset;
+			uint32_t length;
+			int64_t fetched;
+		};
+
+		/**
+			File starts with magic and UserCodec version, every record with
+			payload length, CRC-32, id and fetch time
+		*/
+		static const uint32_t MAGIC = 0x43504b56;
+		static const size_t HEADER = 8;
+		static const size_t RECORD_HEADER = 20;
+		static const size_t COMPACT_BUFFER = 1048576;
+
+		string path;
+		int fd;
+		char *mapped;
+		size_t mapped_size;
+		size_t file_size;
+		unordered_map<int, Location> index;
+		mutex lock;
+		string record;
+
+		bool open();
+		void close();
+		bool scan();
+		bool remap();
+		bool append(const UserFull &user, long long fetched);
+
+		ProfileStore(const ProfileStore&) = delete;
+		ProfileStore &operator=(const ProfileStore&) = delete;
+	};
+}
+#endif
@@ -0,0 +1,584 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include "vkstream.h"
+
+using namespace std;
+
+// JSON STREAM
+VK::JsonStream::JsonStream(Handler *handler){
+	VK::JsonStream::handler = handler;
+	mode = NONE;
+	expect = VALUE;
+	is_key = false;
+	error = false;
+	unicode = 0;
+	surrogate = 0;
+	unicode_digits = 0;
+	fed = 0;
+}
+
+bool VK::JsonStream::failed(){
+	return error;
+}
+
+size_t VK::JsonStream::received(){
+	return fed;
+}
+
+bool VK::JsonStream::feed(const char *data, size_t size){
+	size_t i = 0;
+	fed += size;
+	while(i < size && !error){
+		char c = data[i];
+		switch(mode){
+		case STRING:{
+			// Copy the run up to the next quote, escape or control character at once
+			size_t end = i;
+			while(end < size && data[end] != '"' && data[end] != '\\' && (unsigned char)data[end] >= 0x20) end++;
+			if(end > i && surrogate){
+				// High surrogate not followed by a low one
+				error = true;
+				break;
+			}
+			token.append(data + i, end - i);
+			i = end;
+			if(i == size) break;
+			if(data[i] == '"'){
+				if(surrogate){
+					error = true;
+					break;
+				}
+				mode = NONE;
+				emitString();
+			}else if(data[i] == '\\'){
+				mode = ESCAPE;
+			}else{
+				error = true;
+				break;
+			}
+			i++;
+			break;
+		}
+		case ESCAPE:
+			mode = STRING;
+			if(c != 'u' && surrogate){
+				error = true;
+				break;
+			}
+			switch(c){
+				case 'n': token += '\n'; break;
+				case 't': token += '\t'; break;
+				case 'r': token += '\r'; break;
+				case 'b': token += '\b'; break;
+				case 'f': token += '\f'; break;
+				case '"': case '\\': case '/': token += c; break;
+				case 'u':
+					mode = UNICODE;
+					unicode = 0;
+					unicode_digits = 0;
+					break;
+				default: error = true;
+			}
+			i++;
+			break;
+		case UNICODE:
+			unicode <<= 4;
+			if(c >= '0' && c <= '9') unicode |= c - '0';
+			else if(c >= 'a' && c <= 'f') unicode |= c - 'a' + 10;
+			else if(c >= 'A' && c <= 'F') unicode |= c - 'A' + 10;
+			else error = true;
+			if(++unicode_digits == 4){
+				mode = STRING;
+				bool high = unicode >= 0xD800 && unicode <= 0xDBFF;
+				bool low = unicode >= 0xDC00 && unicode <= 0xDFFF;
+				if(surrogate && low){
+					appendUtf8(0x10000 + ((surrogate - 0xD800) << 10) + (unicode - 0xDC00));
+					surrogate = 0;
+				}else if(surrogate || low){
+					// Unpaired surrogates can not be encoded in UTF-8
+					error = true;
+				}else if(high){
+					surrogate = unicode;
+				}else{
+					appendUtf8(unicode);
+				}
+			}
+			i++;
+			break;
+		case NUMBER:
+			if((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-'){
+				token += c;
+				i++;
+			}else{
+				mode = NONE;
+				emitNumber();
+			}
+			break;
+		case LITERAL:
+			if(c >= 'a' && c <= 'z'){
+				token += c;
+				i++;
+			}else{
+				mode = NONE;
+				emitLiteral();
+			}
+			break;
+		case NONE:
+			i++;
+			switch(c){
+			case ' ': case '\t': case '\r': case '\n':
+				break;
+			case '{':
+			case '[':
+				if(expect != VALUE && expect != FIRST_VALUE){
+					error = true;
+					break;
+				}
+				containers.push_back(c);
+				if(c == '{'){
+					expect = FIRST_KEY;
+					handler->onStartObject();
+				}else{
+					expect = FIRST_VALUE;
+					handler->onStartArray();
+				}
+				break;
+			case '}':
+			case ']':{
+				char open = c == '}' ? '{' : '[';
+				if(containers.empty() || containers.back() != open ||
+					(expect != SEPARATOR && expect != (c == '}' ? FIRST_KEY : FIRST_VALUE))){
+					error = true;
+					break;
+				}
+				containers.pop_back();
+				if(c == '}') handler->onEndObject();
+				else handler->onEndArray();
+				completed();
+				break;
+			}
+			case ':':
+				if(expect != COLON) error = true;
+				else expect = VALUE;
+				break;
+			case ',':
+				if(expect != SEPARATOR) error = true;
+				else expect = containers.back() == '{' ? KEY : VALUE;
+				break;
+			case '"':
+				if(expect == KEY || expect == FIRST_KEY) is_key = true;
+				else if(expect == VALUE || expect == FIRST_VALUE) is_key = false;
+				else{
+					error = true;
+					break;
+				}
+				mode = STRING;
+				token.clear();
+				surrogate = 0;
+				break;
+			default:
+				if(expect != VALUE && expect != FIRST_VALUE){
+					error = true;
+					break;
+				}
+				token.assign(1, c);
+				if(c == '-' || (c >= '0' && c <= '9')) mode = NUMBER;
+				else if(c >= 'a' && c <= 'z') mode = LITERAL;
+				else error = true;
+			}
+			break;
+		}
+	}
+	return !error;
+}
+
+bool VK::JsonStream::finish(){
+	if(!error){
+		if(mode == NUMBER) emitNumber();
+		else if(mode == LITERAL) emitLiteral();
+		else if(mode != NONE) error = true;
+	}
+	mode = NONE;
+	return !error && expect == DONE;
+}
+
+void VK::JsonStream::emitString(){
+	if(is_key){
+		handler->onKey(token);
+		expect = COLON;
+	}else{
+		handler->onString(token);
+		completed();
+	}
+}
+
+/**
+	Check number against JSON grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+
+	@param text number
+	@return true if valid
+*/
+static bool isNumber(const string &text){
+	const char *c = text.c_str();
+	if(*c == '-') c++;
+	if(*c == '0') c++;
+	else if(*c >= '1' && *c <= '9') while(*c >= '0' && *c <= '9') c++;
+	else return false;
+	if(*c == '.'){
+		c++;
+		if(*c < '0' || *c > '9') return false;
+		while(*c >= '0' && *c <= '9') c++;
+	}
+	if(*c == 'e' || *c == 'E'){
+		c++;
+		if(*c == '+' || *c == '-') c++;
+		if(*c < '0' || *c > '9') return false;
+		while(*c >= '0' && *c <= '9') c++;
+	}
+	return *c == 0;
+}
+
+void VK::JsonStream::emitNumber(){
+	if(!isNumber(token)){
+		error = true;
+		return;
+	}
+	handler->onNumber(token);
+	completed();
+}
+
+void VK::JsonStream::emitLiteral(){
+	if(token == "true") handler->onBool(true);
+	else if(token == "false") handler->onBool(false);
+	else if(token == "null") handler->onNull();
+	else{
+		error = true;
+		return;
+	}
+	completed();
+}
+
+void VK::JsonStream::completed(){
+	expect = containers.empty() ? DONE : SEPARATOR;
+}
+
+void VK::JsonStream::appendUtf8(unsigned int code){
+	if(code < 0x80){
+		token += (char)code;
+	}else if(code < 0x800){
+		token += (char)(0xC0 | (code >> 6));
+		token += (char)(0x80 | (code & 0x3F));
+	}else if(code < 0x10000){
+		token += (char)(0xE0 | (code >> 12));
+		token += (char)(0x80 | ((code >> 6) & 0x3F));
+		token += (char)(0x80 | (code & 0x3F));
+	}else{
+		token += (char)(0xF0 | (code >> 18));
+		token += (char)(0x80 | ((code >> 12) & 0x3F));
+		token += (char)(0x80 | ((code >> 6) & 0x3F));
+		token += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+// USERS STREAM
+static int toInt(const string &text){
+	return atoi(text.c_str());
+}
+
+static bool toBool(const string &text){
+	return !text.empty() && text != "0" && text != "false";
+}
+
+static void assign(VK::City &city, const string &key, const string &text){
+	if(key == "id") city.id = toInt(text);
+	else if(key == "title") city.title = text;
+}
+
+static void assign(VK::Country &country, const string &key, const string &text){
+	if(key == "id") country.id = toInt(text);
+	else if(key == "title") country.title = text;
+}
+
+static void assign(VK::Education &education, const string &key, const string &text){
+	if(key == "university") education.university = toInt(text);
+	else if(key == "university_name") education.university_name = text;
+	else if(key == "faculty") education.faculty = toInt(text);
+	else if(key == "faculty_name") education.faculty_name = text;
+	else if(key == "graduation") education.graduation = toInt(text);
+}
+
+static void assign(VK::University &university, const string &key, const string &text){
+	if(key == "id") university.id = toInt(text);
+	else if(key == "country") university.country = toInt(text);
+	else if(key == "city") university.city = toInt(text);
+	else if(key == "name") university.name = text;
+	else if(key == "faculty") university.faculty = toInt(text);
+	else if(key == "faculty_name") university.faculty_name = text;
+	else if(key == "chair") university.chair = toInt(text);
+	else if(key == "chair_name") university.chair_name = text;
+	else if(key == "graduation") university.graduation = toInt(text);
+}
+
+static void assign(VK::School &school, const string &key, const string &text){
+	if(key == "id") school.id = toInt(text);
+	else if(key == "country") school.country = toInt(text);
+	else if(key == "city") school.city = toInt(text);
+	else if(key == "name") school.name = text;
+	else if(key == "year_from") school.year_from = toInt(text);
+	else if(key == "year_to") school.year_to = toInt(text);
+	else if(key == "year_graduated") school.year_graduated = toInt(text);
+	else if(key == "class") school.class_l = text;
+	else if(key == "speciality") school.speciality = text;
+	else if(key == "type") school.type = toInt(text);
+	else if(key == "type_str") school.type_str = text;
+}
+
+static void assign(VK::UserFull &user, const string &key, const string &text){
+	switch(key.empty() ? 0 : key[0]){
+	case 'b':
+		if(key == "blacklisted") user.blacklisted = toBool(text);
+		else if(key == "bdate") user.bdate = text;
+		break;
+	case 'c':
+		if(key == "common_count") user.common_count = toInt(text);
+		break;
+	case 'd':
+		if(key == "domain") user.domain = text;
+		break;
+	case 'f':
+		if(key == "first_name") user.first_name = text;
+		else if(key == "followers_count") user.followers_count = toInt(text);
+		break;
+	case 'h':
+		if(key == "home_town") user.home_town = text;
+		else if(key == "has_mobile") user.has_mobile = toBool(text);
+		break;
+	case 'i':
+		if(key == "id") user.id = toInt(text);
+		break;
+	case 'l':
+		if(key == "last_name") user.last_name = text;
+		break;
+	case 'o':
+		if(key == "online") user.online = toBool(text);
+		else if(key == "online_mobile") user.online_mobile = toBool(text);
+		break;
+	case 'p':
+		if(key == "photo_50") user.photo_50 = text;
+		else if(key == "photo_100") user.photo_100 = text;
+		else if(key == "photo_200") user.photo_200 = text;
+		else if(key == "photo_id") user.photo_id = text;
+		break;
+	case 's':
+		if(key == "sex") user.sex = toInt(text);
+		else if(key == "site") user.site = text;
+		else if(key == "status") user.status = text;
+		break;
+	case 'v':
+		if(key == "verified") user.verified = toBool(text);
+		break;
+	}
+}
+
+/**
+	@param key key of user object
+	@return UserFull::Fields bit of key, 0 for keys read whatever the mask is
+*/
+static unsigned long long fieldOf(const string &key){
+	typedef VK::UserFull::Fields F;
+	switch(key.empty() ? 0 : key[0]){
+	case 'b':
+		if(key == "blacklisted") return F::BLACKLISTED;
+		if(key == "bdate") return F::BDATE;
+		break;
+	case 'c':
+		if(key == "city") return F::CITY;
+		if(key == "country") return F::COUNTRY;
+		if(key == "contacts") return F::CONTACTS;
+		if(key == "counters") return F::COUNTERS;
+		if(key == "common_count") return F::COMMON_COUNT;
+		break;
+	case 'd':
+		if(key == "domain") return F::DOMAIN;
+		break;
+	case 'e':
+		if(key == "education") return F::EDUCATION;
+		break;
+	case 'f':
+		if(key == "followers_count") return F::FOLLOWERS_COUNT;
+		break;
+	case 'h':
+		if(key == "home_town") return F::HOME_TOWN;
+		if(key == "has_mobile") return F::HAS_MOBILE;
+		break;
+	case 'l':
+		if(key == "last_seen") return F::LAST_SEEN;
+		break;
+	case 'o':
+		if(key == "online" || key == "online_mobile") return F::ONLINE;
+		break;
+	case 'p':
+		if(key == "photo_50") return F::PHOTO_50;
+		if(key == "photo_100") return F::PHOTO_100;
+		if(key == "photo_200") return F::PHOTO_200;
+		if(key == "photo_id") return F::PHOTO_ID;
+		break;
+	case 's':
+		if(key == "sex") return F::SEX;
+		if(key == "site") return F::SITE;
+		if(key == "status") return F::STATUS;
+		if(key == "schools") return F::SCHOOLS;
+		break;
+	case 'u':
+		if(key == "universities") return F::UNIVERSITIES;
+		break;
+	case 'v':
+		if(key == "verified") return F::VERIFIED;
+		break;
+	}
+	return 0;
+}
+
+VK::UsersStream::UsersStream(VK::UsersStream::Callback callback, unsigned long long fields){
+	VK::UsersStream::callback = callback;
+	VK::UsersStream::fields = fields;
+	count = 0;
+	error_code = 0;
+	delivered = 0;
+	user_depth = 0;
+	skip_depth = 0;
+}
+
+bool VK::UsersStream::skip(){
+	if(skip_depth){
+		skip_depth++;
+		return true;
+	}
+	if(user_depth && frames.size() == user_depth && fields != VK::UserFull::Fields::ALL){
+		unsigned long long field = fieldOf(key);
+		if(field && !(fields & field)){
+			skip_depth = 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+const string &VK::UsersStream::parentKey(size_t level){
+	static const string none;
+	return level < frames.size() ? frames[frames.size() - 1 - level].key : none;
+}
+
+void VK::UsersStream::push(bool object){
+	VK::UsersStream::Frame frame;
+	frame.object = object;
+	if(!frames.empty() && frames.back().object) frame.key = key;
+	frames.push_back(frame);
+	key.clear();
+}
+
+void VK::UsersStream::pop(){
+	frames.pop_back();
+	if(user_depth && frames.size() < user_depth){
+		user_depth = 0;
+		if(callback){
+			callback(users.back());
+			users.pop_back();
+			delivered++;
+		}
+	}
+}
+
+void VK::UsersStream::onStartObject(){
+	if(skip()) return;
+	push(true);
+	size_t depth = frames.size();
+	if(!user_depth){
+		// users.get: {"response": [user]}, users.search: {"response": {"items": [user]}}
+		bool get = depth == 3 && parentKey(1) == "response";
+		bool search = depth == 4 && parentKey(1) == "items" && parentKey(2) == "response";
+		if((get || search) && !frames[depth - 2].object){
+			users.push_back(VK::UserFull());
+			user_depth = depth;
+		}
+		return;
+	}
+	if(depth == user_depth + 2 && !frames[depth - 2].object){
+		const string &list = parentKey(1);
+		if(list == "universities") users.back().universities.push_back(VK::University());
+		else if(list == "schools") users.back().schools.push_back(VK::School());
+	}
+}
+
+void VK::UsersStream::onEndObject(){
+	if(skip_depth) skip_depth--;
+	else pop();
+}
+
+void VK::UsersStream::onStartArray(){
+	if(skip()) return;
+	push(false);
+}
+
+void VK::UsersStream::onEndArray(){
+	if(skip_depth) skip_depth--;
+	else pop();
+}
+
+void VK::UsersStream::onKey(const string &key){
+	VK::UsersStream::key = key;
+}
+
+void VK::UsersStream::onString(const string &value){
+	VK::UsersStream::value(value);
+}
+
+void VK::UsersStream::onNumber(const string &number){
+	value(number);
+}
+
+void VK::UsersStream::onBool(bool value){
+	VK::UsersStream::value(value ? "1" : "0");
+}
+
+void VK::UsersStream::onNull(){
+	value("");
+}
+
+void VK::UsersStream::value(const string &text){
+	if(!user_depth){
+		if(frames.size() == 2 && frames[1].object){
+			if(frames[1].key == "response" && key == "count") count = toInt(text);
+			else if(frames[1].key == "error" && key == "error_code") error_code = toInt(text);
+			else if(frames[1].key == "error" && key == "error_msg") error_msg = text;
+		}
+		return;
+	}
+
+	if(skip_depth) return;
+	VK::UserFull &user = users.back();
+	size_t level = frames.size() - user_depth;
+	if(level == 0){
+		unsigned long long field = fields != VK::UserFull::Fields::ALL ? fieldOf(key) : 0;
+		if(!field || (fields & field)) assign(user, key, text);
+	}else if(level == 1 && frames.back().object){
+		const string &object = frames.back().key;
+		if(object == "city") assign(user.city, key, text);
+		else if(object == "country") assign(user.country, key, text);
+		else if(object == "education") assign(user.education, key, text);
+		else if(object == "counters") user.counters[key] = toInt(text);
+		else if(object == "contacts"){
+			if(key == "mobile_phone") user.contacts.mobile_phone = text;
+			else if(key == "home_phone") user.contacts.home_phone = text;
+		}else if(object == "last_seen"){
+			if(key == "time") user.last_seen.time = strtoll(text.c_str(), NULL, 10);
+			else if(key == "platform") user.last_seen.platform = toInt(text);
+		}
+	}else if(level == 2 && frames.back().object){
+		const string &list = parentKey(1);
+		if(list == "universities" && !user.universities.empty()) assign(user.universities.back(), key, text);
+		else if(list == "schools" && !user.schools.empty()) assign(user.schools.back(), key, text);
+	}
+}
@@ -0,0 +1,192 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains streaming JSON parser which builds models while bytes arrive
+*/
+#include <string>
+#include <vector>
+#include <functional>
+#include "vklib.h"
+#ifndef VKSTREAM_H
+#define VKSTREAM_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A JsonStream class is a resumable event driven JSON parser.
+		Input may be fed in chunks of any size, events are sent to Handler
+		as soon as a token is complete. Placement of separators, numbers,
+		literals, escapes and surrogate pairs is checked, events sent before
+		a syntax error was found are not taken back
+	*/
+	class JsonStream{
+	public:
+		/**
+			A Handler class receives JSON events
+		*/
+		class Handler{
+		public:
+			virtual ~Handler(){}
+			virtual void onStartObject() = 0;
+			virtual void onEndObject() = 0;
+			virtual void onStartArray() = 0;
+			virtual void onEndArray() = 0;
+			virtual void onKey(const string &key) = 0;
+			virtual void onString(const string &value) = 0;
+
+			/**
+				@param number number text as it is in JSON
+			*/
+			virtual void onNumber(const string &number) = 0;
+			virtual void onBool(bool value) = 0;
+			virtual void onNull() = 0;
+		};
+
+		/**
+			JsonStream constructor
+
+			@param handler events receiver
+		*/
+		JsonStream(Handler *handler);
+
+		/**
+			Parse next chunk
+
+			@param data chunk
+			@param size chunk size
+			@return false on syntax error
+		*/
+		bool feed(const char *data, size_t size);
+
+		/**
+			Finish parsing
+
+			@return true if a complete JSON document was parsed
+		*/
+		bool finish();
+
+		bool failed();
+
+		/**
+			@return number of bytes fed so far
+		*/
+		size_t received();
+
+	private:
+		enum Mode{
+			NONE,
+			STRING,
+			ESCAPE,
+			UNICODE,
+			NUMBER,
+			LITERAL
+		};
+
+		/**
+			What may come next between tokens
+		*/
+		enum Expect{
+			VALUE,			///< value, after ':', ',' in array and at the start
+			FIRST_VALUE,	///< value or ']', after '['
+			KEY,			///< key, after ',' in object
+			FIRST_KEY,		///< key or '}', after '{'
+			COLON,			///< ':', after key
+			SEPARATOR,		///< ',' or closing bracket, after value in container
+			DONE			///< nothing, the document is complete
+		};
+
+		Handler *handler;
+		Mode mode;
+		Expect expect;
+		string token;
+		vector<char> containers;
+		bool is_key;
+		bool error;
+		unsigned int unicode;
+		unsigned int surrogate;
+		int unicode_digits;
+		size_t fed;
+
+		void emitString();
+		void emitNumber();
+		void emitLiteral();
+
+		/**
+			Value was completed, next is a separator or the end
+		*/
+		void completed();
+		void appendUtf8(unsigned int code);
+	};
+
+	/**
+		A UsersStream class builds UserFull objects straight from JSON events of
+		users.get ("response" array) and users.search ("response.items") responses
+	*/
+	class UsersStream: public JsonStream::Handler{
+	public:
+		typedef function<void(UserFull &user)> Callback;
+
+		vector<UserFull> users;
+		int count;
+		int error_code;
+		string error_msg;
+
+		/**
+			Number of users given to callback
+		*/
+		size_t delivered;
+
+		/**
+			UsersStream constructor
+
+			@param callback called with every user as soon as its object is closed,
+			while the rest of the response may still be in transfer. Users given
+			to callback are not kept in users
+			@param fields UserFull::Fields mask, values of other fields are skipped
+			without being assigned or allocated. id and names are always read
+		*/
+		UsersStream(Callback callback = nullptr, unsigned long long fields = UserFull::Fields::ALL);
+
+		void onStartObject();
+		void onEndObject();
+		void onStartArray();
+		void onEndArray();
+		void onKey(const string &key);
+		void onString(const string &value);
+		void onNumber(const string &number);
+		void onBool(bool value);
+		void onNull();
+
+	private:
+		class Frame{
+		public:
+			bool object;
+			string key;
+		};
+
+		vector<Frame> frames;
+		string key;
+		size_t user_depth;
+		Callback callback;
+		unsigned long long fields;
+
+		/**
+			Depth of containers inside a skipped field, 0 outside
+		*/
+		size_t skip_depth;
+
+		/**
+			@return true if container starting now is a field not in mask
+		*/
+		bool skip();
+
+		void value(const string &text);
+		void push(bool object);
+		void pop();
+		const string &parentKey(size_t level);
+	};
+}
+#endif
@@ -0,0 +1,313 @@
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <curl/curl.h>
+#include "vktransport.h"
+
+using namespace std;
+
+// TRANSPORT
+string VK::Transport::key(const string &url, const string &data){
+	string key = url.substr(url.rfind('/') + 1);
+	key += '?';
+
+	// Same request of another user gives the same key
+	size_t start = 0;
+	while(start < data.size()){
+		size_t end = data.find('&', start);
+		if(end == string::npos) end = data.size();
+		if(data.compare(start, 13, "access_token=") != 0){
+			key.append(data, start, end - start);
+			key += '&';
+		}
+		start = end + 1;
+	}
+	return key;
+}
+
+// CURL TRANSPORT
+static size_t CURL_SINK_WRITER(char *data, size_t size, size_t nmemb, const VK::Transport::Sink *sink){
+	if(sink == NULL || !(*sink)(data, size * nmemb)) return 0;
+	return size * nmemb;
+}
+
+VK::CurlTransport::CurlTransport(shared_ptr<VK::CurlPool> pool){
+	VK::CurlTransport::pool = pool;
+}
+
+bool VK::CurlTransport::perform(VK::CurlPool &pool, const string &url, const string &data, const VK::Transport::Sink &sink, string &error, VK::Timing *timing){
+	char errorBuffer[CURL_ERROR_SIZE];
+	errorBuffer[0] = 0;
+
+	CURL *curl = pool.acquire();
+	if(!curl){
+		error = "Failed to create CURL handle";
+		return false;
+	}
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	// Compressed body is inflated by curl before it reaches the sink
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CURL_SINK_WRITER);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+	CURLcode result = curl_easy_perform(curl);
+
+	if(timing){
+		curl_off_t connect = 0, tls = 0, first_byte = 0, transfer = 0, downloaded = 0;
+		curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+		curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+		curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+		curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &transfer);
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+		timing->connect = connect / 1000.0;
+		timing->tls = tls / 1000.0;
+		timing->first_byte = first_byte / 1000.0;
+		timing->transfer = transfer / 1000.0;
+		timing->downloaded = (size_t)downloaded;
+	}
+	pool.release(curl);
+
+	if(result != CURLE_OK){
+		error = errorBuffer[0] ? string(errorBuffer) : string(curl_easy_strerror(result));
+		return false;
+	}
+	return true;
+}
+
+bool VK::CurlTransport::send(const string &url, const string &data, const VK::Transport::Sink &sink, string &error, VK::Timing *timing){
+	return perform(*pool, url, data, sink, error, timing);
+}
+
+void VK::CurlTransport::sendAsync(const string &url, const string &data, const string &key, VK::Transport::Callback callback, chrono::milliseconds delay){
+	shared_ptr<VK::AsyncEngine> engine;
+	{
+		lock_guard<mutex> guard(lock);
+		if(!VK::CurlTransport::engine){
+			VK::CurlTransport::engine = make_shared<VK::AsyncEngine>(pool);
+			VK::CurlTransport::engine->setLimiter(limiter);
+		}
+		engine = VK::CurlTransport::engine;
+	}
+	engine->post(url, data, key, callback, delay);
+}
+
+void VK::CurlTransport::setLimiter(shared_ptr<VK::RateLimiter> limiter){
+	lock_guard<mutex> guard(lock);
+	VK::CurlTransport::limiter = limiter;
+	if(engine) engine->setLimiter(limiter);
+}
+
+// RECORDING TRANSPORT
+VK::RecordingTransport::RecordingTransport(shared_ptr<VK::Transport> transport, const string &path){
+	VK::RecordingTransport::transport = transport;
+	log = make_shared<VK::RecordingTransport::Log>();
+	log->file.open(path.c_str(), ios::out | ios::app | ios::binary);
+}
+
+VK::RecordingTransport::~RecordingTransport(){
+	transport.reset();
+}
+
+bool VK::RecordingTransport::isOpen(){
+	return log->file.is_open();
+}
+
+void VK::RecordingTransport::Log::record(const string &url, const string &data, const string &body){
+	// Record is "key\nlength\nbody\n", body may contain new lines
+	lock_guard<mutex> guard(lock);
+	file << VK::Transport::key(url, data) << '\n' << body.size() << '\n';
+	file.write(body.data(), body.size());
+	file << '\n';
+	file.flush();
+}
+
+bool VK::RecordingTransport::send(const string &url, const string &data, const VK::Transport::Sink &sink, string &error, VK::Timing *timing){
+	string body;
+	bool ok = transport->send(url, data, [&body, &sink](const char *chunk, size_t size){
+		body.append(chunk, size);
+		return sink(chunk, size);
+	}, error, timing);
+	if(ok) log->record(url, data, body);
+	return ok;
+}
+
+void VK::RecordingTransport::sendAsync(const string &url, const string &data, const string &key, VK::Transport::Callback callback, chrono::milliseconds delay){
+	shared_ptr<VK::RecordingTransport::Log> log = VK::RecordingTransport::log;
+	transport->sendAsync(url, data, key, [log, url, data, callback](bool ok, const string &body){
+		if(ok) log->record(url, data, body);
+		callback(ok, body);
+	}, delay);
+}
+
+void VK::RecordingTransport::setLimiter(shared_ptr<VK::RateLimiter> limiter){
+	transport->setLimiter(limiter);
+}
+
+// REPLAY TRANSPORT
+VK::ReplayTransport::ReplayTransport(int latency_ms){
+	latency = chrono::milliseconds(latency_ms);
+	stats.served = 0;
+	stats.missed = 0;
+	stopping = false;
+	delivery = thread(&VK::ReplayTransport::run, this);
+}
+
+VK::ReplayTransport::~ReplayTransport(){
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	delivery.join();
+}
+
+bool VK::ReplayTransport::load(const string &path){
+	ifstream file(path.c_str(), ios::in | ios::binary);
+	if(!file.is_open()) return false;
+
+	string key;
+	string length;
+	while(getline(file, key) && getline(file, length)){
+		char *end;
+		errno = 0;
+		unsigned long size = strtoul(length.c_str(), &end, 10);
+		if(length.empty() || *end || errno || length[0] == '-') return false;
+		shared_ptr<string> body = make_shared<string>(size, '\0');
+		if(size && !file.read(&(*body)[0], size)) return false;
+		file.get();
+
+		lock_guard<mutex> guard(lock);
+		responses[key] = body;
+	}
+	return true;
+}
+
+void VK::ReplayTransport::add(const string &url, const string &data, const string &body){
+	lock_guard<mutex> guard(lock);
+	responses[VK::Transport::key(url, data)] = make_shared<const string>(body);
+}
+
+void VK::ReplayTransport::add(const string &method, const string &body){
+	lock_guard<mutex> guard(lock);
+	responses[method] = make_shared<const string>(body);
+}
+
+void VK::ReplayTransport::setLatency(int latency_ms){
+	lock_guard<mutex> guard(lock);
+	latency = chrono::milliseconds(latency_ms);
+}
+
+VK::ReplayTransport::Stats VK::ReplayTransport::getStats(){
+	lock_guard<mutex> guard(lock);
+	return stats;
+}
+
+void VK::ReplayTransport::setLimiter(shared_ptr<VK::RateLimiter> limiter){
+	lock_guard<mutex> guard(lock);
+	VK::ReplayTransport::limiter = limiter;
+}
+
+shared_ptr<const string> VK::ReplayTransport::find(const string &url, const string &data){
+	string key = VK::Transport::key(url, data);
+	lock_guard<mutex> guard(lock);
+	unordered_map<string, shared_ptr<const string> >::iterator it = responses.find(key);
+	// Responses added for a whole method are found by the part before '?'
+	if(it == responses.end()) it = responses.find(key.substr(0, key.find('?')));
+	if(it == responses.end()){
+		stats.missed++;
+		return shared_ptr<const string>();
+	}
+	stats.served++;
+	return it->second;
+}
+
+bool VK::ReplayTransport::send(const string &url, const string &data, const VK::Transport::Sink &sink, string &error, VK::Timing *timing){
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	shared_ptr<const string> body = find(url, data);
+	chrono::microseconds delay;
+	{
+		lock_guard<mutex> guard(lock);
+		delay = latency;
+	}
+	if(delay.count()) this_thread::sleep_for(delay);
+	if(!body){
+		error = "No recorded response for " + VK::Transport::key(url, data);
+		return false;
+	}
+
+	// Body is handed out in chunks, like a network transfer
+	static const size_t CHUNK = 16384;
+	for(size_t offset = 0; offset < body->size(); offset += CHUNK){
+		if(!sink(body->data() + offset, min(CHUNK, body->size() - offset))){
+			error = "Transfer aborted by receiver";
+			return false;
+		}
+	}
+	if(timing){
+		double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		timing->connect = 0;
+		timing->tls = 0;
+		timing->first_byte = delay.count() / 1000.0;
+		timing->transfer = elapsed;
+		timing->downloaded = body->size();
+	}
+	return true;
+}
+
+void VK::ReplayTransport::sendAsync(const string &url, const string &data, const string &key, VK::Transport::Callback callback, chrono::milliseconds delay){
+	shared_ptr<const string> body = find(url, data);
+	unique_lock<mutex> guard(lock);
+	if(!latency.count() && !delay.count() && !(limiter && !key.empty())){
+		guard.unlock();
+		if(body) callback(true, *body);
+		else callback(false, "No recorded response for " + VK::Transport::key(url, data));
+		return;
+	}
+
+	VK::ReplayTransport::Delivery delivery;
+	delivery.key = key;
+	delivery.found = (bool)body;
+	delivery.body = body ? body : make_shared<const string>("No recorded response for " + VK::Transport::key(url, data));
+	delivery.callback = callback;
+	delivery.queued = chrono::steady_clock::now();
+	chrono::steady_clock::time_point due = chrono::steady_clock::now() + latency + delay;
+	// Delivery thread only needs waking when the earliest due time changes
+	bool earliest = queue.empty() || due < queue.begin()->first;
+	queue.insert(make_pair(due, delivery));
+	if(earliest) wake.notify_one();
+}
+
+void VK::ReplayTransport::run(){
+	unique_lock<mutex> guard(lock);
+	while(true){
+		if(queue.empty()){
+			if(stopping) return;
+			wake.wait(guard);
+			continue;
+		}
+		multimap<chrono::steady_clock::time_point, VK::ReplayTransport::Delivery>::iterator next = queue.begin();
+		if(!stopping && next->first > chrono::steady_clock::now()){
+			wake.wait_until(guard, next->first);
+			continue;
+		}
+		VK::ReplayTransport::Delivery delivery = next->second;
+		queue.erase(next);
+
+		// A throttled key is queued again for its next slot, deliveries of other keys go on.
+		// Remaining deliveries are completed without waiting when transport is destroyed
+		chrono::steady_clock::duration retry;
+		if(delivery.found && limiter && !delivery.key.empty() && !stopping && !limiter->tryAcquire(delivery.key, delivery.queued, retry)){
+			queue.insert(make_pair(chrono::steady_clock::now() + retry, delivery));
+			continue;
+		}
+		guard.unlock();
+		delivery.callback(delivery.found, *delivery.body);
+		guard.lock();
+	}
+}
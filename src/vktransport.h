@@ -0,0 +1,250 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains transports which deliver API requests: libcurl, record and replay
+*/
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <unordered_map>
+#include "vklib.h"
+#ifndef VKTRANSPORT_H
+#define VKTRANSPORT_H
+
+using namespace std;
+
+namespace VK{
+	/**
+		A Transport class sends request bodies to API urls. API uses libcurl
+		directly until a transport is set with API::setTransport
+	*/
+	class Transport{
+	public:
+		/**
+			Receives response bytes as they arrive
+
+			@return false to abort transfer
+		*/
+		typedef function<bool(const char *data, size_t size)> Sink;
+
+		/**
+			Completion callback
+
+			@param ok true when transfer succeeded
+			@param body response body or error text
+		*/
+		typedef function<void(bool ok, const string &body)> Callback;
+
+		virtual ~Transport(){}
+
+		/**
+			Blocking request
+
+			@param url request url
+			@param data data string
+			@param sink receiver of response bytes
+			@param error error text on failure
+			@param timing filled with request timing when not NULL
+			@return true if transfer succeeded
+		*/
+		virtual bool send(const string &url, const string &data, const Sink &sink, string &error, Timing *timing = NULL) = 0;
+
+		/**
+			Queued request, callback may run on another thread
+
+			@param url request url
+			@param data data string
+			@param key rate limiter key, empty when not limited
+			@param callback completion callback
+			@param delay time to wait before sending
+		*/
+		virtual void sendAsync(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay = chrono::milliseconds(0)) = 0;
+
+		/**
+			Set rate limiter consulted before queued requests with a key are sent
+
+			@param limiter RateLimiter object or NULL
+		*/
+		virtual void setLimiter(shared_ptr<RateLimiter> limiter) = 0;
+
+		/**
+			@param url request url
+			@param data data string
+			@return method name and data without access token, equal for the same request of any user
+		*/
+		static string key(const string &url, const string &data);
+	};
+
+	/**
+		A CurlTransport class sends requests with libcurl, blocking ones on
+		handles of a CurlPool and queued ones on an AsyncEngine
+	*/
+	class CurlTransport: public Transport{
+	public:
+		/**
+			@param pool handles pool, may be shared with API objects
+		*/
+		CurlTransport(shared_ptr<CurlPool> pool);
+
+		bool send(const string &url, const string &data, const Sink &sink, string &error, Timing *timing = NULL);
+		void sendAsync(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay = chrono::milliseconds(0));
+		void setLimiter(shared_ptr<RateLimiter> limiter);
+
+		/**
+			HTTP Post request on a handle checked out from pool
+
+			@param pool handles pool
+			@param url request url
+			@param data data string
+			@param sink receiver of response bytes
+			@param error curl error text on failure
+			@param timing filled with request timing when not NULL
+			@return true if transfer succeeded
+		*/
+		static bool perform(CurlPool &pool, const string &url, const string &data, const Sink &sink, string &error, Timing *timing = NULL);
+
+	private:
+		shared_ptr<CurlPool> pool;
+		shared_ptr<RateLimiter> limiter;
+		shared_ptr<AsyncEngine> engine;
+		mutex lock;
+	};
+
+	/**
+		A RecordingTransport class passes requests to another transport and
+		appends every successful response to a file readable by ReplayTransport
+	*/
+	class RecordingTransport: public Transport{
+	public:
+		/**
+			@param transport transport which sends requests
+			@param path file to append responses to
+		*/
+		RecordingTransport(shared_ptr<Transport> transport, const string &path);
+
+		/**
+			Releases the inner transport first, requests it completes while
+			shutting down are still recorded
+		*/
+		~RecordingTransport();
+
+		bool isOpen();
+		bool send(const string &url, const string &data, const Sink &sink, string &error, Timing *timing = NULL);
+		void sendAsync(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay = chrono::milliseconds(0));
+		void setLimiter(shared_ptr<RateLimiter> limiter);
+
+	private:
+		/**
+			A Log class is the output file, shared with callbacks of pending
+			requests, which may run after the transport is destroyed
+		*/
+		class Log{
+		public:
+			ofstream file;
+			mutex lock;
+
+			void record(const string &url, const string &data, const string &body);
+		};
+
+		shared_ptr<Transport> transport;
+		shared_ptr<Log> log;
+	};
+
+	/**
+		A ReplayTransport class answers requests with recorded responses without
+		network. Responses are matched by Transport::key, requests nothing was
+		recorded for fail. Latency is added to every response, queued requests
+		are completed by one delivery thread in order of their due time
+	*/
+	class ReplayTransport: public Transport{
+	public:
+		/**
+			A Stats class describes served requests
+		*/
+		class Stats{
+		public:
+			size_t served;
+			size_t missed;
+		};
+
+		/**
+			@param latency_ms milliseconds added to every response
+		*/
+		ReplayTransport(int latency_ms = 0);
+
+		/**
+			Completes queued requests and stops delivery thread
+		*/
+		~ReplayTransport();
+
+		/**
+			Load responses written by RecordingTransport
+
+			@param path file path
+			@return false if file can not be read or is malformed
+		*/
+		bool load(const string &path);
+
+		/**
+			Add response
+
+			@param url request url
+			@param data data string
+			@param body response body
+		*/
+		void add(const string &url, const string &data, const string &body);
+
+		/**
+			Add response for every request of method
+
+			@param method method name
+			@param body response body
+		*/
+		void add(const string &method, const string &body);
+
+		void setLatency(int latency_ms);
+		Stats getStats();
+
+		bool send(const string &url, const string &data, const Sink &sink, string &error, Timing *timing = NULL);
+		void sendAsync(const string &url, const string &data, const string &key, Callback callback, chrono::milliseconds delay = chrono::milliseconds(0));
+		void setLimiter(shared_ptr<RateLimiter> limiter);
+
+	private:
+		class Delivery{
+		public:
+			string key;
+			bool found;
+			shared_ptr<const string> body;
+			Callback callback;
+
+			/**
+				Time when the request was queued, for rate limiter wait statistics
+			*/
+			chrono::steady_clock::time_point queued;
+		};
+
+		unordered_map<string, shared_ptr<const string> > responses;
+		chrono::microseconds latency;
+		shared_ptr<RateLimiter> limiter;
+		Stats stats;
+		mutex lock;
+		condition_variable wake;
+		multimap<chrono::steady_clock::time_point, Delivery> queue;
+		bool stopping;
+		thread delivery;
+
+		shared_ptr<const string> find(const string &url, const string &data);
+		void run();
+
+		ReplayTransport(const ReplayTransport&) = delete;
+		ReplayTransport &operator=(const ReplayTransport&) = delete;
+	};
+}
+#endif
@@ -0,0 +1,125 @@
+/*!
+	@file
+	@brief Header file
+	@author Philip Pavo
+
+	Contains allocation counting and payloads shared by tests and benchmarks.
+	Replaces the global operator new, include it in one file of a program
+*/
+#include <string>
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include "../src/vklib.h"
+#ifndef FIXTURES_H
+#define FIXTURES_H
+
+using namespace std;
+
+// ALLOCATION COUNTING
+static atomic<size_t> allocations(0);
+static atomic<size_t> allocated(0);
+
+/**
+	Not inlined, otherwise GCC sees free() of memory from operator new and warns
+*/
+__attribute__((noinline)) static void release(void *memory){
+	free(memory);
+}
+
+void *operator new(size_t size){
+	allocations++;
+	allocated += size;
+	void *memory = malloc(size ? size : 1);
+	if(!memory) throw bad_alloc();
+	return memory;
+}
+
+void *operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void *memory) noexcept{
+	release(memory);
+}
+
+void operator delete[](void *memory) noexcept{
+	release(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept{
+	release(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept{
+	release(memory);
+}
+
+// PAYLOADS
+/**
+	@param id user id
+	@return user as users.get returns it with all fields the library parses
+*/
+inline Json::Value user(int id){
+	Json::Value user;
+	user["id"] = id;
+	user["first_name"] = "Александр";
+	user["last_name"] = "Иванов-" + to_string(id % 97);
+	user["online"] = id % 2;
+	user["online_mobile"] = id % 3 == 0;
+	user["photo_50"] = "https://pp.userapi.com/c" + to_string(id) + "/v" + to_string(id * 7) + "/a1b2c3_50.jpg";
+	user["photo_100"] = "https://pp.userapi.com/c" + to_string(id) + "/v" + to_string(id * 7) + "/a1b2c3_100.jpg";
+	user["photo_200"] = "https://pp.userapi.com/c" + to_string(id) + "/v" + to_string(id * 7) + "/a1b2c3_200.jpg";
+	user["photo_id"] = to_string(id) + "_456239017";
+	user["verified"] = 0;
+	user["blacklisted"] = 0;
+	user["sex"] = 1 + id % 2;
+	user["bdate"] = to_string(1 + id % 28) + "." + to_string(1 + id % 12) + ".1990";
+	user["city"]["id"] = 1 + id % 20;
+	user["city"]["title"] = id % 2 ? "Москва" : "Санкт-Петербург";
+	user["country"]["id"] = 1;
+	user["country"]["title"] = "Россия";
+	user["home_town"] = "Новосибирск";
+	user["domain"] = "id" + to_string(id);
+	user["has_mobile"] = 1;
+	user["contacts"]["mobile_phone"] = "+7 900 000-00-" + to_string(id % 100);
+	user["contacts"]["home_phone"] = "";
+	user["site"] = "https://example.com/" + to_string(id);
+	user["education"]["university"] = 2;
+	user["education"]["university_name"] = "МГУ";
+	user["education"]["faculty"] = 20;
+	user["education"]["faculty_name"] = "Механико-математический факультет";
+	user["education"]["graduation"] = 2012;
+	Json::Value university;
+	university["id"] = 2;
+	university["country"] = 1;
+	university["city"] = 1;
+	university["name"] = "МГУ";
+	university["faculty"] = 20;
+	university["faculty_name"] = "Механико-математический факультет";
+	university["chair"] = 1802;
+	university["chair_name"] = "Кафедра теории вероятностей";
+	university["graduation"] = 2012;
+	user["universities"].append(university);
+	Json::Value school;
+	school["id"] = 1000 + id % 50;
+	school["country"] = 1;
+	school["city"] = 1;
+	school["name"] = "Школа № " + to_string(1 + id % 50);
+	school["year_from"] = 1997;
+	school["year_to"] = 2007;
+	school["year_graduated"] = 2007;
+	school["class"] = "а";
+	school["type"] = 0;
+	school["type_str"] = "Школа";
+	user["schools"].append(school);
+	user["status"] = "Статус пользователя номер " + to_string(id);
+	user["last_seen"]["time"] = 1500000000 + id;
+	user["last_seen"]["platform"] = 1 + id % 7;
+	user["followers_count"] = id * 3;
+	user["common_count"] = id % 11;
+	user["counters"]["friends"] = 150 + id % 300;
+	user["counters"]["photos"] = id % 400;
+	return user;
+}
+#endif
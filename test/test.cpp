@@ -0,0 +1,747 @@
+/*!
+	@file
+	@brief Tests of library behaviour the compiler can not check
+	@author Philip Pavo
+
+	Every check prints its result, the exit code is the number of failed checks.
+	Allocations are counted by replacing the global operator new
+*/
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <new>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <sys/stat.h>
+#include "../src/vklib.h"
+#include "../src/vkcolumns.h"
+#include "../src/vkparams.h"
+#include "../src/vkquery.h"
+#include "../src/vkstream.h"
+#include "../src/vktransport.h"
+#include "../src/vkstore.h"
+#include "fixtures.h"
+
+using namespace std;
+
+// RUNNER
+static int failures = 0;
+
+/**
+	Print check result
+
+	@param name check name
+	@param ok check passed
+	@param note measured values
+*/
+static void check(const string &name, bool ok, const string &note = ""){
+	printf("%-4s %-52s %s\n", ok ? "ok" : "FAIL", name.c_str(), note.c_str());
+	if(!ok) failures++;
+}
+
+/**
+	@param users number of users
+	@param operation code to measure
+	@return allocations per user
+*/
+template<typename Operation> static double perUser(size_t users, Operation operation){
+	size_t before = allocations;
+	operation();
+	return (double)(allocations - before) / users;
+}
+
+// CASES
+static void batching(){
+	// Second and fourth calls fail, the third one returns an empty list
+	Json::Value resp;
+	resp["success"] = true;
+	resp["response"].append(Json::Value(Json::arrayValue));
+	resp["response"].append(false);
+	resp["response"].append(Json::Value(Json::arrayValue));
+	resp["response"].append(false);
+	Json::Value error;
+	error["method"] = "users.get";
+	error["error_code"] = 113;
+	resp["execute_errors"].append(error);
+	error["error_code"] = 18;
+	resp["execute_errors"].append(error);
+	vector<Json::Value> results = VK::ExecuteBatcher::results(4, resp);
+	check("ExecuteBatcher maps execute errors to failed calls by position", results.size() == 4
+		&& results[0]["success"].asBool() && results[2]["success"].asBool() && results[2]["response"].isArray()
+		&& !results[1]["success"].asBool() && results[1]["error"]["error_code"].asInt() == 113
+		&& !results[3]["success"].asBool() && results[3]["error"]["error_code"].asInt() == 18);
+
+	Json::Value failed;
+	failed["success"] = false;
+	results = VK::ExecuteBatcher::results(2, failed);
+	check("ExecuteBatcher passes failed execute to every call", results.size() == 2 && results[0] == failed && results[1] == failed);
+
+	check("ExecuteBatcher sends methods returning false directly", VK::ExecuteBatcher::batchable("users.get")
+		&& !VK::ExecuteBatcher::batchable("groups.isMember") && !VK::ExecuteBatcher::batchable("users.isAppUser")
+		&& !VK::ExecuteBatcher::batchable("auth.checkPhone"));
+}
+
+static void parsing(){
+	const size_t count = 1000;
+	Json::Value items(Json::arrayValue);
+	for(size_t i = 0; i < count; i++){
+		items.append(user((int)i + 1));
+	}
+
+	// A user owns 8 strings too long for inline storage, universities and schools vectors
+	// and 2 counters nodes. The ceiling leaves room for growth of the users vector, a
+	// Json::Value or model copy of every user would exceed it
+	vector<VK::UserFull> users;
+	double parsed = perUser(count, [&](){
+		VK::UsersList::parse(items, users);
+	});
+	check("UsersList::parse fills every user", users.size() == count && users[count - 1].id == (int)count
+		&& users[0].schools.size() == 1 && users[0].city.title == "Москва");
+
+	char note[128];
+	snprintf(note, sizeof(note), "%.1f allocs/user", parsed);
+	check("UsersList::parse allocates only owned storage", parsed <= 13.0, note);
+
+	// Strings and vectors of reused users keep their capacity, only the counters map nodes are new
+	double reused = perUser(count, [&](){
+		for(size_t i = 0; i < count; i++){
+			VK::UserFull::parse(items[(int)i], users[i]);
+		}
+	});
+	snprintf(note, sizeof(note), "%.1f allocs/user", reused);
+	check("parse into reused storage allocates at most 2 per user", reused <= 2.0, note);
+
+	// Results are handed over without copying users
+	double handed = perUser(count, [&](){
+		VK::UsersList list(std::move(users));
+		users = list.take();
+	});
+	snprintf(note, sizeof(note), "%.1f allocs/user", handed);
+	check("UsersList moves users in and out", handed == 0 && users.size() == count, note);
+}
+
+/**
+	A Events class records JSON events as text
+*/
+class Events: public VK::JsonStream::Handler{
+public:
+	string text;
+
+	void onStartObject(){ text += '{'; }
+	void onEndObject(){ text += '}'; }
+	void onStartArray(){ text += '['; }
+	void onEndArray(){ text += ']'; }
+	void onKey(const string &key){ text += "k:" + key + ' '; }
+	void onString(const string &value){ text += "s:" + value + ' '; }
+	void onNumber(const string &number){ text += "n:" + number + ' '; }
+	void onBool(bool value){ text += value ? "true " : "false "; }
+	void onNull(){ text += "null "; }
+};
+
+/**
+	@param json document
+	@param chunk bytes fed at once
+	@param events received events
+	@return true if the document was accepted
+*/
+static bool stream(const string &json, size_t chunk, string *events = NULL){
+	Events handler;
+	VK::JsonStream stream(&handler);
+	for(size_t i = 0; i < json.size(); i += chunk){
+		if(!stream.feed(json.data() + i, min(chunk, json.size() - i))) return false;
+	}
+	bool ok = stream.finish();
+	if(events) *events = handler.text;
+	return ok;
+}
+
+static void streaming(){
+	const string valid = " {\"a\": [1, -2.5e3, true, null, {}, []], \"b\": \"x\\u00e9\\ud83d\\ude00\\n\", \"c\": {\"d\": false}} ";
+	const string expected = "{k:a [n:1 n:-2.5e3 true null {}[]]k:b s:x\xC3\xA9\xF0\x9F\x98\x80\n k:c {k:d false }}";
+	bool accepted = true;
+	for(size_t chunk = 1; chunk <= valid.size(); chunk++){
+		string events;
+		accepted = accepted && stream(valid, chunk, &events) && events == expected;
+	}
+	check("JsonStream accepts valid JSON in chunks of any size", accepted);
+	check("JsonStream accepts scalar documents", stream("0", 1) && stream("\"\"", 2) && stream("[]", 1));
+
+	const char *malformed[] = {
+		"{\"a\" 1 2}", "{\"a\" 1}", "{\"a\":1 \"b\":2}", "{\"a\":1,}", "{,\"a\":1}", "{\"a\"::1}",
+		"{1:2}", "{\"a\":}", "[1 2]", "[1,]", "[,1]", "[1,,2]", "[1:2]", "{\"a\":1]", "[}", "{} {}", "1 2",
+		"[01]", "[1.]", "[-]", "[1e]", "[1-2]", "[nul]", "[\"\\ud83d\"]", "[\"\\ud83dx\"]", "[\"\\ud83d\\n\"]",
+		"[\"\\ude00\"]", "[\"\\q\"]", "[\"a\nb\"]", "", "  ", "[", "{\"a\":1"
+	};
+	size_t rejected = 0;
+	for(const char *json : malformed){
+		if(!stream(json, 1) && !stream(json, 64)) rejected++;
+		else printf("     accepted %s\n", json);
+	}
+	check("JsonStream rejects misplaced separators and bad tokens", rejected == sizeof(malformed) / sizeof(*malformed));
+}
+
+static void projection(){
+	// Unrequested fields, nested ones included, are skipped by UsersStream
+	Json::Value response;
+	response["response"].append(user(7));
+	string text = Json::FastWriter().write(response);
+	VK::UsersStream all;
+	VK::UsersStream projected(nullptr, VK::UserFull::Fields::parse("sex,city"));
+	bool parsed = true;
+	for(VK::UsersStream *users : {&all, &projected}){
+		VK::JsonStream json(users);
+		parsed = parsed && json.feed(text.data(), text.size()) && json.finish() && users->users.size() == 1;
+	}
+	check("UsersStream reads every field without mask", parsed && all.users[0].schools.size() == 1
+		&& all.users[0].status != "" && all.users[0].last_seen.time == 1500000007 && all.users[0].counters["friends"] == 157);
+	const VK::UserFull &only = projected.users[0];
+	check("UsersStream skips fields not in mask", parsed && only.id == 7 && only.first_name == "Александр"
+		&& only.sex == 2 && only.city.id == 8 && only.city.title == "Москва" && only.country.id == 0 && only.schools.empty()
+		&& only.status.empty() && only.photo_50.empty() && only.last_seen.time == 0 && only.counters.empty());
+}
+
+static void columns(){
+	vector<VK::UserFull> users(100);
+	for(size_t i = 0; i < users.size(); i++) VK::UserFull::parse(user((int)i + 1), users[i]);
+	VK::UsersColumns columns(users);
+	bool same = columns.size() == users.size();
+	for(size_t i = 0; same && i < users.size(); i++){
+		VK::UserFull stored = columns.get(i);
+		same = stored.id == users[i].id && stored.first_name == users[i].first_name && stored.status == users[i].status
+			&& stored.photo_200 == users[i].photo_200 && stored.city.title == users[i].city.title;
+	}
+	check("UsersColumns keeps strings in 8 byte references", same && sizeof(VK::UsersColumns::Str) == 8);
+}
+
+static void pooling(){
+	Json::Value items(Json::arrayValue);
+	Json::Value item = user(1);
+	item["city"]["title"] = "Город только для пула теста";
+	items.append(item);
+
+	size_t before = VK::StringPool::shared().getStats().strings;
+	vector<VK::UserFull> users;
+	size_t scoped;
+	{
+		VK::StringPool pool;
+		{
+			VK::StringPool::Scope scope(pool);
+			VK::UsersList::parse(items, users);
+			check("StringPool::Scope makes its pool current", &VK::StringPool::current() == &pool);
+			scoped = pool.getStats().strings;
+			users.clear();
+		}
+		check("StringPool::Scope restores the shared pool", &VK::StringPool::current() == &VK::StringPool::shared());
+	}
+	size_t after = VK::StringPool::shared().getStats().strings;
+	char note[128];
+	snprintf(note, sizeof(note), "%zu strings in scoped pool, shared grew by %zu", scoped, after - before);
+	check("models parsed in a Scope intern into its pool", scoped >= 3 && after == before, note);
+}
+
+/**
+	@param id user id
+	@return users.get parameters of user
+*/
+static map<string, string> userIds(int id){
+	map<string, string> params;
+	params["user_ids"] = to_string(id);
+	return params;
+}
+
+static void params(){
+	// Keys in map order, so both encodings list them the same way
+	vector<int> ids = {1, 5, -42};
+	vector<string> fields = {"photo_50", "city"};
+	VK::Params params;
+	params.set("a b", "x&y=z").set(VK::Keys::COUNT, 1000).set(VK::Keys::FIELDS, fields).set(VK::Keys::LAT, 55.75)
+		.set(VK::Keys::ONLINE, true).set(VK::Keys::Q, "Павел Дуров +%").set(VK::Keys::USER_IDS, ids);
+	map<string, string> data;
+	data["a b"] = "x&y=z";
+	data["count"] = "1000";
+	data["fields"] = "photo_50,city";
+	data["lat"] = "55.75";
+	data["online"] = "1";
+	data["q"] = "Павел Дуров +%";
+	data["user_ids"] = "1,5,-42";
+	string encoded;
+	params.encode(encoded);
+	check("Params encodes like Utils::data2str", encoded == VK::Utils::data2str(data));
+
+	// Values set again for every page take no more room than the longest of them
+	params.clear();
+	params.set(VK::Keys::Q, "Павел Дуров");
+	size_t size = 0;
+	for(int page = 0; page < 100; page++){
+		params.set(VK::Keys::OFFSET, page * 1000).set(VK::Keys::Q, page % 2 ? "Павел" : "Павел Дуров")
+			.set(VK::Keys::USER_IDS, ids).set("page", to_string(page % 10));
+		if(page == 1) size = params.encodedSize();
+	}
+	string q;
+	encoded.clear();
+	params.encode(encoded);
+	check("Params writes values set again over the old ones", params.get("q", q) && q == "Павел"
+		&& encoded.find("page=9&") != string::npos && params.encodedSize() == size && perUser(1, [&](){
+			params.set(VK::Keys::Q, "Дуров").set(VK::Keys::FIELDS, fields).set(VK::Keys::USER_IDS, ids);
+		}) == 0);
+
+	check("Parameters::join keeps characters", VK::Parameters::join(1, 'a', "durov") == "1,a,durov");
+}
+
+static void caching(){
+	Json::Value response;
+	response["response"] = "x";
+	response["success"] = true;
+	Json::Value found;
+
+	// APIs of different languages or versions do not get each other's responses
+	VK::API ru("5.131", "ru", true, "token"), en("5.131", "en", true, "token"), old("5.0", "ru", true, "token");
+	const string scope = ru.cacheScope();
+	VK::ResponseCache cache;
+	cache.put("users.get", userIds(1), scope, "token", response);
+	check("ResponseCache keeps API versions and languages apart", cache.get("users.get", userIds(1), ru.cacheScope(), "token", found)
+		&& !cache.get("users.get", userIds(1), en.cacheScope(), "token", found)
+		&& !cache.get("users.get", userIds(1), old.cacheScope(), "token", found));
+	cache.invalidate("users.get", userIds(1), scope, "token");
+
+	cache.put("execute", userIds(1), scope, "token", response);
+	cache.setTTL("users.get", 0);
+	cache.put("users.get", userIds(1), scope, "token", response);
+	check("ResponseCache skips execute and methods with TTL 0", !cache.get("execute", userIds(1), scope, "token", found)
+		&& !cache.get("users.get", userIds(1), scope, "token", found) && cache.getStats().entries == 0);
+
+	cache.setTTL("users.get", 1);
+	cache.put("users.get", userIds(1), scope, "token", response);
+	bool fresh = cache.get("users.get", userIds(1), scope, "token", found) && found == response;
+	this_thread::sleep_for(chrono::milliseconds(1100));
+	check("ResponseCache expires responses after TTL", fresh && !cache.get("users.get", userIds(1), scope, "token", found)
+		&& cache.getStats().entries == 0);
+
+	// Room for 3 responses, the least recently used one goes first
+	cache.put("users.get", userIds(1), scope, "token", response);
+	size_t entry = cache.getStats().bytes;
+	VK::ResponseCache lru(entry * 3 + entry / 2);
+	for(int id = 1; id <= 3; id++) lru.put("users.get", userIds(id), scope, "token", response);
+	bool used = lru.get("users.get", userIds(1), scope, "token", found);
+	lru.put("users.get", userIds(4), scope, "token", response);
+	check("ResponseCache evicts least recently used responses", used && lru.getStats().evictions == 1
+		&& !lru.get("users.get", userIds(2), scope, "token", found) && lru.get("users.get", userIds(1), scope, "token", found)
+		&& lru.get("users.get", userIds(3), scope, "token", found) && lru.get("users.get", userIds(4), scope, "token", found));
+}
+
+/**
+	@param path file path
+	@return file size, 0 if it does not exist
+*/
+static size_t fileSize(const string &path){
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 ? (size_t)info.st_size : 0;
+}
+
+/**
+	Overwrite bytes of file like a crash or a bad disk would
+
+	@param path file path
+	@param offset position to write at, file size to append
+	@param bytes bytes to write
+*/
+static void damage(const string &path, size_t offset, const string &bytes){
+	fstream file(path.c_str(), ios::in | ios::out | ios::binary);
+	file.seekp((streamoff)offset);
+	file.write(bytes.data(), bytes.size());
+}
+
+/**
+	@param id user id
+	@return first name of the latest record of user written by profiles()
+*/
+static string profileName(int id){
+	return "Имя " + to_string(id) + (id % 4 == 1 ? " v2" : " v1");
+}
+
+/**
+	@param store store to read
+	@param users number of users with ids from 1
+	@return true if every user is read with its latest first name
+*/
+static bool latest(VK::ProfileStore &store, int users){
+	if(store.size() != (size_t)users) return false;
+	for(int id = 1; id <= users; id++){
+		VK::UserFull user;
+		if(!store.get(id, user) || user.first_name != profileName(id) || user.city.title != "Москва") return false;
+	}
+	return true;
+}
+
+static void profiles(){
+	const string path = "vktest-profiles.bin";
+	remove(path.c_str());
+	const int users = 100;
+	{
+		VK::ProfileStore store(path);
+		VK::UserFull profile;
+		VK::UserFull::parse(user(1), profile);
+		for(int id = 1; id <= users; id++){
+			profile.id = id;
+			profile.first_name = "Имя " + to_string(id) + " v1";
+			store.put(profile, 1500000000);
+		}
+		// Odd ids are written again, the last record is user 99 with an unchanged name
+		for(int id = 1; id <= users; id += 2){
+			profile.id = id;
+			profile.first_name = profileName(id);
+			store.put(profile, 1500000000);
+		}
+		check("ProfileStore get returns latest records", latest(store, users));
+	}
+	size_t size = fileSize(path);
+	{
+		VK::ProfileStore store(path);
+		check("ProfileStore reopens with latest records", latest(store, users));
+	}
+
+	// Header and part of the payload of an interrupted append
+	ifstream file(path.c_str(), ios::binary);
+	string head(40, '\0');
+	file.seekg(8);
+	file.read(&head[0], head.size());
+	file.close();
+	damage(path, size, head);
+	{
+		VK::ProfileStore store(path);
+		check("ProfileStore drops a partly written record", latest(store, users) && fileSize(path) == size);
+	}
+
+	// A flipped payload byte of the last record leaves the earlier record of user 99
+	damage(path, size - 3, "\xff");
+	{
+		VK::ProfileStore store(path);
+		check("ProfileStore truncates at a damaged record", latest(store, users) && fileSize(path) < size);
+		size = fileSize(path);
+		check("ProfileStore compact keeps latest records", store.compact() && latest(store, users) && fileSize(path) < size);
+	}
+	{
+		VK::ProfileStore store(path);
+		check("ProfileStore reopens compacted file", latest(store, users));
+	}
+	remove(path.c_str());
+}
+
+static void transports(){
+	const string path = "vktest-recording.txt";
+	remove(path.c_str());
+	const string url = "https://api.vk.com/method/users.get";
+	const string body = "{\"response\":[{\"id\":1}]}\n";
+
+	// Inner transport outlives the recorder and completes the pending request when destroyed
+	shared_ptr<VK::ReplayTransport> inner = make_shared<VK::ReplayTransport>(60000);
+	inner->add("users.get", body);
+	size_t completed = 0;
+	{
+		VK::RecordingTransport recorder(inner, path);
+		recorder.sendAsync(url, "user_ids=1&access_token=a", "", [&completed](bool ok, const string &){
+			if(ok) completed++;
+		});
+	}
+	inner.reset();
+
+	VK::ReplayTransport replay;
+	string received, error;
+	bool loaded = replay.load(path);
+	bool sent = replay.send(url, "user_ids=1&access_token=b", [&received](const char *data, size_t size){
+		received.append(data, size);
+		return true;
+	}, error);
+	check("RecordingTransport records requests completed after it", completed == 1 && loaded && sent && received == body);
+	remove(path.c_str());
+
+	// APIs of different languages sharing a cache send their own requests
+	shared_ptr<VK::ReplayTransport> origin = make_shared<VK::ReplayTransport>();
+	origin->add("users.get", "{\"response\":[{\"id\":1,\"first_name\":\"Павел\"}]}");
+	shared_ptr<VK::ResponseCache> shared = make_shared<VK::ResponseCache>();
+	VK::API ru("5.131", "ru", true, "token"), en("5.131", "en", true, "token"), old("5.0", "ru", true, "token");
+	VK::API *apis[] = {&ru, &en, &old, &ru, &en, &old};
+	for(VK::API *api : apis){
+		api->setTransport(origin);
+		api->cache = shared;
+		api->call("users.get", userIds(1));
+	}
+	VK::ResponseCache::Stats stats = shared->getStats();
+	check("API calls through a shared cache keep settings apart", origin->getStats().served == 3 && stats.hits == 3 && stats.entries == 3);
+}
+
+/**
+	@param store store to check
+	@param expected users the store must hold
+	@return true if every user, index list and count of store matches expected
+*/
+static bool consistent(const VK::UserStore &store, const map<int, VK::UserFull> &expected){
+	if(store.size() != expected.size()) return false;
+	map<int, vector<int> > lists[VK::UserStore::INDEXES];
+	for(map<int, VK::UserFull>::const_iterator it = expected.begin(); it != expected.end(); ++it){
+		const VK::UserFull &user = it->second;
+		VK::UserFull stored;
+		VK::UserView view;
+		if(!store.contains(user.id) || !store.get(user.id, stored) || !store.view(user.id, view)) return false;
+		if(stored.first_name != user.first_name || stored.city.id != user.city.id || stored.online != user.online) return false;
+		if(view.id != user.id || view.first_name != user.first_name || view.city_id != user.city.id || view.sex != user.sex) return false;
+		lists[VK::UserStore::CITY][user.city.id].push_back(user.id);
+		lists[VK::UserStore::COUNTRY][user.country.id].push_back(user.id);
+		lists[VK::UserStore::SEX][user.sex].push_back(user.id);
+		lists[VK::UserStore::ONLINE][user.online ? 1 : 0].push_back(user.id);
+	}
+	for(int index = 0; index < VK::UserStore::INDEXES; index++){
+		map<int, size_t> groups = store.groups((VK::UserStore::Index)index);
+		size_t keys = 0;
+		for(map<int, size_t>::const_iterator it = groups.begin(); it != groups.end(); ++it){
+			if(it->second) keys++;
+		}
+		if(keys != lists[index].size()) return false;
+		for(map<int, vector<int> >::iterator it = lists[index].begin(); it != lists[index].end(); ++it){
+			vector<int> found = store.find((VK::UserStore::Index)index, it->first);
+			sort(found.begin(), found.end());
+			sort(it->second.begin(), it->second.end());
+			if(found != it->second || store.count((VK::UserStore::Index)index, it->first) != found.size()) return false;
+		}
+	}
+	return true;
+}
+
+static void retries(){
+	VK::RetryPolicy policy(5, 100, 5000, 0);
+	policy.seed(42);
+	bool classified = policy.isRetriable(-1) && policy.isRetriable(1) && policy.isRetriable(6) && policy.isRetriable(10)
+		&& !policy.isRetriable(0) && !policy.isRetriable(5) && !policy.isRetriable(15);
+	policy.setRetriable(9, true);
+	policy.setRetriable(10, false);
+	chrono::milliseconds delay, none(0);
+	classified = classified && policy.next("wall.post", 9, 0, none, delay) && !policy.next("users.get", 10, 0, none, delay)
+		&& !policy.next("users.get", 0, 0, none, delay) && !policy.next("users.get", 6, 5, none, delay);
+	check("RetryPolicy retries only retriable codes", classified);
+
+	bool reads = policy.isIdempotent("users.get") && policy.isIdempotent("users.search") && policy.isIdempotent("groups.isMember")
+		&& policy.isIdempotent("users.getFollowers") && policy.isIdempotent("auth.checkPhone") && !policy.isIdempotent("wall.post")
+		&& !policy.isIdempotent("messages.send") && !policy.isIdempotent("photos.issue") && !policy.isIdempotent("execute");
+	policy.setIdempotent("wall.post", true);
+	policy.setIdempotent("users.get", false);
+	reads = reads && policy.isIdempotent("wall.post") && !policy.isIdempotent("users.get");
+	check("RetryPolicy tells reads by name and overrides", reads);
+	check("RetryPolicy retries transport errors of reads only", policy.next("users.search", -1, 0, none, delay)
+		&& policy.next("wall.post", -1, 0, none, delay) && !policy.next("messages.send", -1, 0, none, delay)
+		&& !policy.next("users.get", -1, 0, none, delay) && policy.next("messages.send", 6, 0, none, delay));
+
+	// Same seed gives the same delays, every delay stays under its cap
+	VK::RetryPolicy first(20, 100, 5000, 0), second(20, 100, 5000, 0);
+	first.seed(7);
+	second.seed(7);
+	bool repeated = true, capped = true;
+	for(int retry = 0; retry < 20; retry++){
+		chrono::milliseconds a, b;
+		repeated = repeated && first.next("users.get", 6, retry, none, a) && second.next("users.get", 6, retry, none, b) && a == b;
+		capped = capped && a.count() <= min(5000.0, 100 * pow(2.0, retry));
+	}
+	check("RetryPolicy jitter repeats with a fixed seed", repeated);
+	check("RetryPolicy delays stay under exponential cap", capped);
+
+	// Maximum below base is raised to base, not the other way round
+	VK::RetryPolicy clamped(20, 500, 100, 0);
+	clamped.seed(7);
+	long long longest = 0;
+	for(int trial = 0; trial < 200; trial++){
+		clamped.next("users.get", 6, 10, none, delay);
+		longest = max(longest, (long long)delay.count());
+	}
+	check("RetryPolicy raises maximum delay to base", longest <= 500 && longest > 100, to_string(longest) + " ms longest");
+
+	VK::RetryPolicy budget(20, 1000, 1000, 1500);
+	budget.seed(7);
+	bool bounded = true;
+	for(int waited = 0; waited <= 1500; waited += 50){
+		bool retried = budget.next("users.get", 6, 3, chrono::milliseconds(waited), delay);
+		bounded = bounded && retried == (waited + delay.count() <= 1500);
+	}
+	check("RetryPolicy stops when budget is spent", bounded);
+}
+
+/**
+	@param snapshot snapshot bytes
+	@param users users read
+	@return true if every record was read and the snapshot is complete
+*/
+static bool readSnapshot(const string &snapshot, vector<VK::UserFull> &users){
+	VK::SnapshotReader reader(snapshot.data(), snapshot.size());
+	VK::UserFull user;
+	while(reader.next(user)) users.push_back(user);
+	return reader.complete();
+}
+
+static void snapshots(){
+	Json::Value items(Json::arrayValue);
+	for(int id = 1; id <= 300; id++){
+		items.append(user(id));
+	}
+	vector<VK::UserFull> users;
+	VK::UsersList::parse(items, users);
+
+	ostringstream out(ios::binary);
+	{
+		VK::SnapshotWriter writer(out);
+		writer.write(users);
+		check("SnapshotWriter finishes", writer.finish() && writer.size() == users.size());
+	}
+	const string snapshot = out.str();
+
+	vector<VK::UserFull> read;
+	bool same = readSnapshot(snapshot, read) && read.size() == users.size();
+	for(size_t i = 0; same && i < users.size(); i++){
+		same = read[i].id == users[i].id && read[i].first_name == users[i].first_name && read[i].status == users[i].status
+			&& read[i].city.title == users[i].city.title && read[i].schools.size() == 1 && read[i].schools[0].name == users[i].schools[0].name
+			&& read[i].last_seen.time == users[i].last_seen.time && read[i].counters == users[i].counters;
+	}
+	check("snapshot round trip keeps users", same);
+
+	VK::SnapshotReader reader(snapshot.data(), snapshot.size());
+	VK::UserView view;
+	size_t viewed = 0;
+	bool in_place = true;
+	while(reader.next(view)){
+		const VK::UserFull &user = users[viewed++];
+		in_place = in_place && view.id == user.id && view.first_name == user.first_name && view.status == user.status
+			&& view.city_title == user.city.title && view.schools == 1
+			&& view.first_name.data > snapshot.data() && view.first_name.data < snapshot.data() + snapshot.size();
+	}
+	check("snapshot UserView reads strings in place", in_place && viewed == users.size() && reader.complete());
+
+	const string path = "vktest-snapshot.bin";
+	read.clear();
+	bool saved = VK::SnapshotWriter::save(path, VK::UsersList(users));
+	check("snapshot file round trip", saved && VK::SnapshotReader::load(path, read) && read.size() == users.size()
+		&& read.back().first_name == users.back().first_name);
+	remove(path.c_str());
+
+	size_t cuts[] = {0, 3, 5, 100, snapshot.size() / 2, snapshot.size() - 13, snapshot.size() - 4, snapshot.size() - 1};
+	bool truncated = true;
+	for(size_t cut : cuts){
+		read.clear();
+		truncated = truncated && !readSnapshot(snapshot.substr(0, cut), read);
+	}
+	check("truncated snapshot is rejected", truncated);
+
+	// Flipped bytes inside a string and inside a length still decode, the checksum catches them
+	bool damaged = true;
+	size_t offsets[] = {snapshot.size() / 2, 6, snapshot.size() - 5};
+	for(size_t offset : offsets){
+		string copy = snapshot;
+		copy[offset] ^= 0x20;
+		read.clear();
+		damaged = damaged && !readSnapshot(copy, read);
+	}
+	check("damaged snapshot is rejected", damaged);
+}
+
+static void stores(){
+	// Random puts, upserts changing indexed fields and removes, which move the last slot
+	VK::UserStore store;
+	map<int, VK::UserFull> expected;
+	unsigned int seed = 12345;
+	bool upserts = true, removes = true, compacted = true;
+	for(int step = 0; step < 20000; step++){
+		seed = seed * 1103515245 + 12345;
+		unsigned int random = seed >> 8;
+		int id = 1 + (int)(random % 500);
+		if(random % 4 == 0){
+			bool removed = store.remove(id);
+			removes = removes && removed == (expected.erase(id) == 1);
+		}else{
+			VK::UserFull user = VK::UserFull();
+			user.id = id;
+			user.first_name = "Пользователь " + to_string(random % 1000);
+			user.sex = (int)(random / 7 % 3);
+			user.online = random / 11 % 2 == 1;
+			user.city.id = (int)(random / 13 % 20);
+			user.country.id = (int)(random / 17 % 5);
+			bool added = store.put(user);
+			upserts = upserts && added == (expected.find(id) == expected.end());
+			expected[id] = user;
+		}
+		if(step % 5000 == 4999){
+			store.compact();
+			compacted = compacted && store.getStats().garbage == 0 && consistent(store, expected);
+		}
+	}
+	check("UserStore put tells additions from replacements", upserts);
+	check("UserStore remove reports known ids", removes);
+	check("UserStore slots and indexes follow upserts and removes", consistent(store, expected), to_string(store.size()) + " users");
+	check("UserStore get and view after compact", compacted);
+	bool gone = true;
+	for(int id = 1; id <= 500; id++){
+		VK::UserFull user;
+		if(expected.find(id) == expected.end()) gone = gone && !store.contains(id) && !store.get(id, user);
+	}
+	check("UserStore forgets removed ids", gone);
+}
+
+static void queries(){
+	// Enough rows for 4 parts, threads are started whatever number of cores the machine has
+	const size_t count = 4 * VK::UsersQuery::MIN_ROWS + 1234;
+	VK::UsersColumns columns;
+	VK::UserFull user = VK::UserFull();
+	size_t expected = 0;
+	long long followers = 0;
+	map<long long, size_t> countries;
+	vector<int> ids;
+	for(size_t i = 0; i < count; i++){
+		user.id = (int)i + 1;
+		user.sex = (int)(i * 7 % 3);
+		user.online = i % 5 < 2;
+		user.city.id = (int)(i * 31 % 100);
+		user.country.id = (int)(i % 7);
+		user.last_seen.time = 1500000000 + (long long)(i * 13 % 86400);
+		user.followers_count = (int)(i * 17 % 1000) - 10;
+		columns.push_back(user);
+		if(user.sex == 2 && user.online && user.last_seen.time >= 1500003600 && user.followers_count >= 0){
+			expected++;
+			if(user.city.id == 42) followers += user.followers_count;
+			countries[user.country.id]++;
+			ids.push_back(user.id);
+		}
+	}
+
+	size_t threads[] = {1, 4};
+	for(int t = 0; t < 2; t++){
+		VK::UsersQuery query(columns);
+		query.threads(threads[t]).where(VK::UsersQuery::SEX, 2).where(VK::UsersQuery::ONLINE, 1)
+			.where(VK::UsersQuery::LAST_SEEN, 1500003600, 1LL << 40).where(VK::UsersQuery::FOLLOWERS_COUNT, 0, 1 << 30);
+		string name = "UsersQuery threads(" + to_string(threads[t]) + ") ";
+		check(name + "count", query.count() == expected, to_string(expected) + " users");
+		check(name + "ids in columns order", query.ids() == ids);
+		check(name + "countBy", query.countBy(VK::UsersQuery::COUNTRY) == countries);
+		map<long long, VK::UsersQuery::Group> cities = query.groupBy(VK::UsersQuery::CITY, VK::UsersQuery::FOLLOWERS_COUNT);
+		check(name + "groupBy sum", cities[42].sum == followers);
+	}
+}
+
+int main(){
+	batching();
+	parsing();
+	streaming();
+	projection();
+	columns();
+	pooling();
+	params();
+	caching();
+	profiles();
+	transports();
+	retries();
+	snapshots();
+	stores();
+	queries();
+	return failures;
+}